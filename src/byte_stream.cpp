@@ -0,0 +1,449 @@
+/***********************************************************************
+ * Filename: byte_stream.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the ByteStream class. A read stream runs as an
+ *     ESPNowTxn stream on the bulk lane, it ends when the credit is used
+ *     up and is started again by the next CREDIT. A write stream grants
+ *     new credit after half of the window has arrived, a frame after a
+ *     gap asks the master to go back to the expected offset. All
+ *     handlers and callbacks run in the ESP-NOW receive task.
+ *
+ ***********************************************************************/
+
+#include "byte_stream.h"
+#include "common.h"
+#include "log.h"
+#include <LittleFS.h>
+
+ByteStream_t ByteStream::streams[BS_MAX_STREAMS];
+const ByteStreamIo_t *ByteStream::resources[BS_RES_NMR];
+const TxnPolicy_t ByteStream::DataPolicy = {5, 0, 0};
+const ByteStreamIo_t ByteStream::fileIo = {fileOpen, fileRead, fileWrite, fileClose};
+
+static File streamFiles[BS_MAX_STREAMS];
+
+ByteStream_t *ByteStream::find(const uint8_t *mac_addr, uint8_t id)
+{
+    for (uint8_t i = 0; i < BS_MAX_STREAMS; i++)
+    {
+        if (streams[i].used && (streams[i].id == id) && (memcmp(streams[i].peer_addr, mac_addr, 6) == 0))
+        {
+            return &streams[i];
+        }
+    }
+    return NULL;
+}
+
+ByteStream_t *ByteStream::allocate(const uint8_t *mac_addr, uint8_t id)
+{
+    ByteStream_t *s = NULL;
+    for (uint8_t i = 0; (i < BS_MAX_STREAMS) && (s == NULL); i++)
+    {
+        if (!streams[i].used)
+        {
+            s = &streams[i];
+        }
+        else if ((millis() - streams[i].lastActivity) > BS_IDLE_TIMEOUT_MS)
+        {
+            release(&streams[i], false);
+            s = &streams[i];
+        }
+    }
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    memset(s, 0, sizeof(ByteStream_t));
+    memcpy(s->peer_addr, mac_addr, 6);
+    s->id = id;
+    s->txn = TXN_INVALID;
+    s->lastActivity = millis();
+    s->used = true;
+    return s;
+}
+
+void ByteStream::release(ByteStream_t *s, bool ok)
+{
+    if (!s->used)
+    {
+        return;
+    }
+    /* Cleared first, the abort below reports back through onDataDone */
+    TxnHandle_t txn = s->txn;
+    s->txn = TXN_INVALID;
+    s->used = false;
+    if (s->io != NULL)
+    {
+        s->io->close(s - streams, ok);
+    }
+    ESPNowTxn::Abort(txn);
+}
+
+void ByteStream::fill(ByteStreamPayload *frame, uint8_t id, ByteStreamOp_t op, uint32_t index, uint32_t bytes, ByteStreamStatus_t status)
+{
+    frame->max_mr_bytes = bytes;
+    frame->type = BS_TYPE(op, id);
+    frame->data.index = index;
+    frame->data.nmr = 1;
+    frame->data.data[0] = status;
+}
+
+void ByteStream::reply(const uint8_t *mac_addr, uint8_t id, ByteStreamOp_t op, uint32_t index, uint32_t bytes, ByteStreamStatus_t status)
+{
+    ByteStreamPayload frame;
+    fill(&frame, id, op, index, bytes, status);
+    ESPNowTxn::Send(mac_addr, MSG_BYTE_STREAM, (const uint8_t *)&frame, BS_HEADER_SIZE + frame.data.nmr);
+}
+
+void ByteStream::grantCredit(ByteStream_t *s)
+{
+    s->sinceCredit = 0;
+    s->limit = s->offset + s->window * BS_CHUNK_SIZE;
+    reply(s->peer_addr, s->id, BS_OP_CREDIT, s->offset, s->limit, BS_STATUS_OK);
+}
+
+void ByteStream::pump(ByteStream_t *s)
+{
+    if (s->write || s->closeSent || ESPNowTxn::IsActive(s->txn))
+    {
+        return;
+    }
+    if ((s->offset < s->end) && (s->offset >= s->limit))
+    {
+        return;
+    }
+    s->txn = ESPNowTxn::Stream(s->peer_addr, dataSource, s, DataPolicy, onDataDone);
+}
+
+bool ByteStream::dataSource(void *ctx, Message *msg)
+{
+    ByteStream_t *s = (ByteStream_t *)ctx;
+    ByteStreamPayload *frame = (ByteStreamPayload *)msg->payload;
+    if (!s->used || s->closeSent)
+    {
+        return false;
+    }
+    msg->messageType = MSG_BYTE_STREAM;
+
+    if (s->offset < s->end)
+    {
+        if (s->offset >= s->limit)
+        {
+            return false;
+        }
+        /* The resource reads straight into the frame */
+        uint8_t len = (uint8_t)min((uint32_t)BS_CHUNK_SIZE, s->end - s->offset);
+        int n = s->io->read(s - streams, s->offset, frame->data.data, len);
+        if (n > 0)
+        {
+            frame->max_mr_bytes = s->end;
+            frame->type = BS_TYPE(BS_OP_DATA, s->id);
+            frame->data.index = s->offset;
+            frame->data.nmr = n;
+            msg->payloadSize = BS_HEADER_SIZE + n;
+            s->offset += n;
+            return true;
+        }
+        if (n < 0)
+        {
+            s->status = BS_STATUS_IO_ERROR;
+        }
+        s->end = s->offset;
+    }
+
+    fill(frame, s->id, BS_OP_CLOSE, s->offset, s->end, s->status);
+    msg->payloadSize = BS_HEADER_SIZE + frame->data.nmr;
+    s->closeSent = true;
+    return true;
+}
+
+void ByteStream::onDataDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+{
+    ByteStream_t *s = (ByteStream_t *)ctx;
+    if (!s->used || (s->txn != handle))
+    {
+        return;
+    }
+    s->txn = TXN_INVALID;
+    if (result != TXN_OK)
+    {
+        /* The master resumes by opening the stream again at its offset */
+        release(s, false);
+    }
+    else if (s->closeSent)
+    {
+        release(s, s->status == BS_STATUS_OK);
+    }
+    else
+    {
+        pump(s);
+    }
+}
+
+void ByteStream::handleOpen(const uint8_t *mac_addr, const ByteStreamPayload *frame)
+{
+    const ByteStreamOpenPayload *request = (const ByteStreamOpenPayload *)frame->data.data;
+    uint8_t id = BS_ID(frame->type);
+    if (frame->data.nmr < offsetof(ByteStreamOpenPayload, name))
+    {
+        return;
+    }
+    char name[sizeof(request->name) + 1];
+    size_t nameLen = frame->data.nmr - offsetof(ByteStreamOpenPayload, name);
+    memcpy(name, request->name, nameLen);
+    name[nameLen] = '\0';
+
+    const ByteStreamIo_t *io = (request->resource < BS_RES_NMR) ? resources[request->resource] : NULL;
+    if (io == NULL)
+    {
+        reply(mac_addr, id, BS_OP_OPEN_ACK, frame->data.index, 0, BS_STATUS_NO_RESOURCE);
+        return;
+    }
+
+    ByteStream_t *s = find(mac_addr, id);
+    if (s != NULL)
+    {
+        release(s, false);
+    }
+    s = allocate(mac_addr, id);
+    if (s == NULL)
+    {
+        reply(mac_addr, id, BS_OP_OPEN_ACK, frame->data.index, 0, BS_STATUS_BUSY);
+        return;
+    }
+
+    bool write = (request->flags & BS_OPEN_WRITE) != 0;
+    uint32_t size = write ? frame->max_mr_bytes : 0;
+    if (!io->open(s - streams, name, write, frame->data.index, &size))
+    {
+        s->used = false;
+        reply(mac_addr, id, BS_OP_OPEN_ACK, frame->data.index, 0, BS_STATUS_OPEN_FAILED);
+        return;
+    }
+
+    s->io = io;
+    s->write = write;
+    s->window = (request->window != 0) ? request->window : BS_DEFAULT_WINDOW;
+    s->offset = frame->data.index;
+    s->limit = s->offset + s->window * BS_CHUNK_SIZE;
+    s->end = size;
+    if (write)
+    {
+        reply(mac_addr, id, BS_OP_OPEN_ACK, s->offset, s->limit, BS_STATUS_OK);
+        return;
+    }
+
+    if (s->offset > s->end)
+    {
+        s->offset = s->end;
+    }
+    if ((frame->max_mr_bytes != 0) && ((s->end - s->offset) > frame->max_mr_bytes))
+    {
+        s->end = s->offset + frame->max_mr_bytes;
+    }
+    reply(mac_addr, id, BS_OP_OPEN_ACK, s->offset, s->end, BS_STATUS_OK);
+    pump(s);
+}
+
+void ByteStream::handleData(ByteStream_t *s, const ByteStreamPayload *frame)
+{
+    if (!s->write || (frame->data.nmr == 0) || (frame->data.index < s->offset))
+    {
+        return;
+    }
+    if (frame->data.index > s->offset)
+    {
+        grantCredit(s);
+        return;
+    }
+    if (!s->io->write(s - streams, s->offset, frame->data.data, frame->data.nmr))
+    {
+        reply(s->peer_addr, s->id, BS_OP_CLOSE, s->offset, 0, BS_STATUS_IO_ERROR);
+        release(s, false);
+        return;
+    }
+    s->offset += frame->data.nmr;
+    if (++s->sinceCredit >= ((s->window + 1) / 2))
+    {
+        grantCredit(s);
+    }
+}
+
+void ByteStream::handleCredit(ByteStream_t *s, const ByteStreamPayload *frame)
+{
+    if (s->write)
+    {
+        return;
+    }
+    if (frame->data.index < s->offset)
+    {
+        /* The slot lives until the CLOSE is acknowledged, an unacknowledged CLOSE is taken back */
+        s->offset = frame->data.index;
+        s->closeSent = false;
+    }
+    if (frame->max_mr_bytes > s->limit)
+    {
+        s->limit = frame->max_mr_bytes;
+    }
+    pump(s);
+}
+
+void ByteStream::handleClose(ByteStream_t *s, const ByteStreamPayload *frame)
+{
+    if (!s->write)
+    {
+        release(s, true);
+        return;
+    }
+    bool ok = (frame->data.nmr > 0) && (frame->data.data[0] == BS_STATUS_OK) && (frame->data.index == s->offset);
+    uint8_t mac_addr[6];
+    memcpy(mac_addr, s->peer_addr, 6);
+    uint8_t id = s->id;
+    uint32_t offset = s->offset;
+    release(s, ok);
+    reply(mac_addr, id, BS_OP_CLOSE, offset, offset, ok ? BS_STATUS_OK : BS_STATUS_ABORTED);
+}
+
+void ByteStream::onMessage(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    const ByteStreamPayload *frame = (const ByteStreamPayload *)payload;
+    if (frame->data.nmr > (payloadSize - BS_HEADER_SIZE))
+    {
+        SystemLog::PutLog("ESP-Now byte stream frame too short", v_warning);
+        return;
+    }
+
+    uint8_t op = BS_OP(frame->type);
+    if (op == BS_OP_OPEN)
+    {
+        handleOpen(mac_addr, frame);
+        return;
+    }
+
+    ByteStream_t *s = find(mac_addr, BS_ID(frame->type));
+    if (s == NULL)
+    {
+        /* Lost after a restart or a timeout, the master has to open it again */
+        if (op != BS_OP_CLOSE)
+        {
+            reply(mac_addr, BS_ID(frame->type), BS_OP_CLOSE, frame->data.index, 0, BS_STATUS_ABORTED);
+        }
+        return;
+    }
+    s->lastActivity = millis();
+
+    switch (op)
+    {
+    case BS_OP_DATA:
+        handleData(s, frame);
+        break;
+    case BS_OP_CREDIT:
+        handleCredit(s, frame);
+        break;
+    case BS_OP_CLOSE:
+        handleClose(s, frame);
+        break;
+    default:
+        break;
+    }
+}
+
+bool ByteStream::fileOpen(uint8_t slot, const char *name, bool write, uint32_t offset, uint32_t *size)
+{
+    if (name[0] != '/')
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(storageFS_lock);
+    File &file = streamFiles[slot];
+    if (!write)
+    {
+        file = storageFS.open(name, "r");
+        if (!file || file.isDirectory() || (offset > file.size()))
+        {
+            file.close();
+            return false;
+        }
+        *size = file.size();
+        return true;
+    }
+
+    /* A write resumes at the end of what arrived before, earlier data is kept */
+    if (offset == 0)
+    {
+        file = storageFS.open(name, "w", true);
+    }
+    else
+    {
+        file = storageFS.open(name, "r+");
+        if (file && ((file.size() < offset) || !file.seek(offset)))
+        {
+            file.close();
+        }
+    }
+    return (bool)file;
+}
+
+int ByteStream::fileRead(uint8_t slot, uint32_t offset, uint8_t *buf, uint8_t len)
+{
+    std::lock_guard<std::mutex> lock(storageFS_lock);
+    File &file = streamFiles[slot];
+    if ((file.position() != offset) && !file.seek(offset))
+    {
+        return -1;
+    }
+    return file.read(buf, len);
+}
+
+bool ByteStream::fileWrite(uint8_t slot, uint32_t offset, const uint8_t *buf, uint8_t len)
+{
+    std::lock_guard<std::mutex> lock(storageFS_lock);
+    File &file = streamFiles[slot];
+    if ((file.position() != offset) && !file.seek(offset))
+    {
+        return false;
+    }
+    return file.write(buf, len) == len;
+}
+
+void ByteStream::fileClose(uint8_t slot, bool ok)
+{
+    std::lock_guard<std::mutex> lock(storageFS_lock);
+    streamFiles[slot].close();
+}
+
+void ByteStream::Init(void)
+{
+    RegisterResource(BS_RES_FILE, &fileIo);
+    ESPNowCtrl::RegisterHandler(MSG_BYTE_STREAM, onMessage);
+}
+
+void ByteStream::RegisterResource(ByteStreamResource_t resource, const ByteStreamIo_t *io)
+{
+    if (resource < BS_RES_NMR)
+    {
+        resources[resource] = io;
+    }
+}
+
+bool ByteStream::IsActive(void)
+{
+    for (uint8_t i = 0; i < BS_MAX_STREAMS; i++)
+    {
+        if (streams[i].used && ((millis() - streams[i].lastActivity) <= BS_IDLE_TIMEOUT_MS))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ByteStream::Sleep(void)
+{
+    for (uint8_t i = 0; i < BS_MAX_STREAMS; i++)
+    {
+        release(&streams[i], false);
+    }
+}
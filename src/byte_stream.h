@@ -0,0 +1,97 @@
+/***********************************************************************
+ * Filename: byte_stream.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the ByteStream class, a flow controlled byte transfer on
+ *     MSG_BYTE_STREAM. The master opens a stream on a resource (a file,
+ *     ...) for reading or writing, starting at any offset, so a broken
+ *     transfer is resumed by opening it again where it stopped. The
+ *     sender keeps up to a window of frames ahead of the credit granted
+ *     by the receiver. Resources plug in through ByteStreamIo_t.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "esp_now_ctrl.h"
+#include "esp_now_txn.h"
+
+#define BS_MAX_STREAMS 2
+#define BS_CHUNK_SIZE sizeof(((ByteStreamPayload *)0)->data.data)
+#define BS_DEFAULT_WINDOW 8
+#define BS_IDLE_TIMEOUT_MS 10000
+#define BS_HEADER_SIZE offsetof(ByteStreamPayload, data.data)
+
+#define BS_OP(type) ((type) & 0x0F)
+#define BS_ID(type) ((type) >> 4)
+#define BS_TYPE(op, id) ((uint8_t)(((id) << 4) | (op)))
+
+typedef enum
+{
+    BS_RES_FILE = 0,
+    BS_RES_NMR
+} ByteStreamResource_t;
+
+/* Resource access, slot identifies the stream so a resource can keep per-stream state */
+typedef struct
+{
+    bool (*open)(uint8_t slot, const char *name, bool write, uint32_t offset, uint32_t *size);
+    int (*read)(uint8_t slot, uint32_t offset, uint8_t *buf, uint8_t len); // bytes read, 0 at the end, -1 on error
+    bool (*write)(uint8_t slot, uint32_t offset, const uint8_t *buf, uint8_t len);
+    void (*close)(uint8_t slot, bool ok);
+} ByteStreamIo_t;
+
+typedef struct
+{
+    bool used;
+    bool write;      // the master writes, the feeder receives
+    bool closeSent;
+    uint8_t id;
+    uint8_t peer_addr[6];
+    const ByteStreamIo_t *io;
+    uint8_t window;
+    uint8_t sinceCredit;
+    ByteStreamStatus_t status;
+    uint32_t offset; // next byte to send or expected
+    uint32_t end;
+    uint32_t limit;  // credit, the sender stops before this offset
+    uint32_t lastActivity;
+    TxnHandle_t txn;
+} ByteStream_t;
+
+class ByteStream
+{
+private:
+    static ByteStream_t streams[BS_MAX_STREAMS];
+    static const ByteStreamIo_t *resources[BS_RES_NMR];
+    static const ByteStreamIo_t fileIo;
+    static const TxnPolicy_t DataPolicy;
+
+    static ByteStream_t *find(const uint8_t *mac_addr, uint8_t id);
+    static ByteStream_t *allocate(const uint8_t *mac_addr, uint8_t id);
+    static void release(ByteStream_t *s, bool ok);
+    static void fill(ByteStreamPayload *frame, uint8_t id, ByteStreamOp_t op, uint32_t index, uint32_t bytes, ByteStreamStatus_t status);
+    static void reply(const uint8_t *mac_addr, uint8_t id, ByteStreamOp_t op, uint32_t index, uint32_t bytes, ByteStreamStatus_t status);
+    static void grantCredit(ByteStream_t *s);
+    static void pump(ByteStream_t *s);
+    static bool dataSource(void *ctx, Message *msg);
+    static void onDataDone(TxnHandle_t handle, TxnResult_t result, void *ctx);
+
+    static void handleOpen(const uint8_t *mac_addr, const ByteStreamPayload *frame);
+    static void handleData(ByteStream_t *s, const ByteStreamPayload *frame);
+    static void handleCredit(ByteStream_t *s, const ByteStreamPayload *frame);
+    static void handleClose(ByteStream_t *s, const ByteStreamPayload *frame);
+    static void onMessage(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+
+    static bool fileOpen(uint8_t slot, const char *name, bool write, uint32_t offset, uint32_t *size);
+    static int fileRead(uint8_t slot, uint32_t offset, uint8_t *buf, uint8_t len);
+    static bool fileWrite(uint8_t slot, uint32_t offset, const uint8_t *buf, uint8_t len);
+    static void fileClose(uint8_t slot, bool ok);
+
+public:
+    static void Init(void);
+    static void RegisterResource(ByteStreamResource_t resource, const ByteStreamIo_t *io);
+    static bool IsActive(void);
+    static void Sleep(void);
+};
@@ -0,0 +1,339 @@
+/***********************************************************************
+ * Filename: delta_patch.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the DeltaPatch class. The compressed body is decoded
+ *     by a streaming heatshrink decoder, the decoded control stream is
+ *     applied to the source partition byte by byte and the produced
+ *     target image is handed over to the writer in small blocks.
+ *
+ ***********************************************************************/
+
+#include "delta_patch.h"
+
+void DeltaPatch::Begin(const esp_partition_t *src, DeltaWriter wr)
+{
+    if (state == delta_source)
+    {
+        mbedtls_sha256_free(&sourceSha);
+    }
+    source = src;
+    writer = wr;
+    state = delta_header;
+    headerLen = 0;
+    sourceSize = 0;
+    targetSize = 0;
+    produced = 0;
+    checkPos = 0;
+    varint = 0;
+    varintShift = 0;
+    diffLen = 0;
+    extraLen = 0;
+    sourcePos = 0;
+    seekAdjust = 0;
+    hsState = hs_tag;
+    windowHead = 0;
+    bitAcc = 0;
+    bitCnt = 0;
+    backrefIndex = 0;
+    srcCacheValid = false;
+    outLen = 0;
+    memset(window, 0, sizeof(window));
+}
+
+bool DeltaPatch::parseHeader(void)
+{
+    if (memcmp(header, DELTA_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    memcpy(&sourceSize, &header[4], sizeof(sourceSize));
+    memcpy(&targetSize, &header[8], sizeof(targetSize));
+    windowSz2 = header[12];
+    lookaheadSz2 = header[13];
+
+    if ((windowSz2 < 4) || (windowSz2 > DELTA_MAX_WINDOW_SZ2) || (lookaheadSz2 < 3) || (lookaheadSz2 >= windowSz2))
+    {
+        return false;
+    }
+    if ((source == NULL) || (sourceSize > source->size))
+    {
+        return false;
+    }
+
+    /* The patch is only valid against the exact image it was made from, CheckSource hashes it */
+    checkPos = 0;
+    mbedtls_sha256_init(&sourceSha);
+    mbedtls_sha256_starts(&sourceSha, 0);
+    return true;
+}
+
+/* Hashes up to budget bytes of the source, returns true once the check is over (IsError tells the result) */
+bool DeltaPatch::CheckSource(uint32_t budget)
+{
+    if (state != delta_source)
+    {
+        return true;
+    }
+    uint32_t end = min(sourceSize, checkPos + budget);
+    while (checkPos < end)
+    {
+        size_t len = min((uint32_t)DELTA_SOURCE_CACHE, end - checkPos);
+        if (esp_partition_read(source, checkPos, srcCache, len) != ESP_OK)
+        {
+            mbedtls_sha256_free(&sourceSha);
+            state = delta_error;
+            return true;
+        }
+        mbedtls_sha256_update(&sourceSha, srcCache, len);
+        checkPos += len;
+    }
+    if (checkPos < sourceSize)
+    {
+        return false;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sourceSha, digest);
+    mbedtls_sha256_free(&sourceSha);
+    srcCacheValid = false;
+    state = (memcmp(digest, &header[16], sizeof(digest)) == 0) ? delta_diff_len : delta_error;
+    return true;
+}
+
+bool DeltaPatch::readSource(uint32_t pos, uint8_t *out)
+{
+    if (pos >= sourceSize)
+    {
+        return false;
+    }
+    if (!srcCacheValid || (pos < srcCacheStart) || (pos >= (srcCacheStart + DELTA_SOURCE_CACHE)))
+    {
+        srcCacheStart = pos;
+        size_t len = min((uint32_t)DELTA_SOURCE_CACHE, sourceSize - pos);
+        if (esp_partition_read(source, srcCacheStart, srcCache, len) != ESP_OK)
+        {
+            return false;
+        }
+        srcCacheValid = true;
+    }
+    *out = srcCache[pos - srcCacheStart];
+    return true;
+}
+
+bool DeltaPatch::flush(void)
+{
+    bool retval = true;
+    if (outLen > 0)
+    {
+        retval = writer(outBuf, outLen);
+        outLen = 0;
+    }
+    return retval;
+}
+
+bool DeltaPatch::emit(uint8_t b)
+{
+    if (produced >= targetSize)
+    {
+        return false;
+    }
+    outBuf[outLen++] = b;
+    produced++;
+    if (outLen >= sizeof(outBuf))
+    {
+        return flush();
+    }
+    return true;
+}
+
+bool DeltaPatch::readVarint(uint8_t b, uint32_t *out)
+{
+    varint |= (uint32_t)(b & 0x7F) << varintShift;
+    if (b & 0x80)
+    {
+        varintShift += 7;
+        if (varintShift > 28)
+        {
+            state = delta_error;
+        }
+        return false;
+    }
+    *out = varint;
+    varint = 0;
+    varintShift = 0;
+    return true;
+}
+
+bool DeltaPatch::processByte(uint8_t b)
+{
+    uint32_t value;
+    switch (state)
+    {
+    case delta_diff_len:
+        if (readVarint(b, &diffLen))
+        {
+            state = delta_extra_len;
+        }
+        break;
+
+    case delta_extra_len:
+        if (readVarint(b, &extraLen))
+        {
+            state = delta_seek;
+        }
+        break;
+
+    case delta_seek:
+        if (readVarint(b, &value))
+        {
+            seekAdjust = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+            state = (diffLen > 0) ? delta_diff : delta_extra;
+        }
+        break;
+
+    case delta_diff:
+    {
+        uint8_t s;
+        if (!readSource(sourcePos, &s) || !emit(s + b))
+        {
+            state = delta_error;
+            break;
+        }
+        sourcePos++;
+        if (--diffLen == 0)
+        {
+            state = delta_extra;
+        }
+        break;
+    }
+
+    case delta_extra:
+        if (!emit(b))
+        {
+            state = delta_error;
+            break;
+        }
+        extraLen--;
+        break;
+
+    case delta_done:
+        /* Padding bits of the compressed stream */
+        return true;
+
+    default:
+        state = delta_error;
+        break;
+    }
+
+    if ((state == delta_extra) && (extraLen == 0))
+    {
+        sourcePos += seekAdjust;
+        if (produced == targetSize)
+        {
+            state = flush() ? delta_done : delta_error;
+        }
+        else
+        {
+            state = delta_diff_len;
+        }
+    }
+    return state != delta_error;
+}
+
+bool DeltaPatch::getBits(uint8_t count, uint16_t *out)
+{
+    if (bitCnt < count)
+    {
+        return false;
+    }
+    bitCnt -= count;
+    *out = (bitAcc >> bitCnt) & ((1UL << count) - 1);
+    return true;
+}
+
+bool DeltaPatch::decompress(uint8_t b)
+{
+    const uint16_t mask = (1 << windowSz2) - 1;
+    uint16_t v;
+
+    bitAcc = (bitAcc << 8) | b;
+    bitCnt += 8;
+
+    while (true)
+    {
+        switch (hsState)
+        {
+        case hs_tag:
+            if (!getBits(1, &v))
+            {
+                return true;
+            }
+            hsState = v ? hs_literal : hs_index;
+            break;
+
+        case hs_literal:
+            if (!getBits(8, &v))
+            {
+                return true;
+            }
+            window[windowHead++ & mask] = (uint8_t)v;
+            if (!processByte((uint8_t)v))
+            {
+                return false;
+            }
+            hsState = hs_tag;
+            break;
+
+        case hs_index:
+            if (!getBits(windowSz2, &v))
+            {
+                return true;
+            }
+            backrefIndex = v + 1;
+            hsState = hs_count;
+            break;
+
+        case hs_count:
+            if (!getBits(lookaheadSz2, &v))
+            {
+                return true;
+            }
+            for (uint16_t i = 0; i <= v; i++)
+            {
+                uint8_t c = window[(windowHead - backrefIndex) & mask];
+                window[windowHead++ & mask] = c;
+                if (!processByte(c))
+                {
+                    return false;
+                }
+            }
+            hsState = hs_tag;
+            break;
+        }
+    }
+}
+
+/* Returns the bytes taken, the data after the header waits until the source check is over */
+size_t DeltaPatch::Feed(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    while ((i < len) && (state != delta_source) && (state != delta_error))
+    {
+        if (state == delta_header)
+        {
+            header[headerLen++] = data[i];
+            if (headerLen == DELTA_HEADER_SIZE)
+            {
+                state = parseHeader() ? delta_source : delta_error;
+            }
+        }
+        else if (!decompress(data[i]))
+        {
+            break;
+        }
+        i++;
+    }
+    return i;
+}
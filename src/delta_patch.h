@@ -0,0 +1,119 @@
+/***********************************************************************
+ * Filename: delta_patch.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the DeltaPatch class, which applies a binary delta
+ *     against the running partition while the patch is streamed in.
+ *     The format follows bsdiff/detools sequential patches:
+ *
+ *     Header (uncompressed, DELTA_HEADER_SIZE bytes, little endian):
+ *     - magic "KDP1"
+ *     - uint32 source size, uint32 target size
+ *     - uint8 window_sz2, uint8 lookahead_sz2 (heatshrink parameters)
+ *     - uint16 reserved
+ *     - uint8[32] SHA-256 of the source image
+ *
+ *     The source image is hashed after the header in slices of
+ *     DELTA_CHECK_STEP bytes (CheckSource), the body is not taken
+ *     until the hash matches.
+ *
+ *     Body, heatshrink compressed, repeated until target size is reached:
+ *     - varint diff_len, varint extra_len, zigzag varint seek
+ *     - diff_len bytes added (mod 256) to the source from current position
+ *     - extra_len bytes copied to the output unchanged
+ *     - source position moved by seek
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+#define DELTA_MAGIC "KDP1"
+#define DELTA_HEADER_SIZE 48
+#define DELTA_MAX_WINDOW_SZ2 12
+#define DELTA_SOURCE_CACHE 256
+#define DELTA_OUTPUT_BUFFER 256
+#define DELTA_CHECK_STEP 8192 // source bytes hashed per call, a few ms of flash reads
+
+typedef bool (*DeltaWriter)(const uint8_t *data, size_t len);
+
+typedef enum
+{
+    delta_header,
+    delta_source,
+    delta_diff_len,
+    delta_extra_len,
+    delta_seek,
+    delta_diff,
+    delta_extra,
+    delta_done,
+    delta_error,
+} DeltaState_t;
+
+typedef enum
+{
+    hs_tag,
+    hs_literal,
+    hs_index,
+    hs_count,
+} HeatshrinkState_t;
+
+class DeltaPatch
+{
+private:
+    const esp_partition_t *source;
+    DeltaWriter writer;
+    DeltaState_t state;
+
+    uint8_t header[DELTA_HEADER_SIZE];
+    size_t headerLen;
+    uint32_t sourceSize;
+    uint32_t targetSize;
+    uint32_t produced;
+    uint32_t checkPos;
+    mbedtls_sha256_context sourceSha;
+
+    uint32_t varint;
+    uint8_t varintShift;
+    uint32_t diffLen;
+    uint32_t extraLen;
+    uint32_t sourcePos;
+    int32_t seekAdjust;
+
+    HeatshrinkState_t hsState;
+    uint8_t windowSz2;
+    uint8_t lookaheadSz2;
+    uint8_t window[1 << DELTA_MAX_WINDOW_SZ2];
+    uint16_t windowHead;
+    uint32_t bitAcc;
+    uint8_t bitCnt;
+    uint16_t backrefIndex;
+
+    uint8_t srcCache[DELTA_SOURCE_CACHE];
+    uint32_t srcCacheStart;
+    bool srcCacheValid;
+
+    uint8_t outBuf[DELTA_OUTPUT_BUFFER];
+    size_t outLen;
+
+    bool parseHeader(void);
+    bool readSource(uint32_t pos, uint8_t *out);
+    bool emit(uint8_t b);
+    bool flush(void);
+    bool readVarint(uint8_t b, uint32_t *out);
+    bool processByte(uint8_t b);
+    bool decompress(uint8_t b);
+    bool getBits(uint8_t count, uint16_t *out);
+
+public:
+    void Begin(const esp_partition_t *src, DeltaWriter wr);
+    size_t Feed(const uint8_t *data, size_t len);
+    bool CheckSource(uint32_t budget);
+    bool IsCheckingSource(void) const { return state == delta_source; }
+    bool IsDone(void) const { return state == delta_done; }
+    bool IsError(void) const { return state == delta_error; }
+    uint32_t TargetSize(void) const { return targetSize; }
+};
@@ -12,6 +12,7 @@
 #include "Preferences.h"
 #include "parameters.h"
 #include "feeder_ctrl.h"
+#include "event_push.h"
 
 #undef ERROR
 #define ERROR(_name, _debup, _debdown, _blocked_fun, _clearing_by, _txt, _error_code, _verbose, _event) \
@@ -44,6 +45,7 @@ void Error::SetErrCode(void)
     {
         ChybovyKod.Set(error_code);
         LogHistory.Set(error_code);
+        EventPush::Changed();
     }
 }
 
@@ -52,6 +54,7 @@ void Error::ClearErrCode(void)
     if (ChybovyKod.Get() == error_code)
     {
         ChybovyKod.Set(0);
+        EventPush::Changed();
     }
 }
 
@@ -15,4 +15,5 @@ ERROR(ovrl_open,5,20,MOVE_UP | MOVE_CTRL_BLOCK, MOVE_UP | MOVE_DOWN, "Nadproud o
 ERROR(ovrl_close,5,20,MOVE_DOWN | MOVE_CTRL_BLOCK,  MOVE_UP | MOVE_DOWN, "Nadproud zavirani",NadProudZav, v_warning, ev_overload_close)
 ERROR(no_current,5,100,MOVE_DOWN | MOVE_UP, MOVE_UP | MOVE_DOWN | SELF_CLEAR, "Zadny proud", NeniProud, v_warning, ev_no_current)
 ERROR(error_close,25,100, MOVE_CTRL_BLOCK, MOVE_UP | MOVE_DOWN, "Nelze zavrit", ChybaZavirani, v_error, no_event)
-ERROR(error_open,25,100, MOVE_CTRL_BLOCK, MOVE_UP | MOVE_DOWN, "Nelze otevrit", ChybaOtevirani, v_error, no_event)
\ No newline at end of file
+ERROR(error_open,25,100, MOVE_CTRL_BLOCK, MOVE_UP | MOVE_DOWN, "Nelze otevrit", ChybaOtevirani, v_error, no_event)
+ERROR(no_load_cell,100,100, 0, SELF_CLEAR, "Vaha neodpovida", NeniVaha, v_error, no_event)
\ No newline at end of file
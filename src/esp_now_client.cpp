@@ -7,11 +7,41 @@
 
 #include "esp_now_client.h"
 
-SemaphoreHandle_t ESPNowClient::semaphore = xSemaphoreCreateBinary();
+QueueHandle_t ESPNowClient::events = xQueueCreate(CLIENT_EVENT_QUEUE_LEN, sizeof(ClientEvent_t));
 bool ESPNowClient::gotMasterResponse;
 std::mutex ESPNowClient::mutex;
-bool ESPNowClient::isUpdating = false;
-uint32_t ESPNowClient::startUpdateTime;
 bool ESPNowClient::param_defs_send = false;
-bool ESPNowClient::first_send;
-bool ESPNowClient::send_data_before_sleep;
\ No newline at end of file
+bool ESPNowClient::send_data_before_sleep;
+
+ClientState_t ESPNowClient::state = CLIENT_START;
+uint32_t ESPNowClient::stateSince;
+uint32_t ESPNowClient::lingerUntil;
+bool ESPNowClient::gatewayDone;
+uint16_t ESPNowClient::gatewayLinger_ms;
+Upload_t ESPNowClient::upload;
+volatile TxnHandle_t ESPNowClient::uploadTxn = TXN_INVALID;
+volatile TxnResult_t ESPNowClient::uploadResult = TXN_OK;
+volatile TxnHandle_t ESPNowClient::scanTxn = TXN_INVALID;
+uint8_t ESPNowClient::scanChannel;
+Discovered_t ESPNowClient::found[SCAN_CANDIDATES_MAX];
+uint8_t ESPNowClient::foundCnt;
+bool ESPNowClient::masterSeen;
+bool ESPNowClient::discovering = false;
+GatewayEntry_t ESPNowClient::probe;
+uint8_t ESPNowClient::probeRank;
+GatewayEntry_t ESPNowClient::failover[GATEWAY_LIST_MAX];
+uint8_t ESPNowClient::failoverCnt;
+uint8_t ESPNowClient::failoverFailed;
+uint8_t ESPNowClient::failoverMaster[6];
+bool ESPNowClient::probeSent;
+uint16_t ESPNowClient::requestDefIdx;
+TxnHandle_t ESPNowClient::requestDefsTxn = TXN_INVALID;
+ParamCursor_t ESPNowClient::requestRead;
+TxnHandle_t ESPNowClient::requestReadTxn = TXN_INVALID;
+
+/* Same budget as the former CHECK_SEND: two rounds of MAC retries, then the known gateways and a discovery scan */
+const TxnPolicy_t ESPNowClient::CommPolicy = {COMMUNICATION_RETRIES, 0, TXN_FLAG_RESCAN};
+/* Broadcasts are not acknowledged, one attempt per channel is all the MAC does anyway */
+const TxnPolicy_t ESPNowClient::ScanPolicy = {1, SCAN_LISTEN_MS, TXN_FLAG_BEST_EFFORT | TXN_FLAG_EXCLUSIVE};
+/* A gateway that is down is given up after two MAC attempts, the next one is tried right away */
+const TxnPolicy_t ESPNowClient::ProbePolicy = {2, SCAN_RESPONSE_WAIT_MS, TXN_FLAG_BEST_EFFORT | TXN_FLAG_EXCLUSIVE};
@@ -8,6 +8,8 @@
  *     node, handles pairing, data transfer, and over-the-air updates.
  *     The class provides methods to send and receive data packets,
  *     handle firmware updates, and manage device states and parameters.
+ *     Uploads and responses run as ESPNowTxn streams, the task itself
+ *     is a state machine that never waits on the radio.
  * 
  ***********************************************************************/
 
@@ -16,80 +18,85 @@
 #include "parameters.h"
 #include "log.h"
 #include "esp_now_ctrl.h"
-#include <Update.h>
+#include "esp_now_txn.h"
+#include "time_sync.h"
+#include "byte_stream.h"
+#include "event_push.h"
+#include "telemetry_batch.h"
+#include "gateway_list.h"
+#include "ota_ctrl.h"
 #include "deep_sleep_ctrl.h"
 #include "weight.h"
 
-#define COMMUNICATION_ATTEMPTS 2
 #define DEVICE_TYPE DEVICE_TYPE_FEEDER
-#define UPDATE_TIMEOUT_S 100
-
-
-#define CHECK_SEND(functionCall, resultVar)          \
-    do                                               \
-    {                                                \
-        resultVar = true;                            \
-        int _attempts = 0;                           \
-        while (!functionCall)                        \
-        {                                            \
-            Serial.println("Communication error");   \
-            _attempts++;                             \
-            if (_attempts >= COMMUNICATION_ATTEMPTS) \
-            {                                        \
-                if (ESPNowClient::ScanForMaster())    \
-                {                                    \
-                    resultVar = functionCall;        \
-                }                                    \
-                else                                 \
-                {                                    \
-                    resultVar = false;               \
-                }                                    \
-                break;                               \
-            }                                        \
-        }                                            \
-    } while (0)
-
-#define CHECK_SEND_RETURN_IF_FAIL(functionCall) \
-    do                                          \
-    {                                           \
-        bool result;                            \
-        CHECK_SEND(functionCall, result);       \
-        if (!result)                            \
-        {                                       \
-            return false;                       \
-        }                                       \
-    } while (0)
-
-#define CHECK_SEND_BREAK_IF_FAIL(functionCall) \
-                                               \
-    {                                          \
-        bool _result;                          \
-        CHECK_SEND(functionCall, _result);     \
-        if (!_result)                          \
-        {                                      \
-            break;                             \
-        }                                      \
-    }
-
-#define CHECK_RETURN_IF_FAIL(functionCall) \
-    do                                     \
-    {                                      \
-        bool _result = functionCall;       \
-        if (!_result)                      \
-        {                                  \
-            return false;                  \
-        }                                  \
-    } while (0)
-
-#define CHECK_BREAK_IF_FAIL(functionCall) \
-                                          \
-    {                                     \
-        bool _result = functionCall;      \
-        if (!_result)                     \
-        {                                 \
-            break;                        \
-        }                                 \
-    }
+#define CLIENT_REFRESH_MS 4000
+#define CLIENT_EVENT_QUEUE_LEN 8
+#define CLIENT_BUSY_POLL_MS 20
+#define SCAN_CANDIDATES_MAX 4
+
+typedef enum
+{
+    CLIENT_START = 0,
+    CLIENT_PAIRING,
+    CLIENT_UPLOAD,
+    CLIENT_LINGER,
+    CLIENT_IDLE,
+    CLIENT_OTA,
+} ClientState_t;
+
+typedef enum
+{
+    CLIENT_EV_UPLOAD_DONE = 0,
+    CLIENT_EV_SCAN_DONE,
+    CLIENT_EV_TRANSMIT_DONE,
+    CLIENT_EV_COMMAND,
+    CLIENT_EV_PAIRING,
+    CLIENT_EV_STATE_CHANGE,
+} ClientEventType_t;
+
+typedef struct
+{
+    ClientEventType_t type;
+    uint16_t linger_ms;
+} ClientEvent_t;
+
+typedef enum
+{
+    UPLOAD_PARAM_DEFS = 0,
+    UPLOAD_PARAM_VALUES,
+    UPLOAD_TELEMETRY,
+    UPLOAD_TIME_SYNC,
+    UPLOAD_LOGS,
+    UPLOAD_TRANSMIT_DONE,
+    UPLOAD_END,
+} UploadStage_t;
+
+typedef struct
+{
+    uint16_t next;
+    uint16_t last;
+} ParamCursor_t;
+
+typedef struct
+{
+    UploadStage_t stage;
+    bool paramDefs;
+    bool timeSync;
+    bool logs;
+    uint16_t defIdx;
+    ParamCursor_t values;
+    uint8_t batchNext;
+    LogCursor_t log;
+} Upload_t;
+
+typedef struct
+{
+    uint8_t mac_addr[6];
+    uint8_t channel;
+    uint8_t capabilities;
+    int8_t rssi;
+    bool isMaster;
+} Discovered_t;
 
 extern Weight weight;
 
@@ -97,52 +104,73 @@ class ESPNowClient
 {
 private:
     static bool gotMasterResponse;
-    static SemaphoreHandle_t semaphore;
+    static QueueHandle_t events;
     static std::mutex mutex;
-    static bool isUpdating;
-    static uint32_t startUpdateTime;
     static bool param_defs_send;
-    static bool first_send;
     static bool send_data_before_sleep;
 
-    static bool sendParamDefs(const uint8_t *mac_addr)
+    static ClientState_t state;
+    static uint32_t stateSince;
+    static uint32_t lingerUntil;
+    static bool gatewayDone;
+    static uint16_t gatewayLinger_ms;
+    static Upload_t upload;
+    static volatile TxnHandle_t uploadTxn;
+    static volatile TxnResult_t uploadResult;
+    static volatile TxnHandle_t scanTxn;
+    static uint8_t scanChannel;
+    static Discovered_t found[SCAN_CANDIDATES_MAX];
+    static uint8_t foundCnt;
+    static bool masterSeen;
+    static bool discovering;
+    static GatewayEntry_t probe;
+    static uint8_t probeRank;
+    static GatewayEntry_t failover[GATEWAY_LIST_MAX];
+    static uint8_t failoverCnt;
+    static uint8_t failoverFailed;
+    static uint8_t failoverMaster[6];
+    static bool probeSent;
+    static uint16_t requestDefIdx;
+    static TxnHandle_t requestDefsTxn;
+    static ParamCursor_t requestRead;
+    static TxnHandle_t requestReadTxn;
+
+    static const TxnPolicy_t CommPolicy;
+    static const TxnPolicy_t ScanPolicy;
+    static const TxnPolicy_t ProbePolicy;
+
+    static bool paramDefsFrame(uint16_t *regIdx, Message *msg)
     {
-        ParamDefsPayload payload;
+        ParamDefsPayload *payload = (ParamDefsPayload *)msg->payload;
         uint8_t parIdx = 0;
-        bool res = true;
-        for (int i = 0; i < Register::NmrParameters; i++)
+        memset(payload, 0, sizeof(ParamDefsPayload));
+        while ((*regIdx < Register::NmrParameters) && (parIdx < MAX_PARAM_DEFS))
         {
-            Register *reg = Register::GetParByIdx(i);
+            Register *reg = Register::GetParByIdx((*regIdx)++);
             if (reg && (reg->def.dsc & Par_ESPNow))
             {
-                payload.params[parIdx].adr = reg->def.adr;
-                payload.params[parIdx].min = reg->def.min;
-                payload.params[parIdx].max = reg->def.max;
-                payload.params[parIdx].dsc = reg->def.dsc;
-                payload.params[parIdx].flags = reg->def.atr;
-                strncpy(payload.params[parIdx].ptxt, reg->def.ptxt, sizeof(payload.params[parIdx].ptxt) - 1);
-                payload.params[parIdx].ptxt[sizeof(payload.params[parIdx].ptxt) - 1] = '\0';
+                payload->params[parIdx].adr = reg->def.adr;
+                payload->params[parIdx].min = reg->def.min;
+                payload->params[parIdx].max = reg->def.max;
+                payload->params[parIdx].dsc = reg->def.dsc;
+                payload->params[parIdx].flags = reg->def.atr;
+                strncpy(payload->params[parIdx].ptxt, reg->def.ptxt, sizeof(payload->params[parIdx].ptxt) - 1);
+                payload->params[parIdx].ptxt[sizeof(payload->params[parIdx].ptxt) - 1] = '\0';
                 parIdx++;
-                payload.numParams = parIdx;
-                if (parIdx >= MAX_PARAM_DEFS)
-                {
-                    CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_GET_PARAM_DEFS_RESPONSE, payload, sizeof(pardef_t_espnow) * MAX_PARAM_DEFS + 1));
-
-                    parIdx = 0;
-                    memset(&payload, 0, sizeof(ParamDefsPayload));
-                }
             }
         }
-        if (parIdx > 0)
+        if (parIdx == 0)
         {
-            CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_GET_PARAM_DEFS_RESPONSE, payload, sizeof(pardef_t_espnow) * parIdx + 1));
+            return false;
         }
-        return res;
+        payload->numParams = parIdx;
+        msg->messageType = MSG_GET_PARAM_DEFS_RESPONSE;
+        msg->payloadSize = ParamDefsPayloadSize(parIdx);
+        return true;
     }
 
-    static bool sendParamValues(const uint8_t *mac_addr)
+    static void startParamValues(ParamCursor_t *cursor)
     {
-        ReadRequestPayload payload;
         uint16_t regFirst = UINT16_MAX;
         uint16_t regLast = 0;
         for (int i = 0; i < Register::NmrParameters; i++)
@@ -160,45 +188,379 @@ private:
                 }
             }
         }
-        if (regFirst != UINT16_MAX)
+        cursor->next = (regFirst != UINT16_MAX) ? regFirst : 0;
+        cursor->last = (regFirst != UINT16_MAX) ? regLast : 0;
+    }
+
+    static bool paramValuesFrame(ParamCursor_t *cursor, Message *msg)
+    {
+        if (cursor->next >= cursor->last)
+        {
+            return false;
+        }
+        ReadResponsePayload *response = (ReadResponsePayload *)msg->payload;
+        uint16_t nmr = min(cursor->last - cursor->next, MAX_PARAM_READS_WRITES);
+        response->regAddr = cursor->next;
+        response->nmr = nmr;
+        for (uint16_t i = 0; i < nmr; i++)
         {
-            payload.regAddr = regFirst;
-            payload.nmr = regLast - regFirst;
-            return readParamsRequestHandler(mac_addr, &payload);
+            int16_t regval;
+            Register::ReadReg(&regval, cursor->next + i);
+            response->values[i] = regval;
         }
+        cursor->next += nmr;
+        msg->messageType = MSG_READ_PARAM_RESPONSE;
+        msg->payloadSize = ReadResponsePayloadSize(nmr);
         return true;
     }
 
-    static bool readParamsRequestHandler(const uint8_t *mac_addr, const ReadRequestPayload *payload)
+    static bool paramDefsSource(void *ctx, Message *msg)
     {
-        uint16_t regadr = payload->regAddr;
-        uint16_t regnmr = payload->nmr;
-        ReadResponsePayload response;
-        uint16_t adrIdx = 0;
-        uint16_t reglast = regadr + regnmr;
-        bool res = true;
-        response.regAddr = regadr;
-        for (uint16_t i = regadr; i < reglast; i++)
+        return paramDefsFrame((uint16_t *)ctx, msg);
+    }
+
+    static bool paramValuesSource(void *ctx, Message *msg)
+    {
+        return paramValuesFrame((ParamCursor_t *)ctx, msg);
+    }
+
+    static bool uploadSource(void *ctx, Message *msg)
+    {
+        Upload_t *up = (Upload_t *)ctx;
+        switch (up->stage)
         {
-            int16_t regval;
-            Register::ReadReg(&regval, i);
-            response.values[adrIdx] = regval;
-            adrIdx++;
-            response.nmr = adrIdx;
-            if (adrIdx >= MAX_PARAM_READS_WRITES)
+        case UPLOAD_PARAM_DEFS:
+            if (up->paramDefs && paramDefsFrame(&up->defIdx, msg))
+            {
+                return true;
+            }
+            up->stage = UPLOAD_PARAM_VALUES;
+            // fall through
+        case UPLOAD_PARAM_VALUES:
+            if (paramValuesFrame(&up->values, msg))
+            {
+                return true;
+            }
+            up->stage = UPLOAD_TELEMETRY;
+            // fall through
+        case UPLOAD_TELEMETRY:
+            if (TelemetryBatch::NextFrame(&up->batchNext, msg))
+            {
+                return true;
+            }
+            up->stage = UPLOAD_TIME_SYNC;
+            // fall through
+        case UPLOAD_TIME_SYNC:
+            up->stage = UPLOAD_LOGS;
+            if (up->timeSync)
+            {
+                TimeSync::FillRequest(msg);
+                return true;
+            }
+            // fall through
+        case UPLOAD_LOGS:
+            if (up->logs && SystemLog::NextLogFrame(&up->log, msg))
             {
-                CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_READ_PARAM_RESPONSE, response, 4 + adrIdx * 2));
-                adrIdx = 0;
-                memset(&response, 0, sizeof(ReadResponsePayload));
-                response.regAddr = i + 1;
+                return true;
             }
+            up->stage = UPLOAD_TRANSMIT_DONE;
+            // fall through
+        case UPLOAD_TRANSMIT_DONE:
+            up->stage = UPLOAD_END;
+            msg->messageType = MSG_TRANSMIT_DONE;
+            msg->payloadSize = 0;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static void onUploadDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+    {
+        if (handle == uploadTxn)
+        {
+            if (result == TXN_OK)
+            {
+                TelemetryBatch::Uploaded(upload.batchNext);
+                if (upload.logs)
+                {
+                    SystemLog::LogsDelivered(&upload.log);
+                }
+            }
+            uploadResult = result;
+            uploadTxn = TXN_INVALID;
+            post(CLIENT_EV_UPLOAD_DONE);
+        }
+    }
+
+    static void startUpload(const uint8_t *mac_addr, bool paramDefs, bool timeSync, bool logs)
+    {
+        ESPNowTxn::Abort(uploadTxn);
+        upload.stage = UPLOAD_PARAM_DEFS;
+        upload.paramDefs = paramDefs;
+        upload.timeSync = timeSync;
+        upload.logs = logs;
+        upload.defIdx = 0;
+        upload.batchNext = 0;
+        startParamValues(&upload.values);
+        if (logs)
+        {
+            SystemLog::StartLogCursor(&upload.log, false);
+        }
+        uploadResult = TXN_OK;
+        uploadTxn = ESPNowTxn::Stream(mac_addr, uploadSource, &upload, CommPolicy, onUploadDone);
+        if (uploadTxn == TXN_INVALID)
+        {
+            uploadResult = TXN_FAILED;
+        }
+    }
+
+    /* Discovery burst, one broadcast per channel and a short listen for the responses */
+    static bool scanSource(void *ctx, Message *msg)
+    {
+        if (masterSeen)
+        {
+            return false;
+        }
+        if (scanChannel > MAX_CHANNEL)
+        {
+            Serial.printf("Discovery done, %d gateways\n", foundCnt);
+            return false;
+        }
+        DiscoveryRequestPayload *request = (DiscoveryRequestPayload *)msg->payload;
+        request->channel = scanChannel++;
+        request->deviceType = DEVICE_TYPE;
+        request->protocolVersion = ESPNOW_PROTOCOL_VERSION;
+        ESPNowTxn::SetFrameChannel(request->channel);
+        msg->messageType = MSG_DISCOVERY;
+        msg->payloadSize = sizeof(DiscoveryRequestPayload);
+        return true;
+    }
+
+    static void finishScan(void)
+    {
+        scanTxn = TXN_INVALID;
+        ESPNowCtrl::SetChannel(WiFiKanal.Get());
+        if (!gotMasterResponse)
+        {
+            Serial.println("Device not paired.");
         }
+        ESPNowTxn::RescanDone(gotMasterResponse, MasterMacAdresa.Get());
+        post(CLIENT_EV_SCAN_DONE);
+    }
 
-        if (adrIdx > 0)
+    /* Pairs with the next gateway that answered the discovery, false when none is left */
+    static bool pairNext(void)
+    {
+        while (probeRank < foundCnt)
+        {
+            Discovered_t *gateway = &found[probeRank++];
+            memcpy(probe.mac_addr, gateway->mac_addr, 6);
+            probe.channel = gateway->channel;
+            probeSent = false;
+            ESPNowCtrl::AddPeer(probe.mac_addr, 0);
+            scanTxn = ESPNowTxn::Stream(probe.mac_addr, probeSource, NULL, ProbePolicy, onPairDone);
+            if (scanTxn != TXN_INVALID)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void onPairDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+    {
+        if (gotMasterResponse || !pairNext())
+        {
+            finishScan();
+        }
+    }
+
+    static void onScanDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+    {
+        discovering = false;
+        probeRank = 0;
+        if (!pairNext())
+        {
+            finishScan();
+        }
+    }
+
+    /* Our master first, then gateways that know the feeder, then by the RSSI they heard */
+    static uint8_t candidateRank(const Discovered_t *gateway)
+    {
+        return (gateway->isMaster ? 2 : 0) + ((gateway->capabilities & GATEWAY_CAP_KNOWN) ? 1 : 0);
+    }
+
+    static void onDiscoveryResponse(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+    {
+        const DiscoveryResponsePayload *response = (const DiscoveryResponsePayload *)payload;
+        if (!discovering || (response->deviceType != DEVICE_TYPE_DOOR_CONTROL))
+        {
+            return;
+        }
+        Discovered_t gateway;
+        memcpy(gateway.mac_addr, mac_addr, 6);
+        gateway.channel = response->channel;
+        gateway.capabilities = response->capabilities;
+        gateway.rssi = response->rssi;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            gateway.isMaster = memcmp(mac_addr, MasterMacAdresa.Get(), 6) == 0;
+            // a feeder that is not paired takes any gateway with an open pairing window
+            bool pairing = memcmp(MasterMacAdresa.Get(), BroadcastAddress, 6) == 0;
+            if (!gateway.isMaster && !(gateway.capabilities & GATEWAY_CAP_KNOWN) &&
+                !(pairing && (gateway.capabilities & GATEWAY_CAP_PAIRING)))
+            {
+                return;
+            }
+        }
+        masterSeen |= gateway.isMaster;
+
+        uint8_t idx = 0;
+        while ((idx < foundCnt) && (memcmp(found[idx].mac_addr, mac_addr, 6) != 0))
+        {
+            idx++;
+        }
+        if (idx < foundCnt)
+        {
+            memmove(&found[idx], &found[idx + 1], (foundCnt - idx - 1) * sizeof(Discovered_t));
+            foundCnt--;
+        }
+        idx = 0;
+        while ((idx < foundCnt) && ((candidateRank(&found[idx]) > candidateRank(&gateway)) ||
+                                    ((candidateRank(&found[idx]) == candidateRank(&gateway)) && (found[idx].rssi >= gateway.rssi))))
+        {
+            idx++;
+        }
+        if (idx >= SCAN_CANDIDATES_MAX)
+        {
+            return;
+        }
+        foundCnt = min((uint8_t)(foundCnt + 1), (uint8_t)SCAN_CANDIDATES_MAX);
+        memmove(&found[idx + 1], &found[idx], (foundCnt - idx - 1) * sizeof(Discovered_t));
+        found[idx] = gateway;
+    }
+
+    static void startScan(void)
+    {
+        if (ESPNowTxn::IsActive(scanTxn))
+        {
+            return;
+        }
+        gotMasterResponse = false;
+        masterSeen = false;
+        foundCnt = 0;
+        discovering = true;
+        scanChannel = 1;
+        ESPNowCtrl::AddPeer(BroadcastAddress, 0);
+        scanTxn = ESPNowTxn::Stream(BroadcastAddress, scanSource, NULL, ScanPolicy, onScanDone);
+        if (scanTxn == TXN_INVALID)
+        {
+            discovering = false;
+            ESPNowTxn::RescanDone(false);
+        }
+    }
+
+    /* One unicast pair request on the channel the gateway was last seen on, the gap leaves time for its response */
+    static bool probeSource(void *ctx, Message *msg)
+    {
+        if (probeSent || gotMasterResponse)
+        {
+            return false;
+        }
+        probeSent = true;
+        PairRequestPayload *request = (PairRequestPayload *)msg->payload;
+        request->channel = probe.channel;
+        request->deviceType = DEVICE_TYPE;
+        request->protocolVersion = ESPNOW_PROTOCOL_VERSION;
+        ESPNowTxn::SetFrameChannel(probe.channel);
+        msg->messageType = MSG_PAIR_REQUEST;
+        msg->payloadSize = sizeof(PairRequestPayload);
+        return true;
+    }
+
+    /* Starts the probe of the next gateway of the failover list, false when none is left */
+    static bool probeNext(void)
+    {
+        while (probeRank < failoverCnt)
+        {
+            probe = failover[probeRank++];
+            gotMasterResponse = false;
+            probeSent = false;
+            ESPNowCtrl::AddPeer(probe.mac_addr, 0);
+            scanTxn = ESPNowTxn::Stream(probe.mac_addr, probeSource, NULL, ProbePolicy, onProbeDone);
+            if (scanTxn != TXN_INVALID)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void onProbeDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+    {
+        scanTxn = TXN_INVALID;
+        if (gotMasterResponse)
+        {
+            // the pair response made it the master, waiting transactions follow it
+            SystemLog::PutLog("Prepnuti na zalozni branu", v_warning);
+            recordFailover();
+            ESPNowCtrl::SetChannel(WiFiKanal.Get());
+            ESPNowTxn::RescanDone(true, probe.mac_addr);
+            post(CLIENT_EV_SCAN_DONE);
+            return;
+        }
+        failoverFailed |= 1 << (probeRank - 1);
+        ESPNowCtrl::SetChannel(WiFiKanal.Get());
+        if (!probeNext())
+        {
+            recordFailover();
+            startScan();
+        }
+    }
+
+    /* Failures re-sort the gateway list, so they are recorded only once the failover is over */
+    static void recordFailover(void)
+    {
+        GatewayList::Failed(failoverMaster);
+        for (uint8_t i = 0; i < failoverCnt; i++)
+        {
+            if (failoverFailed & (1 << i))
+            {
+                GatewayList::Failed(failover[i].mac_addr);
+            }
+        }
+    }
+
+    /* Rescan hook, the known gateways are tried before the channel scan */
+    static void startFailover(void)
+    {
+        if (ESPNowTxn::IsActive(scanTxn))
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            memcpy(failoverMaster, MasterMacAdresa.Get(), 6);
+        }
+        /* The candidates are copied in rank order, the probes walk the copy */
+        failoverCnt = 0;
+        GatewayEntry_t entry;
+        for (uint8_t i = 0; GatewayList::Get(i, &entry); i++)
+        {
+            if (memcmp(entry.mac_addr, failoverMaster, 6) != 0)
+            {
+                failover[failoverCnt++] = entry;
+            }
+        }
+        failoverFailed = 0;
+        probeRank = 0;
+        if (!probeNext())
         {
-            CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_READ_PARAM_RESPONSE, response, 4 + adrIdx * 2));
+            recordFailover();
+            startScan();
         }
-        return res;
     }
 
     static void writeParamsRequestHandler(const uint8_t *mac_addr, const WriteRequestPayload *payload)
@@ -212,19 +574,25 @@ private:
         }
     }
 
-    static bool pairResponseHandler(const uint8_t *mac_addr, const PairResponsePayload *payload)
+    static void pairResponseHandler(const uint8_t *mac_addr, const PairResponsePayload *payload)
     {
-        bool res = true;
         if (payload->state == PAIR_STATE_PAIRED)
         {
             bool isBroadcast = false;
+            bool newMaster = false;
             gotMasterResponse = true;
             {
                 std::lock_guard<std::mutex> lock(mutex);
                 isBroadcast = memcmp(MasterMacAdresa.Get(), BroadcastAddress, 6) == 0;
+                newMaster = memcmp(MasterMacAdresa.Get(), mac_addr, 6) != 0;
                 MasterMacAdresa.Set(mac_addr);
                 WiFiKanal.Set(payload->channel);
             }
+            if (newMaster)
+            {
+                ESPNowCtrl::ResetSeq(mac_addr);
+            }
+            GatewayList::Seen(mac_addr, payload->channel);
             ESPNowCtrl::AddPeer(mac_addr, 0);
             char macStr[18];
             snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x",
@@ -234,10 +602,7 @@ private:
             if (isBroadcast)
             {
                 StavZarizeni.Set(Sparovano);
-                CHECK_RETURN_IF_FAIL(sendParamDefs(mac_addr));
-                CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_TIME_SYNC_REQUEST));
-                CHECK_RETURN_IF_FAIL(sendParamValues(mac_addr));
-                CHECK_SEND_RETURN_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_TRANSMIT_DONE));
+                startUpload(mac_addr, true, true, false);
             }
         }
         else if ((payload->state == PAIR_STATE_INITIAL_REQUEST) || (payload->state == PAIR_STATE_EXPIRED))
@@ -250,187 +615,333 @@ private:
                     MasterMacAdresa.Set(BroadcastAddress);
                 }
             }
+            GatewayList::Forget(mac_addr);
+            ESPNowCtrl::ResetSeq(mac_addr);
             char macStr[18];
             snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x",
                      mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
             Serial.printf("Find device on channel: %d, MAC addr: %s\n", payload->channel, macStr);
         }
-        return res;
     }
 
-    static void fwUpdateRequestHandler(const uint8_t *mac_addr, UpdateRequestPayload *payload)
+    static void onPairResponse(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
     {
-        static uint32_t last_index = 0;
-        if (!payload->index)
+        const PairResponsePayload *response = (const PairResponsePayload *)payload;
+        if ((payloadSize >= sizeof(PairResponsePayload)) && (response->protocolVersion != ESPNOW_PROTOCOL_VERSION))
         {
-            active_tasks[Communication_Task] = true;
-            SystemLog::PutLog("Start aktualizace firmwaru", v_info);
-            isUpdating = true;
-            startUpdateTime = millis();
-            if (!Update.begin(UPDATE_SIZE_UNKNOWN, payload->isFW ? U_FLASH : U_SPIFFS))
-                Update.printError(Serial);
+            SystemLog::PutLog("ESP-Now master protocol version " + String(response->protocolVersion), v_warning);
         }
-        // Serial.printf("Get data, size: %d, index: %d, FW: %d\n", payload->nmr, payload->index, payload->isFW);
-        if (Update.write(payload->data, payload->nmr) != payload->nmr)
-            Update.printError(Serial);
-        if (payload->isFinal)
+        pairResponseHandler(mac_addr, response);
+    }
+
+    static void onParamDefsRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+    {
+        ESPNowTxn::Abort(requestDefsTxn);
+        requestDefIdx = 0;
+        requestDefsTxn = ESPNowTxn::Stream(mac_addr, paramDefsSource, &requestDefIdx, CommPolicy);
+    }
+
+    static void onReadParamsRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+    {
+        const ReadRequestPayload *request = (const ReadRequestPayload *)payload;
+        ESPNowTxn::Abort(requestReadTxn);
+        requestRead.next = request->regAddr;
+        requestRead.last = request->regAddr + request->nmr;
+        requestReadTxn = ESPNowTxn::Stream(mac_addr, paramValuesSource, &requestRead, CommPolicy);
+    }
+
+    static void onWriteParamsRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+    {
+        const WriteRequestPayload *request = (const WriteRequestPayload *)payload;
+        if (WriteRequestPayloadSize(request->nmr) > payloadSize)
         {
-            if (!Update.end(true))
-            {
-                SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe. Zarizeni se restartuje.", v_error);
-                Update.printError(Serial);
-                delay(1000);
-            }
-            else
-            {
-                SystemLog::PutLog("Aktualizace firmwaru probehla uspesne", v_info);
-                delay(1000);
-            }
-            RestartCmd.Set(povoleno);
-            isUpdating = false;
+            SystemLog::PutLog("ESP-Now write request too short", v_warning);
+            return;
         }
+        writeParamsRequestHandler(mac_addr, request);
+        send_data_before_sleep = true;
+        weight.RunMeasure();
     }
 
-    static void timeSyncResponseHandler(const uint8_t *mac_addr, const TimeSyncPayload *payload)
+    static void onTransmitDone(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
     {
-        PopisCasu.Set(payload->timezone);
-        SetTimezone(payload->timezone);
-        SetDateTime(payload->currentTime);
-        CasVychodu.Set(payload->sunriseTime);
-        CasZapadu.Set(payload->sunsetTime);
+        uint16_t linger_ms = 0;
+        if (payloadSize >= sizeof(TransmitDonePayload))
+        {
+            linger_ms = ((const TransmitDonePayload *)payload)->linger_ms;
+        }
+        post(CLIENT_EV_TRANSMIT_DONE, linger_ms);
     }
 
-    static void handleDataReceived(const uint8_t *mac_addr, const Message *msg, int len)
+    static void onDataReceived(const uint8_t *mac_addr, uint8_t messageType)
     {
-        // Serial.printf("Received data type: %d, len: %d\n", msg->messageType, len);
-        switch (msg->messageType)
+        switch (messageType)
         {
-        case MSG_PAIR_RESPONSE:
-            pairResponseHandler(mac_addr, (const PairResponsePayload *)(msg->payload));
-            break;
-        case MSG_GET_PARAM_DEFS_REQUEST:
-            sendParamDefs(mac_addr);
-            break;
         case MSG_READ_PARAM_REQUEST:
-            readParamsRequestHandler(mac_addr, (const ReadRequestPayload *)(msg->payload));
-            break;
         case MSG_WRITE_PARAM_REQUEST:
-            writeParamsRequestHandler(mac_addr, (const WriteRequestPayload *)(msg->payload));
-            send_data_before_sleep = true;
-            weight.RunMeasure();
-            break;
-
+        case MSG_GET_PARAM_DEFS_REQUEST:
+        case MSG_GET_LOG_REQUEST:
         case MSG_FW_UPDATE_REQUEST:
-            fwUpdateRequestHandler(mac_addr, (UpdateRequestPayload *)(msg->payload));
-            break;
-
-        case MSG_TIME_SYNC_RESPONSE:
-            timeSyncResponseHandler(mac_addr, (const TimeSyncPayload *)(msg->payload));
-            break;
-
-        case MSG_TRANSMIT_DONE:
-            active_tasks[Communication_Task] = false;
-
-            // xSemaphoreGive(semaphore);
+        case MSG_BYTE_STREAM:
+        case MSG_FILE_REQUEST:
+            post(CLIENT_EV_COMMAND);
             break;
         default:
-            Serial.println("Received unknown data");
             break;
         }
     }
 
+    static void onStateChange(void)
+    {
+        post(CLIENT_EV_STATE_CHANGE);
+    }
+
+    static void post(ClientEventType_t type, uint16_t linger_ms = 0)
+    {
+        ClientEvent_t event = {type, linger_ms};
+        xQueueSendToBack(events, &event, 0);
+    }
+
     static void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
     {
     }
 
-   
+    static void setState(ClientState_t newState)
+    {
+        state = newState;
+        stateSince = millis();
+    }
+
+    static uint32_t remaining(uint32_t period_ms)
+    {
+        uint32_t elapsed = millis() - stateSince;
+        return (elapsed < period_ms) ? (period_ms - elapsed) : 0;
+    }
 
-public:
-    static void Init(void)
+    static void extendLinger(uint32_t linger_ms)
     {
-        ESPNowCtrl::Init();
-        ESPNowCtrl::SetDataReceivedCallback(handleDataReceived);
-        ESPNowCtrl::SetDataSentCallback(OnDataSent);
-        ESPNowCtrl::SetChannel(WiFiKanal.Get());
-        ESPNowCtrl::AddPeer(MasterMacAdresa.Get(), 0);
-        active_tasks[Communication_Task] = true;
-        first_send = false;
-        send_data_before_sleep = false;
+        if ((int32_t)(millis() + linger_ms - lingerUntil) > 0)
+        {
+            lingerUntil = millis() + linger_ms;
+        }
     }
 
-    static void Task(void)
+    static void shortenLinger(uint32_t linger_ms)
+    {
+        if ((int32_t)(millis() + linger_ms - lingerUntil) < 0)
+        {
+            lingerUntil = millis() + linger_ms;
+        }
+    }
+
+    static uint32_t finish(bool res)
+    {
+        if (!res)
+        {
+            if (!OtaCtrl::IsActive())
+            {
+                active_tasks[Communication_Task] = false;
+            }
+            setState(CLIENT_IDLE);
+            return CLIENT_REFRESH_MS;
+        }
+        setState(CLIENT_LINGER);
+        lingerUntil = millis() + (gatewayDone ? gatewayLinger_ms : CekaniNaPovel_ms.Get());
+        return 0;
+    }
+
+    static void handleEvent(const ClientEvent_t &event)
     {
-        bool res = true;
-        if (!isUpdating)
+        switch (event.type)
         {
-            if (RestartCmd.Get() == povoleno)
+        case CLIENT_EV_PAIRING:
+            if ((state == CLIENT_LINGER) || (state == CLIENT_IDLE))
+            {
+                setState(CLIENT_START);
+            }
+            break;
+
+        case CLIENT_EV_TRANSMIT_DONE:
+            gatewayDone = true;
+            gatewayLinger_ms = event.linger_ms;
+            if (state == CLIENT_LINGER)
+            {
+                shortenLinger(event.linger_ms);
+            }
+            break;
+
+        case CLIENT_EV_STATE_CHANGE:
+            /* Sent right away while the radio is up, otherwise first at the next wake */
+            if ((state == CLIENT_UPLOAD) || (state == CLIENT_LINGER) || (state == CLIENT_OTA))
             {
-                delay(1000);
+                uint8_t mac_addr[6];
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    memcpy(mac_addr, MasterMacAdresa.Get(), 6);
+                }
+                EventPush::Send(mac_addr);
             }
+            break;
 
+        case CLIENT_EV_COMMAND:
+            gatewayDone = false;
             active_tasks[Communication_Task] = true;
+            if (state == CLIENT_IDLE)
+            {
+                setState(CLIENT_LINGER);
+                lingerUntil = millis();
+            }
+            if (state == CLIENT_LINGER)
+            {
+                extendLinger(CekaniNaPovel_ms.Get());
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    /* Runs one step of the client state machine, returns how long it may wait for an event */
+    static uint32_t step(void)
+    {
+        switch (state)
+        {
+        case CLIENT_START:
+        {
+            if (OtaCtrl::IsActive())
+            {
+                setState(CLIENT_OTA);
+                return 0;
+            }
+
+            active_tasks[Communication_Task] = true;
+            gatewayDone = false;
 
-            bool pair;
             uint8_t mac_addr[6];
             {
                 std::lock_guard<std::mutex> lock(mutex);
                 memcpy(mac_addr, MasterMacAdresa.Get(), 6);
             }
 
-            pair = memcmp(mac_addr, BroadcastAddress, 6) == 0;
+            if (memcmp(mac_addr, BroadcastAddress, 6) == 0)
+            {
+                if (StavZarizeni.Get() != Parovani)
+                {
+                    return finish(false);
+                }
+                startScan();
+                setState(CLIENT_PAIRING);
+                return portMAX_DELAY;
+            }
 
-            // ESPNowCtrl::Init();
+            bool paramDefs = (ResetReason.Get() != rst_Deepsleep) && !param_defs_send;
+            param_defs_send |= paramDefs;
+            // events go on the control lane, ahead of the upload
+            EventPush::Send(mac_addr);
+            startUpload(mac_addr, paramDefs, TimeSync::NeedsSync(), SystemLog::HasNewLogs());
+            setState(CLIENT_UPLOAD);
+            return (uploadTxn != TXN_INVALID) ? portMAX_DELAY : 0;
+        }
 
-            if (pair)
+        case CLIENT_PAIRING:
+            if (scanTxn != TXN_INVALID)
             {
-                res = (StavZarizeni.Get() == Parovani) ? ScanForMaster() : false;
+                return portMAX_DELAY;
             }
-            else
+            if (uploadTxn != TXN_INVALID)
             {
-                res = false;
-                do
-                {
-                    if (ResetReason.Get() != rst_Deepsleep && !param_defs_send)
-                    {
-                        param_defs_send = true;
-                        CHECK_BREAK_IF_FAIL(sendParamDefs(mac_addr));
-                    }
-                    CHECK_BREAK_IF_FAIL(sendParamValues(mac_addr));
-                    if (!first_send)
-                    {
-                        CHECK_SEND_BREAK_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_TIME_SYNC_REQUEST));
-                        CHECK_BREAK_IF_FAIL(SystemLog::SendLogsViaEspNow(mac_addr));
-                        first_send = true;
-                    }
-                    CHECK_SEND_BREAK_IF_FAIL(ESPNowCtrl::SendMessage(mac_addr, MSG_TRANSMIT_DONE));
-                    res = true;
-                } while (0);
-            }
-            // xSemaphoreTake(semaphore, pdMS_TO_TICKS(500));
-
-            if (!isUpdating && !res)
+                // upload started by the pair response
+                setState(CLIENT_UPLOAD);
+                return portMAX_DELAY;
+            }
+            return finish(gotMasterResponse);
+
+        case CLIENT_UPLOAD:
+            if (uploadTxn != TXN_INVALID)
             {
-                active_tasks[Communication_Task] = false;
+                return portMAX_DELAY;
             }
-        }
-        else
+            return finish(uploadResult == TXN_OK);
+
+        case CLIENT_LINGER:
         {
-            if ((millis() - startUpdateTime) > (UPDATE_TIMEOUT_S * 1000))
+            if (OtaCtrl::IsActive())
             {
-                SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe: Timeout", v_error);
-                delay(500);
-                RestartCmd.Set(povoleno);
-                active_tasks[Communication_Task] = false;
-                isUpdating = false;
+                setState(CLIENT_OTA);
+                return 0;
+            }
+            int32_t left = (int32_t)(lingerUntil - millis());
+            if (left > 0)
+            {
+                return left;
+            }
+            if (ESPNowTxn::IsBusy() || ByteStream::IsActive())
+            {
+                // responses to the gateway are still being sent
+                return CLIENT_BUSY_POLL_MS;
             }
+            active_tasks[Communication_Task] = false;
+            setState(CLIENT_IDLE);
+            return CLIENT_REFRESH_MS;
         }
-        if (xSemaphoreTake(semaphore, pdMS_TO_TICKS(3000)) != pdTRUE)
-        {
-            if (!isUpdating)
+
+        case CLIENT_IDLE:
+            /* Only reached again when something else keeps the feeder awake */
+            if (remaining(CLIENT_REFRESH_MS) > 0)
+            {
+                return remaining(CLIENT_REFRESH_MS);
+            }
+            setState(CLIENT_START);
+            return 0;
+
+        case CLIENT_OTA:
+        default:
+            if (!OtaCtrl::IsActive())
             {
+                setState(CLIENT_START);
+                return 0;
+            }
+            if (OtaCtrl::IsStalled())
+            {
+                OtaCtrl::Suspend();
                 active_tasks[Communication_Task] = false;
-                delay(1000);
             }
+            return OTA_IDLE_TIMEOUT_S * 1000;
+        }
+    }
+
+public:
+    static void Init(void)
+    {
+        ESPNowCtrl::Init();
+        ESPNowCtrl::RegisterHandler(MSG_PAIR_RESPONSE, onPairResponse);
+        ESPNowCtrl::RegisterHandler(MSG_DISCOVERY_RESPONSE, onDiscoveryResponse);
+        ESPNowCtrl::RegisterHandler(MSG_GET_PARAM_DEFS_REQUEST, onParamDefsRequest);
+        ESPNowCtrl::RegisterHandler(MSG_READ_PARAM_REQUEST, onReadParamsRequest);
+        ESPNowCtrl::RegisterHandler(MSG_WRITE_PARAM_REQUEST, onWriteParamsRequest);
+        ESPNowCtrl::RegisterHandler(MSG_TRANSMIT_DONE, onTransmitDone);
+        ESPNowCtrl::SetDataSentCallback(OnDataSent);
+        ESPNowCtrl::SetDataReceivedCallback(onDataReceived);
+        ESPNowTxn::SetRescanHook(startFailover);
+        EventPush::SetHook(onStateChange);
+        ESPNowCtrl::SetChannel(WiFiKanal.Get());
+        ESPNowCtrl::AddPeer(MasterMacAdresa.Get(), 0);
+        GatewayList::Init(MasterMacAdresa.Get(), WiFiKanal.Get());
+        active_tasks[Communication_Task] = true;
+        send_data_before_sleep = false;
+        setState(CLIENT_START);
+    }
+
+    static void Task(void)
+    {
+        uint32_t wait_ms = step();
+        ClientEvent_t event;
+        TickType_t wait = (wait_ms == portMAX_DELAY) ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms);
+        while (xQueueReceive(events, &event, wait) == pdTRUE)
+        {
+            handleEvent(event);
+            wait = 0;
         }
     }
 
@@ -452,64 +963,28 @@ public:
                 StavZarizeni.Set(Parovani);
             }
         }
-        xSemaphoreGive(semaphore);
+        post(CLIENT_EV_PAIRING);
     }
 
-    static void Sleep(void)
+    /* Tells the master when the feeder wakes again, so it only has to listen then */
+    static void Sleep(int64_t wakeAt_us)
     {
-        if (memcmp(BroadcastAddress, MasterMacAdresa.Get(), 6))
+        if (ESPNowCtrl::IsInit() && memcmp(BroadcastAddress, MasterMacAdresa.Get(), 6))
         {
+            EventPush::Flush(MasterMacAdresa.Get());
             if (send_data_before_sleep)
             {
-                sendParamValues(MasterMacAdresa.Get());
+                ParamCursor_t cursor;
+                startParamValues(&cursor);
+                ESPNowTxn::StreamAndWait(MasterMacAdresa.Get(), paramValuesSource, &cursor);
             }
             SleepPayload payload;
-            payload.sleepTime = PeriodaKomunikace_S.Get();
+            int64_t sleep_us = wakeAt_us - TimeSync::Now_us();
+            payload.sleepTime = (sleep_us > 0) ? (uint32_t)((sleep_us + 500000LL) / 1000000LL) : 0;
+            payload.slotOffset_s = TimeSync::Slot();
+            payload.nextWake = (int32_t)(wakeAt_us / 1000000LL);
             ESPNowCtrl::SendMessage(MasterMacAdresa.Get(), MSG_SLEEP, payload, sizeof(payload));
+            GatewayList::Sleep(MasterMacAdresa.Get());
         }
     }
-
-     static bool ScanForMaster()
-    {
-        gotMasterResponse = false;
-        uint8_t macAddr[6];
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            memcpy(macAddr, MasterMacAdresa.Get(), 6);
-        }
-        WiFiKanal.Set(1);
-        uint8_t channel = 1;
-        while (!gotMasterResponse)
-        {
-            PairRequestPayload request;
-            request.channel = channel;
-            ESPNowCtrl::SetChannel(request.channel);
-            delay(5);
-            request.deviceType = DEVICE_TYPE;
-            if (ESPNowCtrl::SendMessage(macAddr, MSG_PAIR_REQUEST, request, sizeof(PairRequestPayload)))
-            {
-                delay(200);
-            }
-            if (gotMasterResponse)
-            {
-                break;
-            }
-            channel++;
-            if (channel > MAX_CHANNEL)
-            {
-                // WiFiKanal.Set(1);
-                Serial.println("Pair scan done.");
-                break;
-            }
-            // memcmp(MasterMacAdresa.Get(), BroadcastAddress, 6) == 0
-        }
-        delay(100);
-        ESPNowCtrl::SetChannel(WiFiKanal.Get());
-        delay(10);
-        if (!gotMasterResponse)
-        {
-            Serial.println("Device not paired.");
-        }
-        return gotMasterResponse;
-    }
-};
\ No newline at end of file
+};
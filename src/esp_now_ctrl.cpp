@@ -17,14 +17,30 @@
 #include "esp_wifi.h"
 #include "esp_mac.h"
 #include "log.h"
+#include "link_stats.h"
+#include "esp_now_txn.h"
+#include "common.h"
 
 uint8_t BroadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-DataReceivedCallback ESPNowCtrl::onDataReceivedCallback;
+MessageHandler ESPNowCtrl::handlers[MSG_NMR_TYPES];
 DataSentCallback ESPNowCtrl::onDataSentCallback;
-QueueHandle_t ESPNowCtrl::sendQueue = NULL;
+DataReceivedCallback ESPNowCtrl::onDataReceivedCallback;
+PollCallback ESPNowCtrl::pollCallback = NULL;
+bool ESPNowCtrl::pollPending = false;
 QueueHandle_t ESPNowCtrl::receiveQueue = NULL;
+uint32_t ESPNowCtrl::sentId = 0;
+uint8_t ESPNowCtrl::sentPeer[6];
+SendDone_t ESPNowCtrl::done;
+uint32_t ESPNowCtrl::droppedAt = 0;
+portMUX_TYPE ESPNowCtrl::statusMux = portMUX_INITIALIZER_UNLOCKED;
+RTC_DATA_ATTR uint8_t ESPNowCtrl::seqPeerNext = 0;
+RTC_DATA_ATTR PeerSeq_t ESPNowCtrl::seqPeers[SEQ_WINDOW_PEERS];
+portMUX_TYPE ESPNowCtrl::seqMux = portMUX_INITIALIZER_UNLOCKED;
 
 bool ESPNowCtrl::initDone = false;
+uint8_t ESPNowCtrl::homeChannel = 0;
+uint8_t ESPNowCtrl::radioChannel = 0;
+
 
 void ESPNowCtrl::Init()
 {
@@ -43,10 +59,9 @@ void ESPNowCtrl::Init()
     }
     esp_now_set_wake_window(UINT16_MAX);
 
-    if (sendQueue == NULL)
-    {
-        sendQueue = xQueueCreate(10, sizeof(esp_now_send_status_t));
-    }
+    sentId = 0;
+    done.id = 0;
+    radioChannel = 0;
     if (receiveQueue == NULL)
     {
         receiveQueue = xQueueCreate(100, sizeof(ESPNowItem_t));
@@ -56,6 +71,7 @@ void ESPNowCtrl::Init()
 
     esp_now_register_send_cb(onDataSent);
     AddPeer(BroadcastAddress, 0);
+    LinkStats::Init();
 
     initDone = true;
 }
@@ -92,54 +108,174 @@ void ESPNowCtrl::DeletePeer(const uint8_t *mac_addr)
     esp_now_del_peer(mac_addr);
 }
 
+void ESPNowCtrl::tune(uint8_t channel)
+{
+    if ((channel != 0) && (channel != radioChannel))
+    {
+        esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+        radioChannel = channel;
+    }
+}
+
+/* Sets the channel of the master, the radio returns to it whenever a frame has no channel of its own */
 void ESPNowCtrl::SetChannel(uint8_t channel)
 {
-    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    homeChannel = channel;
+    tune(channel);
+}
+
+/* Tunes the radio for the next frame, 0 = home channel */
+void ESPNowCtrl::UseChannel(uint8_t channel)
+{
+    tune((channel != 0) ? channel : homeChannel);
 }
 
 bool ESPNowCtrl::SendMessageInternal(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payload, uint8_t payloadSize, uint8_t retryCount)
 {
-    for (uint8_t retries = 0; retries < retryCount; retries++)
-    {
-        SendMessageRaw(peer_addr, messageType, payload, payloadSize);
+    TxnPolicy_t policy = {retryCount, 0, 0};
+    return ESPNowTxn::SendAndWait(peer_addr, messageType, payload, payloadSize, policy) == TXN_OK;
+}
+
+bool ESPNowCtrl::SendMessage(const uint8_t *peer_addr, uint8_t messageType, uint8_t retryCount)
+{
+    return SendMessageInternal(peer_addr, messageType, nullptr, 0, retryCount);
+}
 
-        esp_now_send_status_t status;
-        if (xQueueReceive(sendQueue, &status, (TickType_t)pdMS_TO_TICKS(1000)) == pdPASS)
+/* Caller holds seqMux, a new peer takes the oldest slot */
+PeerSeq_t *ESPNowCtrl::findSeqPeer(const uint8_t *mac_addr)
+{
+    for (int i = 0; i < SEQ_WINDOW_PEERS; i++)
+    {
+        if (seqPeers[i].used && (memcmp(seqPeers[i].mac_addr, mac_addr, 6) == 0))
         {
-            if (status == ESP_NOW_SEND_SUCCESS)
-            {
-                return true;
-            }
-            delay(50);
+            return &seqPeers[i];
         }
-        else
+    }
+    PeerSeq_t *entry = &seqPeers[seqPeerNext];
+    seqPeerNext = (seqPeerNext + 1) % SEQ_WINDOW_PEERS;
+    memset(entry, 0, sizeof(PeerSeq_t));
+    memcpy(entry->mac_addr, mac_addr, 6);
+    entry->used = true;
+    return entry;
+}
+
+uint8_t ESPNowCtrl::NextSeq(const uint8_t *peer_addr)
+{
+    portENTER_CRITICAL(&seqMux);
+    PeerSeq_t *entry = findSeqPeer(peer_addr);
+    if (++entry->txSeq == 0)
+    {
+        entry->txSeq = 1;
+    }
+    uint8_t seq = entry->txSeq;
+    portEXIT_CRITICAL(&seqMux);
+    return seq;
+}
+
+/* The peer paired again or lost the pairing, its counter may have restarted */
+void ESPNowCtrl::ResetSeq(const uint8_t *peer_addr)
+{
+    portENTER_CRITICAL(&seqMux);
+    PeerSeq_t *entry = findSeqPeer(peer_addr);
+    entry->rxTop = 0;
+    entry->rxSeen = 0;
+    portEXIT_CRITICAL(&seqMux);
+}
+
+Lane_t ESPNowCtrl::GetLane(uint8_t messageType)
+{
+    return (messageType < MSG_NMR_TYPES) ? (Lane_t)msg_limits[messageType].lane : LANE_BULK;
+}
+
+/*
+ * The driver reports accepted frames in send order, so a completion is
+ * numbered as the next frame still waiting for one and carries the MAC
+ * address it was sent to. The number and the peer are reserved before
+ * esp_now_send(), the completion can come from the Wi-Fi task before
+ * the call returns. A frame given up by DropPending() keeps its number,
+ * its late completion is counted for it and never for a newer frame.
+ * Only a completion missing SEND_DONE_LOST_MS after the drop is taken
+ * as lost and the count is resynced. frameId is the number of the
+ * accepted frame.
+ */
+bool ESPNowCtrl::SendFrame(const uint8_t *peer_addr, const Message *msg, uint32_t *frameId)
+{
+    if (msg->payloadSize > MAX_PAYLOAD_SIZE)
+    {
+        Serial.printf("Payload size is too large: %d bytes, Max allowed: %d bytes\n", msg->payloadSize, MAX_PAYLOAD_SIZE);
+        return false;
+    }
+    uint8_t lastPeer[6];
+    uint32_t now = millis();
+    portENTER_CRITICAL(&statusMux);
+    if ((done.id != sentId) && ((now - droppedAt) >= SEND_DONE_LOST_MS))
+    {
+        done.id = sentId;
+    }
+    memcpy(lastPeer, sentPeer, 6);
+    memcpy(sentPeer, peer_addr, 6);
+    uint32_t id = ++sentId;
+    portEXIT_CRITICAL(&statusMux);
+
+    if (esp_now_send(peer_addr, (const uint8_t *)msg, MESSAGE_HEADER_SIZE + msg->payloadSize) != ESP_OK)
+    {
+        /* A refused frame gets no completion, the number is given back */
+        portENTER_CRITICAL(&statusMux);
+        sentId = id - 1;
+        memcpy(sentPeer, lastPeer, 6);
+        if (done.id > sentId)
         {
-            Serial.println("Timeout waiting for send status.");
+            done.id = sentId;
         }
+        portEXIT_CRITICAL(&statusMux);
+        return false;
     }
-    return false; // Failed to send after retrying
+    *frameId = id;
+    return true;
 }
 
-bool ESPNowCtrl::SendMessage(const uint8_t *peer_addr, uint8_t messageType, uint8_t retryCount)
+/* A completion numbered as the frame but for another peer belongs to an older frame, the frame is reported failed */
+bool ESPNowCtrl::GetSendStatus(uint32_t frameId, esp_now_send_status_t *status)
 {
-    return SendMessageInternal(peer_addr, messageType, nullptr, 0, retryCount);
+    portENTER_CRITICAL(&statusMux);
+    bool isDone = (done.id == frameId);
+    bool samePeer = (memcmp(done.mac_addr, sentPeer, 6) == 0);
+    *status = samePeer ? done.status : ESP_NOW_SEND_FAIL;
+    portEXIT_CRITICAL(&statusMux);
+    return isDone;
+}
+
+/* The frame on the air is given up, its completion is still counted when it comes */
+void ESPNowCtrl::DropPending(void)
+{
+    uint32_t now = millis();
+    portENTER_CRITICAL(&statusMux);
+    droppedAt = now;
+    portEXIT_CRITICAL(&statusMux);
 }
 
-void ESPNowCtrl::SendMessageRaw(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payloadData, uint8_t payloadSize)
+void ESPNowCtrl::Wake(void)
 {
-    if (payloadSize > (MAX_PAYLOAD_SIZE))
+    /* An empty item only breaks the wait in Task() */
+    ESPNowItem_t item;
+    item.len = 0;
+    if (receiveQueue != NULL)
     {
-        Serial.printf("Payload size is too large: %d bytes, Max allowed: %d bytes\n", payloadSize, MAX_PAYLOAD_SIZE);
-        return;
+        xQueueSendToBack(receiveQueue, &item, 0);
     }
+}
 
-    Message msg;
-    msg.messageType = messageType;
-    msg.payloadSize = payloadSize;
-    memcpy(msg.payload, payloadData, payloadSize);
+void ESPNowCtrl::RegisterHandler(MessageType_t type, MessageHandler handler)
+{
+    if (type < MSG_NMR_TYPES)
+    {
+        handlers[type] = handler;
+    }
+}
 
-    size_t totalMessageSize = sizeof(msg.messageType) + sizeof(msg.payloadSize) + payloadSize;
-    esp_now_send(peer_addr, (uint8_t *)&msg, totalMessageSize);
+void ESPNowCtrl::SetDataSentCallback(DataSentCallback callback)
+{
+    onDataSentCallback = callback;
 }
 
 void ESPNowCtrl::SetDataReceivedCallback(DataReceivedCallback callback)
@@ -147,9 +283,10 @@ void ESPNowCtrl::SetDataReceivedCallback(DataReceivedCallback callback)
     onDataReceivedCallback = callback;
 }
 
-void ESPNowCtrl::SetDataSentCallback(DataSentCallback callback)
+/* Long work is cut into slices run between frames, so dispatch and send completions are never held up */
+void ESPNowCtrl::SetPollCallback(PollCallback callback)
 {
-    onDataSentCallback = callback;
+    pollCallback = callback;
 }
 
 void ESPNowCtrl::onDataRecv(const uint8_t *mac_addr, const uint8_t *incomingData, int len)
@@ -161,32 +298,113 @@ void ESPNowCtrl::onDataRecv(const uint8_t *mac_addr, const uint8_t *incomingData
         memcpy(msg.data, incomingData, len);
         msg.len = len;
 
-        xQueueSendToBack(receiveQueue, &msg, pdMS_TO_TICKS(2000));
+        // never block the Wi-Fi task, a frame dropped here is retried by the sender
+        xQueueSendToBack(receiveQueue, &msg, 0);
     }
 }
 
 void ESPNowCtrl::Task()
 {
     ESPNowItem_t data;
+    TickType_t wait = (ESPNowTxn::IsBusy() || pollPending) ? pdMS_TO_TICKS(ESPNOW_POLL_MS) : portMAX_DELAY;
 
-    if (xQueueReceive(receiveQueue, &data, portMAX_DELAY) == pdTRUE)
+    if ((xQueueReceive(receiveQueue, &data, wait) == pdTRUE) && (data.len > 0))
     {
-        if (onDataReceivedCallback != NULL)
+        Message *msg = (Message *)data.data;
+        switch (ProtoCheckFrame(data.data, data.len))
         {
-            if (data.len < (sizeof(Message) - MAX_PAYLOAD_SIZE))
-            {
-                SystemLog::PutLog("ESP-Now data too short", v_warning);
-                return;
-            }
-            Message *msg = (Message *)data.data;
-            if (data.len != (sizeof(Message) - MAX_PAYLOAD_SIZE + msg->payloadSize))
-            {
-                SystemLog::PutLog("ESP-Now data incorrect length", v_error);
-                return;
-            }
-            onDataReceivedCallback(data.mac_addr, msg, data.len);
+        case PROTO_OK:
+            dispatch(data.mac_addr, msg);
+            break;
+        case PROTO_TOO_SHORT:
+            SystemLog::PutLog("ESP-Now data too short", v_warning);
+            break;
+        case PROTO_BAD_LENGTH:
+            SystemLog::PutLog("ESP-Now data incorrect length", v_error);
+            break;
+        case PROTO_UNKNOWN_TYPE:
+            Serial.println("Received unknown data");
+            break;
+        case PROTO_BAD_SIZE:
+        default:
+            SystemLog::PutLog("ESP-Now payload size mismatch, type " + String(msg->messageType), v_warning);
+            break;
         }
     }
+    ESPNowTxn::Poll();
+    if (pollCallback != NULL)
+    {
+        pollPending = pollCallback();
+    }
+}
+
+void ESPNowCtrl::dispatch(const uint8_t *mac_addr, const Message *msg)
+{
+    const MessageLimits_t &limits = msg_limits[msg->messageType];
+    if ((limits.flags & MSG_FLAG_ONCE) && isDuplicate(mac_addr, msg->seq))
+    {
+        SystemLog::PutLog("ESP-Now duplicate dropped, type " + String(msg->messageType) + " seq " + String(msg->seq), v_info);
+        return;
+    }
+
+    MessageHandler handler = handlers[msg->messageType];
+    if (handler == NULL)
+    {
+        Serial.println("Received unhandled data");
+        return;
+    }
+    handler(mac_addr, msg->payload, msg->payloadSize);
+    if (onDataReceivedCallback != NULL)
+    {
+        onDataReceivedCallback(mac_addr, msg->messageType);
+    }
+}
+
+/*
+ * Anti-replay window: seq newer than rxTop (serial number arithmetic
+ * over 1..255) moves the window, an older seq inside the window is a
+ * duplicate when its bit is set. A seq older than the window cannot be
+ * a retransmission, the sender restarted its counter and the window
+ * starts over at it, as it does after SEQ_WINDOW_TIMEOUT_S of silence.
+ */
+bool ESPNowCtrl::isDuplicate(const uint8_t *mac_addr, uint8_t seq)
+{
+    if (seq == 0)
+    {
+        return false;
+    }
+
+    time_t now = Now();
+    bool duplicate = false;
+    portENTER_CRITICAL(&seqMux);
+    PeerSeq_t *entry = findSeqPeer(mac_addr);
+    int16_t diff = ((int16_t)seq - entry->rxTop + SEQ_SPACE) % SEQ_SPACE;
+    if (diff > (SEQ_SPACE / 2))
+    {
+        diff -= SEQ_SPACE;
+    }
+
+    if ((entry->rxTop == 0) || ((now - entry->rxTime) > SEQ_WINDOW_TIMEOUT_S) || (now < entry->rxTime) || (diff <= -SEQ_WINDOW_SIZE))
+    {
+        entry->rxTop = seq;
+        entry->rxSeen = 1;
+    }
+    else if (diff > 0)
+    {
+        entry->rxSeen = (diff >= SEQ_WINDOW_SIZE) ? 1 : ((entry->rxSeen << diff) | 1);
+        entry->rxTop = seq;
+    }
+    else if (entry->rxSeen & (1UL << -diff))
+    {
+        duplicate = true;
+    }
+    else
+    {
+        entry->rxSeen |= 1UL << -diff;
+    }
+    entry->rxTime = now;
+    portEXIT_CRITICAL(&seqMux);
+    return duplicate;
 }
 
 void ESPNowCtrl::onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
@@ -195,7 +413,19 @@ void ESPNowCtrl::onDataSent(const uint8_t *mac_addr, esp_now_send_status_t statu
     // {
     //     onDataSentCallback(mac_addr, status);
     // }
-    xQueueSendToBack(sendQueue, &status, portMAX_DELAY);
+    portENTER_CRITICAL(&statusMux);
+    bool pending = (done.id != sentId);
+    if (pending)
+    {
+        done.id++;
+        memcpy(done.mac_addr, mac_addr, 6);
+        done.status = status;
+    }
+    portEXIT_CRITICAL(&statusMux);
+    if (pending)
+    {
+        Wake();
+    }
 }
 
 void ESPNowCtrl::SetPower(wifi_power_t power)
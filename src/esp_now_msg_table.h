@@ -0,0 +1,42 @@
+/***********************************************************************
+ * Filename: esp_now_msg_table.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Defines the accepted payload size for every ESP-NOW message type
+ *     using the MSG macro. The rows must follow the order of
+ *     MessageType_t, which is checked at compile time. Messages are
+ *     dropped before dispatch when their payload size is out of range,
+ *     so handlers can rely on the fixed part of the payload struct.
+ *     Types flagged MSG_FLAG_ONCE are executed only once per sender
+ *     sequence number, retransmissions are dropped after the MAC ack.
+ *     The lane sets the send priority of outgoing frames of that type.
+ *
+ ***********************************************************************/
+
+// MSG(_type, _min_size, _max_size, _flags, _lane)
+MSG(MSG_NACK,                    0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_TRANSMIT_DONE,           0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_TELEMETRY)
+MSG(MSG_PAIR_REQUEST,            offsetof(PairRequestPayload, protocolVersion),  MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_PAIR_RESPONSE,           offsetof(PairResponsePayload, protocolVersion), MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_READ_PARAM_REQUEST,      sizeof(ReadRequestPayload),                     sizeof(ReadRequestPayload),    MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_READ_PARAM_RESPONSE,     offsetof(ReadResponsePayload, values),          sizeof(ReadResponsePayload),   MSG_FLAG_NONE, LANE_TELEMETRY)
+MSG(MSG_WRITE_PARAM_REQUEST,     offsetof(WriteRequestPayload, values),          sizeof(WriteRequestPayload),   MSG_FLAG_ONCE, LANE_CONTROL)
+MSG(MSG_WRITE_PARAM_RESPONSE,    0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_GET_PARAM_DEFS_REQUEST,  0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_GET_PARAM_DEFS_RESPONSE, offsetof(ParamDefsPayload, params),             sizeof(ParamDefsPayload),      MSG_FLAG_NONE, LANE_BULK)
+MSG(MSG_FW_UPDATE_REQUEST,       offsetof(UpdateRequestPayload, data),           sizeof(UpdateRequestPayload),  MSG_FLAG_NONE, LANE_BULK)
+MSG(MSG_FW_UPDATE_RESPONSE,      sizeof(UpdateResponsePayload),                  MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_GET_LOG_REQUEST,         0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_GET_LOG_RESPONSE,        offsetof(DataPayload, data),                    sizeof(DataPayload),           MSG_FLAG_NONE, LANE_BULK)
+MSG(MSG_TIME_SYNC_REQUEST,       0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_TIME_SYNC_RESPONSE,      offsetof(TimeSyncPayload, currentTime_ms),      MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_SLEEP,                   offsetof(SleepPayload, slotOffset_s),           MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_BYTE_STREAM,             offsetof(ByteStreamPayload, data.data),         sizeof(ByteStreamPayload),     MSG_FLAG_NONE, LANE_BULK)
+MSG(MSG_DISCOVERY,               sizeof(DiscoveryRequestPayload),                MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_ACK,                     0,                                              MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_FILE_REQUEST,            offsetof(FileRequestPayload, path),             sizeof(FileRequestPayload),    MSG_FLAG_ONCE, LANE_CONTROL)
+MSG(MSG_FILE_RESPONSE,           offsetof(FileResponsePayload, data),            sizeof(FileResponsePayload),   MSG_FLAG_NONE, LANE_BULK)
+MSG(MSG_EVENT_NOTIFY,            EventNotifyPayloadSize(1),                      sizeof(EventNotifyPayload),    MSG_FLAG_NONE, LANE_CONTROL)
+MSG(MSG_TELEMETRY_BATCH,         TelemetryBatchPayloadSize(1),                   sizeof(TelemetryBatchPayload), MSG_FLAG_NONE, LANE_TELEMETRY)
+MSG(MSG_DISCOVERY_RESPONSE,      sizeof(DiscoveryResponsePayload),               MAX_PAYLOAD_SIZE,              MSG_FLAG_NONE, LANE_CONTROL)
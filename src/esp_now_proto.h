@@ -0,0 +1,502 @@
+/***********************************************************************
+ * Filename: esp_now_proto.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     ESP-NOW wire protocol shared by the feeder and the master: message
+ *     types, payload layouts, the accepted payload sizes and the
+ *     protocol version, together with the link timing the master is
+ *     tuned to. Payloads are packed little-endian structs mapped
+ *     straight onto the frame, their sizes are checked at compile time
+ *     so a layout change cannot slip through. The header does not
+ *     depend on Arduino or ESP-IDF and builds on the host as well, on
+ *     little-endian hosts only.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* 1 = frames without the seq byte, 2 = seq byte and byte streams, 3 = discovery burst */
+#define ESPNOW_PROTOCOL_VERSION 3
+
+#define MAX_PAYLOAD_SIZE 240
+#define MAX_PACKET_SIZE 250
+#define MAX_PARAM_DEFS 5
+#define MAX_PARAM_READS_WRITES 118
+
+/* Link timing of the feeder, the master and the host emulator rely on the same values */
+#define COMMUNICATION_ATTEMPTS 2
+#define COMMUNICATION_RETRIES (COMMUNICATION_ATTEMPTS * 3) // tries of one upload frame before the master is searched again
+#define TXN_RETRY_DELAY_MS 50
+#define SCAN_RESPONSE_WAIT_MS 200
+#define SCAN_LISTEN_MS 30 // discovery responses come back within a few ms
+#define OTA_WINDOW_CHUNKS 8
+#define OTA_CHUNK_SIZE sizeof(((UpdateRequestPayload *)0)->data)
+#define OTA_ACK_RETRIES 1
+#define OTA_ACK_TIMEOUT_MS 300 // the master resends the window when no ack came in this time
+#define LOG_RECORD_SIZE 92     // Log_t, the record of MSG_GET_LOG_RESPONSE
+
+#define MSG_FLAG_NONE 0x00
+#define MSG_FLAG_ONCE 0x01 // not idempotent, a retransmitted frame is not executed again
+
+typedef enum
+{
+    DEVICE_TYPE_DOOR_CONTROL = 0,
+    DEVICE_TYPE_FEEDER = 1,
+} DeviceType_t;
+
+typedef enum
+{
+    MSG_NACK = 0,
+    MSG_TRANSMIT_DONE = 1,
+    MSG_PAIR_REQUEST = 2,
+    MSG_PAIR_RESPONSE,
+    MSG_READ_PARAM_REQUEST,
+    MSG_READ_PARAM_RESPONSE,
+    MSG_WRITE_PARAM_REQUEST,
+    MSG_WRITE_PARAM_RESPONSE,
+    MSG_GET_PARAM_DEFS_REQUEST,
+    MSG_GET_PARAM_DEFS_RESPONSE,
+    MSG_FW_UPDATE_REQUEST,
+    MSG_FW_UPDATE_RESPONSE,
+    MSG_GET_LOG_REQUEST,
+    MSG_GET_LOG_RESPONSE,
+    MSG_TIME_SYNC_REQUEST,
+    MSG_TIME_SYNC_RESPONSE,
+    MSG_SLEEP,
+    MSG_BYTE_STREAM,
+    MSG_DISCOVERY,
+    MSG_ACK,
+    MSG_FILE_REQUEST,
+    MSG_FILE_RESPONSE,
+    MSG_EVENT_NOTIFY,
+    MSG_TELEMETRY_BATCH,
+    MSG_DISCOVERY_RESPONSE,
+    MSG_NMR_TYPES
+} MessageType_t;
+
+typedef enum
+{
+    LANE_CONTROL = 0, // commands, pairing, acks
+    LANE_TELEMETRY,   // parameter values
+    LANE_BULK,        // logs, parameter definitions, streams
+    LANE_NMR
+} Lane_t;
+
+typedef enum
+{
+    PAIR_STATE_INITIAL_REQUEST = 0,
+    PAIR_STATE_APPROVED,
+    PAIR_STATE_PAIRED,
+    PAIR_STATE_EXPIRED
+} PairingState_t;
+
+typedef struct
+{
+    uint8_t messageType;
+    uint8_t payloadSize;
+    uint8_t seq; // per sender, 0 = not sequenced
+    uint8_t payload[MAX_PAYLOAD_SIZE];
+} __attribute__((packed)) Message;
+
+#define MESSAGE_HEADER_SIZE (sizeof(Message) - MAX_PAYLOAD_SIZE)
+
+typedef struct
+{
+    uint8_t deviceType;
+    uint8_t channel;
+    uint8_t protocolVersion;
+} __attribute__((packed)) PairRequestPayload;
+
+typedef struct
+{
+    uint8_t deviceType;
+    uint8_t channel;
+    uint8_t state;
+    uint8_t protocolVersion; // optional, masters before versioning do not send it
+} __attribute__((packed)) PairResponsePayload;
+
+/* Broadcast on every channel without waiting for a MAC ack, gateways that hear it answer with MSG_DISCOVERY_RESPONSE */
+typedef struct
+{
+    uint8_t deviceType;
+    uint8_t channel;
+    uint8_t protocolVersion;
+} __attribute__((packed)) DiscoveryRequestPayload;
+
+#define GATEWAY_CAP_PAIRING 0x01 // pairing window open, new feeders are accepted
+#define GATEWAY_CAP_KNOWN 0x02   // the requesting feeder is paired with this gateway
+#define GATEWAY_CAP_TIME 0x04    // serves time sync
+#define GATEWAY_CAP_OTA 0x08     // has an update for the feeder
+
+typedef struct
+{
+    uint8_t deviceType;
+    uint8_t channel;
+    uint8_t protocolVersion;
+    uint8_t capabilities; // GATEWAY_CAP_*
+    int8_t rssi;          // of the request as heard by the gateway
+    uint8_t feeders;      // feeders paired with the gateway
+} __attribute__((packed)) DiscoveryResponsePayload;
+
+typedef struct
+{
+    int32_t min;
+    int32_t max;
+    uint32_t dsc;
+    uint16_t adr;
+    uint8_t flags;
+    char ptxt[32];
+} __attribute__((packed)) pardef_t_espnow;
+
+typedef struct
+{
+    uint8_t numParams;                      
+    pardef_t_espnow params[MAX_PARAM_DEFS];
+} __attribute__((packed)) ParamDefsPayload;
+
+typedef struct
+{
+    uint16_t regAddr;
+    uint16_t nmr;
+} __attribute__((packed)) ReadRequestPayload;
+
+typedef struct
+{
+    uint16_t regAddr;
+    uint16_t nmr;
+    int16_t values[MAX_PARAM_READS_WRITES];
+} __attribute__((packed)) ReadResponsePayload;
+
+typedef struct
+{
+    uint16_t regAddr;
+    uint16_t nmr;
+    int16_t values[MAX_PARAM_READS_WRITES];
+} __attribute__((packed)) WriteRequestPayload;
+
+typedef struct
+{
+    uint32_t index;
+    uint8_t nmr;
+    union
+    {
+        uint8_t atr;
+        struct
+        {
+            uint8_t isFinal : 1;
+            uint8_t isFW : 1;
+            uint8_t isInfo : 1;
+            uint8_t isDelta : 1;
+            uint8_t : 4;
+        };
+    };
+    uint8_t data[230];
+} __attribute__((packed)) UpdateRequestPayload;
+
+typedef struct
+{
+    uint32_t size;
+    uint8_t sha256[32];
+} __attribute__((packed)) UpdateInfoPayload;
+
+typedef enum
+{
+    UPDATE_STATUS_OK = 0,
+    UPDATE_STATUS_DONE,
+    UPDATE_STATUS_ERROR,
+    UPDATE_STATUS_DIGEST_MISMATCH,
+    UPDATE_STATUS_NOT_STARTED,
+    UPDATE_STATUS_SIZE_MISMATCH,
+} UpdateStatus_t;
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t bitmap;
+    uint8_t status;
+} __attribute__((packed)) UpdateResponsePayload;
+
+typedef struct
+{
+    uint32_t index;
+    uint8_t nmr;
+    uint8_t data[230];
+} __attribute__((packed)) DataPayload;
+
+typedef struct
+{
+    int32_t currentTime;
+    char timezone[46];
+    int32_t sunriseTime;
+    int32_t sunsetTime;
+    uint16_t currentTime_ms; // optional, older masters send whole seconds only
+    uint16_t slotOffset_s;   // optional, wake slot within PeriodaKomunikace_S
+} __attribute__((packed)) TimeSyncPayload;
+
+
+typedef struct
+{
+    uint16_t linger_ms; // how long the feeder should keep listening, 0 = go to sleep
+} __attribute__((packed)) TransmitDonePayload;
+
+#define SLOT_NONE 0xFFFF
+
+/*
+ * Sent by the feeder before it sleeps. The master sends it to the feeder
+ * to assign a wake slot, only slotOffset_s is used then.
+ */
+typedef struct
+{
+    uint32_t sleepTime;
+    uint16_t slotOffset_s; // optional, SLOT_NONE when the feeder has no slot
+    int32_t nextWake;      // optional, planned wake time
+} __attribute__((packed)) SleepPayload;
+
+/*
+ * Byte stream frame. type holds the operation in the low nibble and the
+ * stream id chosen by the master in the high nibble, data.index is the
+ * byte offset. max_mr_bytes is the length limit in OPEN, the end offset
+ * in the read OPEN_ACK and the credit (first offset not granted) in the
+ * write OPEN_ACK and in CREDIT. A CREDIT with an index below the sent
+ * data rewinds a read stream, also after its CLOSE as long as the CLOSE
+ * is not acknowledged: the CLOSE is taken back, the data follows again
+ * and a new CLOSE ends the stream. Once the CLOSE is acknowledged the
+ * stream is gone, a gap found later needs a new OPEN at its offset.
+ */
+typedef struct
+{
+    uint32_t max_mr_bytes;
+    uint8_t type;
+    DataPayload data;
+} __attribute__((packed)) ByteStreamPayload;
+
+typedef enum
+{
+    BS_OP_OPEN = 0,  // master -> feeder, data holds ByteStreamOpenPayload
+    BS_OP_OPEN_ACK,  // data[0] is ByteStreamStatus_t
+    BS_OP_DATA,
+    BS_OP_CREDIT,    // receiver -> sender, index is the next offset expected
+    BS_OP_CLOSE,     // data[0] is ByteStreamStatus_t
+} ByteStreamOp_t;
+
+typedef enum
+{
+    BS_STATUS_OK = 0,
+    BS_STATUS_NO_RESOURCE,
+    BS_STATUS_OPEN_FAILED,
+    BS_STATUS_IO_ERROR,
+    BS_STATUS_BUSY,
+    BS_STATUS_ABORTED,
+} ByteStreamStatus_t;
+
+#define BS_OPEN_WRITE 0x01
+
+typedef struct
+{
+    uint8_t resource;
+    uint8_t flags;
+    uint8_t window; // frames sent ahead of the credit, 0 = default
+    char name[227];
+} __attribute__((packed)) ByteStreamOpenPayload;
+
+/* File contents are read and written with a BS_RES_FILE byte stream */
+typedef enum
+{
+    FILE_OP_LIST = 0,
+    FILE_OP_STAT,
+    FILE_OP_DELETE,
+} FileOp_t;
+
+typedef enum
+{
+    FILE_STATUS_OK = 0,
+    FILE_STATUS_NOT_FOUND,
+    FILE_STATUS_FAILED,
+    FILE_STATUS_BUSY,
+} FileStatus_t;
+
+#define FILE_ENTRY_DIR 0x01
+
+typedef struct
+{
+    uint8_t op;
+    uint16_t start; // first directory entry to list
+    char path[237];
+} __attribute__((packed)) FileRequestPayload;
+
+/* Directory entry, the name follows without a terminator */
+typedef struct
+{
+    uint32_t size;
+    uint8_t flags;
+    uint8_t nameLen;
+} __attribute__((packed)) FileEntryHeader;
+
+typedef struct
+{
+    uint8_t op;
+    uint8_t status;
+    uint16_t index; // directory index of the first entry
+    uint8_t nmr;    // entries in data
+    uint8_t last;   // no more entries follow
+    uint8_t data[234];
+} __attribute__((packed)) FileResponsePayload;
+
+/* State or error change pushed by the feeder, seq lets the master drop repeated records */
+typedef struct
+{
+    uint16_t seq;
+    uint16_t state;     // StavKrmitka
+    uint16_t errorCode; // ChybovyKod
+    uint8_t source;     // PovelOd
+    int32_t time;
+} __attribute__((packed)) EventRecord;
+
+typedef struct
+{
+    uint8_t nmr;
+    EventRecord events[21];
+} __attribute__((packed)) EventNotifyPayload;
+
+/* Values measured at a wake that did not bring the radio up */
+typedef struct
+{
+    int32_t time;
+    int32_t weight;      // AktualniVaha
+    uint16_t battery_mV; // NapetiBaterie_mV, bit 15 is the low battery flag
+    uint8_t weight_proc; // AktualniVaha_proc
+    uint8_t state;       // StavKrmitka
+} __attribute__((packed)) TelemetrySample;
+
+typedef struct
+{
+    uint8_t nmr;
+    uint8_t last; // no more samples follow in this upload
+    TelemetrySample samples[19];
+} __attribute__((packed)) TelemetryBatchPayload;
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t minSize;
+    uint8_t maxSize;
+    uint8_t flags;
+    uint8_t lane;
+} MessageLimits_t;
+
+/*
+ * Layout checks. A failing assert means the frame format changed, bump
+ * ESPNOW_PROTOCOL_VERSION and update the master together with this file.
+ */
+static_assert(MESSAGE_HEADER_SIZE == 3, "Message header layout changed");
+static_assert(sizeof(Message) <= MAX_PACKET_SIZE, "Message does not fit an ESP-NOW frame");
+static_assert(sizeof(PairRequestPayload) == 3, "PairRequestPayload layout changed");
+static_assert(sizeof(PairResponsePayload) == 4, "PairResponsePayload layout changed");
+static_assert(sizeof(DiscoveryRequestPayload) == 3, "DiscoveryRequestPayload layout changed");
+static_assert(sizeof(DiscoveryResponsePayload) == 6, "DiscoveryResponsePayload layout changed");
+static_assert(sizeof(pardef_t_espnow) == 47, "pardef_t_espnow layout changed");
+static_assert(sizeof(ParamDefsPayload) == 236, "ParamDefsPayload layout changed");
+static_assert(sizeof(ReadRequestPayload) == 4, "ReadRequestPayload layout changed");
+static_assert(sizeof(ReadResponsePayload) == MAX_PAYLOAD_SIZE, "ReadResponsePayload layout changed");
+static_assert(sizeof(WriteRequestPayload) == MAX_PAYLOAD_SIZE, "WriteRequestPayload layout changed");
+static_assert(sizeof(UpdateRequestPayload) == 236, "UpdateRequestPayload layout changed");
+static_assert(sizeof(UpdateInfoPayload) == 36, "UpdateInfoPayload layout changed");
+static_assert(sizeof(UpdateResponsePayload) == 9, "UpdateResponsePayload layout changed");
+static_assert(sizeof(DataPayload) == 235, "DataPayload layout changed");
+static_assert(sizeof(TimeSyncPayload) == 62, "TimeSyncPayload layout changed");
+static_assert(sizeof(TransmitDonePayload) == 2, "TransmitDonePayload layout changed");
+static_assert(sizeof(SleepPayload) == 10, "SleepPayload layout changed");
+static_assert(sizeof(ByteStreamPayload) == MAX_PAYLOAD_SIZE, "ByteStreamPayload layout changed");
+static_assert(sizeof(ByteStreamOpenPayload) == sizeof(((DataPayload *)0)->data), "ByteStreamOpenPayload must fill the stream data");
+static_assert(sizeof(FileRequestPayload) == MAX_PAYLOAD_SIZE, "FileRequestPayload layout changed");
+static_assert(sizeof(FileEntryHeader) == 6, "FileEntryHeader layout changed");
+static_assert(sizeof(FileResponsePayload) == MAX_PAYLOAD_SIZE, "FileResponsePayload layout changed");
+static_assert(sizeof(EventRecord) == 11, "EventRecord layout changed");
+static_assert(sizeof(EventNotifyPayload) <= MAX_PAYLOAD_SIZE, "EventNotifyPayload does not fit a frame");
+static_assert(sizeof(TelemetrySample) == 12, "TelemetrySample layout changed");
+static_assert(sizeof(TelemetryBatchPayload) <= MAX_PAYLOAD_SIZE, "TelemetryBatchPayload does not fit a frame");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "payload structs map little-endian frames, big-endian hosts are not supported");
+
+/* Payload sizes of the variable length messages */
+constexpr size_t ParamDefsPayloadSize(uint8_t nmr)
+{
+    return offsetof(ParamDefsPayload, params) + nmr * sizeof(pardef_t_espnow);
+}
+
+constexpr size_t ReadResponsePayloadSize(uint16_t nmr)
+{
+    return offsetof(ReadResponsePayload, values) + nmr * sizeof(int16_t);
+}
+
+constexpr size_t WriteRequestPayloadSize(uint16_t nmr)
+{
+    return offsetof(WriteRequestPayload, values) + nmr * sizeof(int16_t);
+}
+
+constexpr size_t EventNotifyPayloadSize(uint8_t nmr)
+{
+    return offsetof(EventNotifyPayload, events) + nmr * sizeof(EventRecord);
+}
+
+constexpr size_t TelemetryBatchPayloadSize(uint8_t nmr)
+{
+    return offsetof(TelemetryBatchPayload, samples) + nmr * sizeof(TelemetrySample);
+}
+
+static_assert(ParamDefsPayloadSize(MAX_PARAM_DEFS) <= MAX_PAYLOAD_SIZE, "MAX_PARAM_DEFS does not fit a frame");
+static_assert(ReadResponsePayloadSize(MAX_PARAM_READS_WRITES) <= MAX_PAYLOAD_SIZE, "MAX_PARAM_READS_WRITES does not fit a frame");
+
+#undef MSG
+#define MSG(_type, _min_size, _max_size, _flags, _lane) {_type, _min_size, _max_size, _flags, _lane},
+
+static constexpr MessageLimits_t msg_limits[] = {
+#include "esp_now_msg_table.h"
+};
+
+#undef MSG
+
+static constexpr bool checkMsgTable(size_t i)
+{
+    return (i >= MSG_NMR_TYPES) ||
+           ((msg_limits[i].type == i) && (msg_limits[i].minSize <= msg_limits[i].maxSize) && (msg_limits[i].maxSize <= MAX_PAYLOAD_SIZE) && (msg_limits[i].lane < LANE_NMR) && checkMsgTable(i + 1));
+}
+
+static_assert(sizeof(msg_limits) / sizeof(msg_limits[0]) == MSG_NMR_TYPES, "esp_now_msg_table.h must have a row for every MessageType_t");
+static_assert(checkMsgTable(0), "esp_now_msg_table.h rows must follow MessageType_t order and fit MAX_PAYLOAD_SIZE");
+
+typedef enum
+{
+    PROTO_OK = 0,
+    PROTO_TOO_SHORT,
+    PROTO_BAD_LENGTH,
+    PROTO_UNKNOWN_TYPE,
+    PROTO_BAD_SIZE,
+} ProtoCheck_t;
+
+/* Validates a received frame against the header and the message table */
+inline ProtoCheck_t ProtoCheckFrame(const uint8_t *frame, size_t len)
+{
+    if (len < MESSAGE_HEADER_SIZE)
+    {
+        return PROTO_TOO_SHORT;
+    }
+    const Message *msg = (const Message *)frame;
+    if (len != (MESSAGE_HEADER_SIZE + msg->payloadSize))
+    {
+        return PROTO_BAD_LENGTH;
+    }
+    if (msg->messageType >= MSG_NMR_TYPES)
+    {
+        return PROTO_UNKNOWN_TYPE;
+    }
+    const MessageLimits_t &limits = msg_limits[msg->messageType];
+    if ((msg->payloadSize < limits.minSize) || (msg->payloadSize > limits.maxSize))
+    {
+        return PROTO_BAD_SIZE;
+    }
+    return PROTO_OK;
+}
@@ -0,0 +1,427 @@
+/***********************************************************************
+ * Filename: esp_now_txn.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the ESPNowTxn class. Only one frame is on the air at a
+ *     time, ready transactions of the highest lane take turns frame by
+ *     frame. Poll() is called from the ESP-NOW receive task, it collects
+ *     the send status of the frame in flight and starts the next one.
+ *
+ ***********************************************************************/
+
+#include "esp_now_txn.h"
+#include "link_stats.h"
+#include "log.h"
+
+#define TXN_WAIT_TIMEOUT_MS 30000
+
+Txn_t ESPNowTxn::txns[TXN_MAX];
+int8_t ESPNowTxn::inFlight = -1;
+uint8_t ESPNowTxn::nextSlot[LANE_NMR];
+uint32_t ESPNowTxn::inFlightSince = 0;
+uint32_t ESPNowTxn::inFlightFrame = 0;
+TxnRescanHook ESPNowTxn::rescanHook = NULL;
+std::recursive_mutex ESPNowTxn::mutex;
+TaskHandle_t ESPNowTxn::pollTask = NULL;
+Txn_t *ESPNowTxn::loading = NULL;
+
+const TxnPolicy_t ESPNowTxn::DefaultPolicy = {3, 0, 0};
+
+TxnHandle_t ESPNowTxn::submit(const uint8_t *peer_addr, const TxnPolicy_t &policy, TxnSource source, void *ctx, const Message *msg, TxnCallback callback, TaskHandle_t notify)
+{
+    TxnHandle_t handle = TXN_INVALID;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        uint8_t freeSlots = 0;
+        for (uint8_t i = 0; i < TXN_MAX; i++)
+        {
+            freeSlots += (txns[i].state == TXN_FREE) ? 1 : 0;
+        }
+        bool control = (msg != NULL) && (ESPNowCtrl::GetLane(msg->messageType) == LANE_CONTROL);
+        if (!control && (freeSlots <= TXN_RESERVED_CONTROL))
+        {
+            freeSlots = 0;
+        }
+        for (uint8_t i = 0; (i < TXN_MAX) && (freeSlots > 0); i++)
+        {
+            Txn_t *txn = &txns[i];
+            if (txn->state != TXN_FREE)
+            {
+                continue;
+            }
+            txn->generation++;
+            memcpy(txn->peer_addr, peer_addr, 6);
+            txn->policy = policy;
+            if (txn->policy.retries == 0)
+            {
+                txn->policy.retries = 1;
+            }
+            txn->source = source;
+            txn->ctx = ctx;
+            txn->callback = callback;
+            txn->notify = notify;
+            txn->rescanned = false;
+            txn->attempt = 0;
+            txn->frames = 0;
+            txn->notBefore = millis();
+            txn->loaded = (msg != NULL);
+            txn->lane = LANE_BULK;
+            txn->channel = 0;
+            if (msg != NULL)
+            {
+                memcpy(&txn->msg, msg, MESSAGE_HEADER_SIZE + msg->payloadSize);
+                txn->msg.seq = ESPNowCtrl::NextSeq(peer_addr);
+                txn->lane = ESPNowCtrl::GetLane(msg->messageType);
+            }
+            txn->state = TXN_READY;
+            handle = ((TxnHandle_t)txn->generation << 8) | i;
+            break;
+        }
+    }
+    if (handle == TXN_INVALID)
+    {
+        SystemLog::PutLog("ESP-Now no free transaction", v_warning);
+        return TXN_INVALID;
+    }
+    ESPNowCtrl::Wake();
+    return handle;
+}
+
+Txn_t *ESPNowTxn::find(TxnHandle_t handle)
+{
+    if (handle == TXN_INVALID)
+    {
+        return NULL;
+    }
+    uint8_t idx = handle & 0xFF;
+    if ((idx >= TXN_MAX) || (txns[idx].state == TXN_FREE) || (txns[idx].generation != (handle >> 8)))
+    {
+        return NULL;
+    }
+    return &txns[idx];
+}
+
+void ESPNowTxn::complete(Txn_t *txn, TxnResult_t result)
+{
+    TxnHandle_t handle = ((TxnHandle_t)txn->generation << 8) | (txn - txns);
+    TxnCallback callback = txn->callback;
+    TaskHandle_t notify = txn->notify;
+    void *ctx = txn->ctx;
+
+    txn->state = TXN_FREE;
+    if (callback != NULL)
+    {
+        callback(handle, result, ctx);
+    }
+    if (notify != NULL)
+    {
+        xTaskNotify(notify, result, eSetValueWithOverwrite);
+    }
+}
+
+bool ESPNowTxn::load(Txn_t *txn)
+{
+    if (txn->source == NULL)
+    {
+        return false;
+    }
+    txn->channel = 0;
+    loading = txn;
+    bool more = txn->source(txn->ctx, &txn->msg);
+    loading = NULL;
+    if (!more)
+    {
+        return false;
+    }
+    txn->msg.seq = ESPNowCtrl::NextSeq(txn->peer_addr);
+    txn->lane = ESPNowCtrl::GetLane(txn->msg.messageType);
+    txn->loaded = true;
+    return true;
+}
+
+void ESPNowTxn::transmit(Txn_t *txn)
+{
+    LinkStats::OnAttempt(txn->peer_addr, txn->attempt > 0);
+    ESPNowCtrl::UseChannel(txn->channel);
+    txn->sendStart = micros();
+    if (!ESPNowCtrl::SendFrame(txn->peer_addr, &txn->msg, &inFlightFrame))
+    {
+        resolve(txn, false);
+        return;
+    }
+    txn->state = TXN_IN_FLIGHT;
+    inFlight = txn - txns;
+    inFlightSince = millis();
+}
+
+void ESPNowTxn::resolve(Txn_t *txn, bool success)
+{
+    LinkStats::OnResult(txn->peer_addr, success, micros() - txn->sendStart);
+    txn->state = TXN_READY;
+
+    if (success)
+    {
+        txn->loaded = false;
+        txn->attempt = 0;
+        txn->rescanned = false;
+        txn->frames++;
+        txn->notBefore = millis() + txn->policy.gap_ms;
+        if (txn->source == NULL)
+        {
+            complete(txn, TXN_OK);
+        }
+        return;
+    }
+
+    txn->attempt++;
+    if (txn->attempt < txn->policy.retries)
+    {
+        txn->notBefore = millis() + TXN_RETRY_DELAY_MS;
+    }
+    else if (txn->policy.flags & TXN_FLAG_BEST_EFFORT)
+    {
+        txn->loaded = false;
+        txn->attempt = 0;
+        txn->notBefore = millis();
+        if (txn->source == NULL)
+        {
+            complete(txn, TXN_FAILED);
+        }
+    }
+    else if ((txn->policy.flags & TXN_FLAG_RESCAN) && !txn->rescanned && (rescanHook != NULL))
+    {
+        Serial.println("Communication error");
+        txn->rescanned = true;
+        txn->state = TXN_WAIT_RESCAN;
+        rescanHook();
+    }
+    else
+    {
+        complete(txn, TXN_FAILED);
+    }
+}
+
+TxnHandle_t ESPNowTxn::Send(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payload, uint8_t payloadSize, const TxnPolicy_t &policy, TxnCallback callback, void *ctx)
+{
+    if (payloadSize > MAX_PAYLOAD_SIZE)
+    {
+        Serial.printf("Payload size is too large: %d bytes, Max allowed: %d bytes\n", payloadSize, MAX_PAYLOAD_SIZE);
+        return TXN_INVALID;
+    }
+    Message msg;
+    msg.messageType = messageType;
+    msg.payloadSize = payloadSize;
+    if (payloadSize > 0)
+    {
+        memcpy(msg.payload, payload, payloadSize);
+    }
+    return submit(peer_addr, policy, NULL, ctx, &msg, callback, NULL);
+}
+
+TxnHandle_t ESPNowTxn::Stream(const uint8_t *peer_addr, TxnSource source, void *ctx, const TxnPolicy_t &policy, TxnCallback callback)
+{
+    return submit(peer_addr, policy, source, ctx, NULL, callback, NULL);
+}
+
+TxnResult_t ESPNowTxn::wait(TxnHandle_t handle)
+{
+    if (handle == TXN_INVALID)
+    {
+        return TXN_FAILED;
+    }
+    uint32_t result;
+    if (xTaskNotifyWait(0, ULONG_MAX, &result, pdMS_TO_TICKS(TXN_WAIT_TIMEOUT_MS)) != pdTRUE)
+    {
+        Abort(handle);
+        xTaskNotifyStateClear(NULL);
+        return TXN_ABORTED;
+    }
+    return (TxnResult_t)result;
+}
+
+TxnResult_t ESPNowTxn::SendAndWait(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payload, uint8_t payloadSize, const TxnPolicy_t &policy)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (self == pollTask)
+    {
+        SystemLog::PutLog("ESP-Now blocking send from the receive task", v_error);
+        return TXN_ABORTED;
+    }
+    if (payloadSize > MAX_PAYLOAD_SIZE)
+    {
+        return TXN_FAILED;
+    }
+    Message msg;
+    msg.messageType = messageType;
+    msg.payloadSize = payloadSize;
+    if (payloadSize > 0)
+    {
+        memcpy(msg.payload, payload, payloadSize);
+    }
+    xTaskNotifyStateClear(NULL);
+    return wait(submit(peer_addr, policy, NULL, NULL, &msg, NULL, self));
+}
+
+TxnResult_t ESPNowTxn::StreamAndWait(const uint8_t *peer_addr, TxnSource source, void *ctx, const TxnPolicy_t &policy)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    if (self == pollTask)
+    {
+        SystemLog::PutLog("ESP-Now blocking send from the receive task", v_error);
+        return TXN_ABORTED;
+    }
+    xTaskNotifyStateClear(NULL);
+    return wait(submit(peer_addr, policy, source, ctx, NULL, NULL, self));
+}
+
+bool ESPNowTxn::IsActive(TxnHandle_t handle)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return find(handle) != NULL;
+}
+
+void ESPNowTxn::Abort(TxnHandle_t handle)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Txn_t *txn = find(handle);
+    if (txn != NULL)
+    {
+        /* A frame in flight still gets its status, it is dropped in Poll() */
+        complete(txn, TXN_ABORTED);
+    }
+}
+
+bool ESPNowTxn::IsBusy(void)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (uint8_t i = 0; i < TXN_MAX; i++)
+    {
+        if (txns[i].state != TXN_FREE)
+        {
+            return true;
+        }
+    }
+    return inFlight >= 0;
+}
+
+/* Only from a source function, the frame being loaded is sent on channel instead of the home channel */
+void ESPNowTxn::SetFrameChannel(uint8_t channel)
+{
+    if (loading != NULL)
+    {
+        loading->channel = channel;
+    }
+}
+
+void ESPNowTxn::SetRescanHook(TxnRescanHook hook)
+{
+    rescanHook = hook;
+}
+
+/* Resumes the transactions waiting for the rescan, peer_addr moves them to a gateway found in its place */
+void ESPNowTxn::RescanDone(bool found, const uint8_t *peer_addr)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (uint8_t i = 0; i < TXN_MAX; i++)
+    {
+        Txn_t *txn = &txns[i];
+        if (txn->state != TXN_WAIT_RESCAN)
+        {
+            continue;
+        }
+        if (found)
+        {
+            if ((peer_addr != NULL) && (memcmp(txn->peer_addr, peer_addr, 6) != 0))
+            {
+                memcpy(txn->peer_addr, peer_addr, 6);
+                if (txn->loaded)
+                {
+                    txn->msg.seq = ESPNowCtrl::NextSeq(peer_addr);
+                }
+            }
+            txn->attempt = 0;
+            txn->notBefore = millis();
+            txn->state = TXN_READY;
+        }
+        else
+        {
+            complete(txn, TXN_FAILED);
+        }
+    }
+}
+
+void ESPNowTxn::Poll(void)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    pollTask = xTaskGetCurrentTaskHandle();
+
+    if (inFlight >= 0)
+    {
+        Txn_t *txn = &txns[inFlight];
+        esp_now_send_status_t status;
+        if (ESPNowCtrl::GetSendStatus(inFlightFrame, &status))
+        {
+            inFlight = -1;
+            if (txn->state == TXN_IN_FLIGHT)
+            {
+                resolve(txn, status == ESP_NOW_SEND_SUCCESS);
+            }
+        }
+        else if ((millis() - inFlightSince) > TXN_STATUS_TIMEOUT_MS)
+        {
+            Serial.println("Timeout waiting for send status.");
+            ESPNowCtrl::DropPending();
+            inFlight = -1;
+            if (txn->state == TXN_IN_FLIGHT)
+            {
+                resolve(txn, false);
+            }
+        }
+        else
+        {
+            return;
+        }
+    }
+
+    /*
+     * A stream is loaded only when it is picked and its frame goes out
+     * right away, sources may have side effects. It is picked by the
+     * lane of its previous frame, a new stream starts in the bulk lane.
+     */
+    Txn_t *owner = NULL;
+    for (uint8_t i = 0; i < TXN_MAX; i++)
+    {
+        if ((txns[i].state == TXN_READY) && (txns[i].policy.flags & TXN_FLAG_EXCLUSIVE))
+        {
+            owner = &txns[i];
+            break;
+        }
+    }
+
+    uint32_t now = millis();
+    for (uint8_t lane = 0; lane < LANE_NMR; lane++)
+    {
+        for (uint8_t i = 0; i < TXN_MAX; i++)
+        {
+            uint8_t idx = (nextSlot[lane] + i) % TXN_MAX;
+            Txn_t *txn = &txns[idx];
+            if ((txn->state != TXN_READY) || (txn->lane != lane) || ((int32_t)(now - txn->notBefore) < 0) ||
+                ((owner != NULL) && (txn != owner)))
+            {
+                continue;
+            }
+            if (!txn->loaded && !load(txn))
+            {
+                complete(txn, TXN_OK);
+                continue;
+            }
+            nextSlot[lane] = (idx + 1) % TXN_MAX;
+            transmit(txn);
+            if (inFlight >= 0)
+            {
+                return;
+            }
+        }
+    }
+}
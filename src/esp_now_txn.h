@@ -0,0 +1,126 @@
+/***********************************************************************
+ * Filename: esp_now_txn.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the ESPNowTxn class, an asynchronous transaction layer
+ *     on top of ESPNowCtrl. A transaction sends one frame or a stream of
+ *     frames produced by a source function, each frame is retried
+ *     according to the transaction policy and the master can be
+ *     searched for again when the link is lost. Several transactions
+ *     run at once, their frames are interleaved. Completion is reported
+ *     by a callback or a task notification. The layer is driven from
+ *     the ESP-NOW receive task, so it never blocks message dispatch.
+ *     Frames are scheduled by lane (control, telemetry, bulk) taken
+ *     from the message table, a bulk stream yields after every frame.
+ *     A source may put its frame on another channel, the radio is tuned
+ *     when the frame is transmitted. An exclusive transaction (scan,
+ *     probe) holds the radio until it completes, other transactions
+ *     wait so that nothing goes out on its channel or retunes the radio
+ *     during its listen gaps.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "esp_now_ctrl.h"
+
+#define TXN_MAX 6
+#define TXN_INVALID 0xFFFF
+#define TXN_STATUS_TIMEOUT_MS 1000
+#define TXN_RESERVED_CONTROL 1 // slots kept free for single control frames
+
+#define TXN_FLAG_RESCAN 0x01      // scan for the master when the retries are exhausted
+#define TXN_FLAG_BEST_EFFORT 0x02 // a failed frame is skipped instead of failing the transaction
+#define TXN_FLAG_EXCLUSIVE 0x04   // no other transaction is sent until this one completes
+
+typedef uint16_t TxnHandle_t;
+
+typedef enum
+{
+    TXN_OK = 0,
+    TXN_FAILED,
+    TXN_ABORTED,
+} TxnResult_t;
+
+typedef enum
+{
+    TXN_FREE = 0,
+    TXN_READY,
+    TXN_IN_FLIGHT,
+    TXN_WAIT_RESCAN,
+} TxnState_t;
+
+typedef struct
+{
+    uint8_t retries;  // MAC attempts per frame
+    uint16_t gap_ms;  // pause after an acknowledged frame
+    uint8_t flags;
+} TxnPolicy_t;
+
+/* Fills the next frame of a stream, returns false when there is nothing more to send */
+typedef bool (*TxnSource)(void *ctx, Message *msg);
+typedef void (*TxnCallback)(TxnHandle_t handle, TxnResult_t result, void *ctx);
+typedef void (*TxnRescanHook)(void);
+
+typedef struct
+{
+    TxnState_t state;
+    uint8_t generation;
+    uint8_t peer_addr[6];
+    TxnPolicy_t policy;
+    TxnSource source;
+    TxnCallback callback;
+    TaskHandle_t notify;
+    void *ctx;
+    bool loaded;
+    bool rescanned;
+    Lane_t lane;
+    uint8_t channel; // 0 = home channel
+    uint8_t attempt;
+    uint32_t frames;
+    uint32_t notBefore;
+    uint32_t sendStart;
+    Message msg;
+} Txn_t;
+
+class ESPNowTxn
+{
+private:
+    static Txn_t txns[TXN_MAX];
+    static int8_t inFlight;
+    static uint8_t nextSlot[LANE_NMR];
+    static uint32_t inFlightSince;
+    static uint32_t inFlightFrame;
+    static TxnRescanHook rescanHook;
+    static std::recursive_mutex mutex;
+    static TaskHandle_t pollTask;
+    static Txn_t *loading;
+
+    static TxnHandle_t submit(const uint8_t *peer_addr, const TxnPolicy_t &policy, TxnSource source, void *ctx, const Message *msg, TxnCallback callback, TaskHandle_t notify);
+    static Txn_t *find(TxnHandle_t handle);
+    static void complete(Txn_t *txn, TxnResult_t result);
+    static void resolve(Txn_t *txn, bool success);
+    static bool load(Txn_t *txn);
+    static void transmit(Txn_t *txn);
+    static TxnResult_t wait(TxnHandle_t handle);
+
+public:
+    static const TxnPolicy_t DefaultPolicy;
+
+    static TxnHandle_t Send(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payload, uint8_t payloadSize, const TxnPolicy_t &policy = DefaultPolicy, TxnCallback callback = NULL, void *ctx = NULL);
+    static TxnHandle_t Stream(const uint8_t *peer_addr, TxnSource source, void *ctx, const TxnPolicy_t &policy = DefaultPolicy, TxnCallback callback = NULL);
+    static TxnResult_t SendAndWait(const uint8_t *peer_addr, uint8_t messageType, const uint8_t *payload, uint8_t payloadSize, const TxnPolicy_t &policy = DefaultPolicy);
+    static TxnResult_t StreamAndWait(const uint8_t *peer_addr, TxnSource source, void *ctx, const TxnPolicy_t &policy = DefaultPolicy);
+
+    static bool IsActive(TxnHandle_t handle);
+    static void Abort(TxnHandle_t handle);
+    static bool IsBusy(void);
+
+    static void SetFrameChannel(uint8_t channel);
+    static void SetRescanHook(TxnRescanHook hook);
+    static void RescanDone(bool found, const uint8_t *peer_addr = NULL);
+
+    static void Poll(void);
+};
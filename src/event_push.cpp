@@ -0,0 +1,147 @@
+/***********************************************************************
+ * Filename: event_push.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the EventPush class. The queue is sent as a stream, a
+ *     frame takes as many records as fit. The records of a frame stay
+ *     queued until its MAC ack, so a lost frame is sent again with the
+ *     next attempt. When the queue is full the oldest record not yet on
+ *     the air is dropped, the newest state is always kept.
+ *
+ ***********************************************************************/
+
+#include "event_push.h"
+#include "common.h"
+
+RTC_DATA_ATTR EventRecord EventPush::queue[EVENT_QUEUE_LEN];
+RTC_DATA_ATTR uint8_t EventPush::count = 0;
+RTC_DATA_ATTR uint16_t EventPush::nextSeq = 0;
+RTC_DATA_ATTR uint16_t EventPush::reportedState = EVENT_NOT_REPORTED;
+RTC_DATA_ATTR uint16_t EventPush::reportedError = EVENT_NOT_REPORTED;
+uint8_t EventPush::inFlight = 0;
+TxnHandle_t EventPush::txn = TXN_INVALID;
+EventPushHook EventPush::hook = NULL;
+std::mutex EventPush::mutex;
+const TxnPolicy_t EventPush::Policy = {6, 0, 0};
+
+void EventPush::drop(uint8_t nmr)
+{
+    nmr = min(nmr, count);
+    memmove(&queue[0], &queue[nmr], (count - nmr) * sizeof(EventRecord));
+    count -= nmr;
+}
+
+bool EventPush::frameSource(void *ctx, Message *msg)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    /* The source is asked for the next frame only after the previous one was acknowledged */
+    drop(inFlight);
+    inFlight = 0;
+    if (count == 0)
+    {
+        return false;
+    }
+    EventNotifyPayload *payload = (EventNotifyPayload *)msg->payload;
+    inFlight = min((size_t)count, EVENT_FRAME_MAX);
+    payload->nmr = inFlight;
+    memcpy(payload->events, queue, inFlight * sizeof(EventRecord));
+    msg->messageType = MSG_EVENT_NOTIFY;
+    msg->payloadSize = EventNotifyPayloadSize(inFlight);
+    return true;
+}
+
+void EventPush::onDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result == TXN_OK)
+    {
+        drop(inFlight);
+    }
+    inFlight = 0;
+}
+
+void EventPush::Init(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (reportedState == EVENT_NOT_REPORTED)
+    {
+        /* Power on, the master learns the initial state from the parameter upload */
+        reportedState = StavKrmitka.Get();
+        reportedError = ChybovyKod.Get();
+    }
+}
+
+/* Called after StavKrmitka or ChybovyKod was written, queues a record when either differs from the last one reported */
+void EventPush::Changed(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint16_t state = StavKrmitka.Get();
+        uint16_t error = ChybovyKod.Get();
+        if ((state == reportedState) && (error == reportedError))
+        {
+            return;
+        }
+        reportedState = state;
+        reportedError = error;
+
+        if (count == EVENT_QUEUE_LEN)
+        {
+            uint8_t idx = (inFlight < count) ? inFlight : 0;
+            memmove(&queue[idx], &queue[idx + 1], (count - idx - 1) * sizeof(EventRecord));
+            count--;
+            if (idx < inFlight)
+            {
+                inFlight--;
+            }
+        }
+        EventRecord *record = &queue[count++];
+        record->seq = nextSeq++;
+        record->state = state;
+        record->errorCode = error;
+        record->source = PovelOd.Get();
+        record->time = (int32_t)Now();
+    }
+    if (hook)
+    {
+        hook();
+    }
+}
+
+bool EventPush::Pending(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return count > 0;
+}
+
+/* Starts sending the queue unless a stream is already running, it picks up new records by itself */
+void EventPush::Send(const uint8_t *mac_addr)
+{
+    if (!Pending() || ESPNowTxn::IsActive(txn))
+    {
+        return;
+    }
+    txn = ESPNowTxn::Stream(mac_addr, frameSource, NULL, Policy, onDone);
+}
+
+/* Sends what is left in the queue before sleep */
+void EventPush::Flush(const uint8_t *mac_addr)
+{
+    if (!Pending() || ESPNowTxn::IsActive(txn))
+    {
+        return;
+    }
+    TxnResult_t result = ESPNowTxn::StreamAndWait(mac_addr, frameSource, NULL, Policy);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result == TXN_OK)
+    {
+        drop(inFlight);
+    }
+    inFlight = 0;
+}
+
+void EventPush::SetHook(EventPushHook pushHook)
+{
+    hook = pushHook;
+}
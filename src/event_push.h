@@ -0,0 +1,53 @@
+/***********************************************************************
+ * Filename: event_push.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the EventPush class, which reports changes of StavKrmitka
+ *     and ChybovyKod to the master with MSG_EVENT_NOTIFY as soon as they
+ *     happen, instead of waiting for the next upload of the parameter
+ *     values. Records are queued in RTC memory, the client sends them
+ *     right away while the radio is up and first thing at the next wake
+ *     otherwise.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "parameters.h"
+#include "esp_now_ctrl.h"
+#include "esp_now_txn.h"
+
+#define EVENT_QUEUE_LEN 16
+#define EVENT_FRAME_MAX (sizeof(((EventNotifyPayload *)0)->events) / sizeof(EventRecord))
+#define EVENT_NOT_REPORTED 0xFFFF
+
+typedef void (*EventPushHook)(void);
+
+class EventPush
+{
+private:
+    static RTC_DATA_ATTR EventRecord queue[EVENT_QUEUE_LEN];
+    static RTC_DATA_ATTR uint8_t count;
+    static RTC_DATA_ATTR uint16_t nextSeq;
+    static RTC_DATA_ATTR uint16_t reportedState;
+    static RTC_DATA_ATTR uint16_t reportedError;
+    static uint8_t inFlight; // records of the frame on the air, dropped once it is acknowledged
+    static TxnHandle_t txn;
+    static EventPushHook hook;
+    static std::mutex mutex;
+    static const TxnPolicy_t Policy;
+
+    static void drop(uint8_t nmr);
+    static bool frameSource(void *ctx, Message *msg);
+    static void onDone(TxnHandle_t handle, TxnResult_t result, void *ctx);
+
+public:
+    static void Init(void);
+    static void Changed(void);
+    static bool Pending(void);
+    static void Send(const uint8_t *mac_addr);
+    static void Flush(const uint8_t *mac_addr);
+    static void SetHook(EventPushHook pushHook);
+};
@@ -15,6 +15,7 @@
 #include "error.h"
 #include "deep_sleep_ctrl.h"
 #include "weight.h"
+#include "event_push.h"
 
 #define TIME_SCHEDULE(_t_secs) ((uint32_t)((_t_secs) * 1000 / FEEDER_CONTROL_TASK_PERIOD_MS))
 
@@ -251,6 +252,7 @@ bool FeederCtrl::IsState(FeederState_t state)
 void FeederCtrl::SetState(FeederState_t state)
 {
     StavKrmitka.Set(state);
+    EventPush::Changed();
 }
 
 void FeederCtrl::TimerStart(uint32_t secs)
@@ -54,6 +54,11 @@ public:
     }
     static void Event(FeederEvents_t event)
     {
+        if (event >= nmr_events)
+        {
+            // no_event of an error entry, the bit would never be cleared and keep the feeder awake
+            return;
+        }
         // std::lock_guard<std::mutex> lock(events_mutex);
         active_tasks[Position_Task] = true;
         events |= 1 << event;
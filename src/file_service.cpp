@@ -0,0 +1,191 @@
+/***********************************************************************
+ * Filename: file_service.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the FileService class. A listing is sent as a stream,
+ *     every frame is filled with as many entries as fit. The directory
+ *     is opened again for each frame, so storageFS_lock is never held
+ *     while a frame waits for the radio.
+ *
+ ***********************************************************************/
+
+#include "file_service.h"
+#include "common.h"
+#include "log.h"
+
+FileListCursor_t FileService::list;
+TxnHandle_t FileService::listTxn = TXN_INVALID;
+const TxnPolicy_t FileService::ListPolicy = {5, 0, 0};
+
+bool FileService::readPath(const FileRequestPayload *request, uint8_t payloadSize, char *path)
+{
+    size_t len = strnlen(request->path, payloadSize - offsetof(FileRequestPayload, path));
+    memcpy(path, request->path, len);
+    path[len] = '\0';
+    return path[0] == '/';
+}
+
+uint8_t FileService::putEntry(uint8_t *buf, uint8_t room, File &file)
+{
+    const char *name = file.name();
+    size_t nameLen = min(strlen(name), sizeof(((FileResponsePayload *)0)->data) - sizeof(FileEntryHeader));
+    if ((sizeof(FileEntryHeader) + nameLen) > room)
+    {
+        return 0;
+    }
+    FileEntryHeader *entry = (FileEntryHeader *)buf;
+    entry->size = file.isDirectory() ? 0 : file.size();
+    entry->flags = file.isDirectory() ? FILE_ENTRY_DIR : 0;
+    entry->nameLen = nameLen;
+    memcpy(buf + sizeof(FileEntryHeader), name, nameLen);
+    return sizeof(FileEntryHeader) + nameLen;
+}
+
+bool FileService::listSource(void *ctx, Message *msg)
+{
+    FileListCursor_t *cursor = (FileListCursor_t *)ctx;
+    FileResponsePayload *response = (FileResponsePayload *)msg->payload;
+    if (cursor->done)
+    {
+        return false;
+    }
+    response->op = FILE_OP_LIST;
+    response->status = FILE_STATUS_OK;
+    response->index = cursor->next;
+    response->nmr = 0;
+    response->last = false;
+    uint8_t used = 0;
+    {
+        std::lock_guard<std::mutex> lock(storageFS_lock);
+        File dir = storageFS.open(cursor->path);
+        if (!dir || !dir.isDirectory())
+        {
+            response->status = FILE_STATUS_NOT_FOUND;
+            response->last = true;
+        }
+        else
+        {
+            uint16_t idx = 0;
+            File entry = dir.openNextFile();
+            while (entry)
+            {
+                if (idx >= cursor->next)
+                {
+                    uint8_t n = putEntry(&response->data[used], sizeof(response->data) - used, entry);
+                    if (n == 0)
+                    {
+                        break;
+                    }
+                    used += n;
+                    response->nmr++;
+                }
+                idx++;
+                entry = dir.openNextFile();
+            }
+            response->last = !entry;
+            cursor->next = idx;
+        }
+    }
+    cursor->done = response->last;
+    msg->messageType = MSG_FILE_RESPONSE;
+    msg->payloadSize = offsetof(FileResponsePayload, data) + used;
+    return true;
+}
+
+void FileService::reply(const uint8_t *mac_addr, FileOp_t op, FileStatus_t status, const uint8_t *entry, uint8_t entrySize)
+{
+    FileResponsePayload response;
+    response.op = op;
+    response.status = status;
+    response.index = 0;
+    response.nmr = (entrySize > 0) ? 1 : 0;
+    response.last = true;
+    if (entrySize > 0)
+    {
+        memcpy(response.data, entry, entrySize);
+    }
+    ESPNowTxn::Send(mac_addr, MSG_FILE_RESPONSE, (const uint8_t *)&response, offsetof(FileResponsePayload, data) + entrySize);
+}
+
+void FileService::handleStat(const uint8_t *mac_addr, const char *path)
+{
+    uint8_t entry[sizeof(((FileResponsePayload *)0)->data)];
+    uint8_t entrySize = 0;
+    {
+        std::lock_guard<std::mutex> lock(storageFS_lock);
+        File file = storageFS.exists(path) ? storageFS.open(path) : File();
+        if (file)
+        {
+            entrySize = putEntry(entry, sizeof(entry), file);
+        }
+    }
+    reply(mac_addr, FILE_OP_STAT, (entrySize > 0) ? FILE_STATUS_OK : FILE_STATUS_NOT_FOUND, entry, entrySize);
+}
+
+void FileService::handleDelete(const uint8_t *mac_addr, const char *path)
+{
+    FileStatus_t status = FILE_STATUS_OK;
+    {
+        std::lock_guard<std::mutex> lock(storageFS_lock);
+        if (!storageFS.exists(path))
+        {
+            status = FILE_STATUS_NOT_FOUND;
+        }
+        else
+        {
+            File file = storageFS.open(path);
+            bool dir = file && file.isDirectory();
+            file.close();
+            if (!(dir ? storageFS.rmdir(path) : storageFS.remove(path)))
+            {
+                status = FILE_STATUS_FAILED;
+            }
+        }
+    }
+    if (status == FILE_STATUS_OK)
+    {
+        SystemLog::PutLog(String("File deleted remotely: ") + path, v_info);
+    }
+    reply(mac_addr, FILE_OP_DELETE, status, NULL, 0);
+}
+
+void FileService::onRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    const FileRequestPayload *request = (const FileRequestPayload *)payload;
+    char path[FILE_PATH_MAX + 1];
+    if (!readPath(request, payloadSize, path))
+    {
+        reply(mac_addr, (FileOp_t)request->op, FILE_STATUS_NOT_FOUND, NULL, 0);
+        return;
+    }
+
+    switch (request->op)
+    {
+    case FILE_OP_LIST:
+        ESPNowTxn::Abort(listTxn);
+        strcpy(list.path, path);
+        list.next = request->start;
+        list.done = false;
+        listTxn = ESPNowTxn::Stream(mac_addr, listSource, &list, ListPolicy);
+        if (listTxn == TXN_INVALID)
+        {
+            reply(mac_addr, FILE_OP_LIST, FILE_STATUS_BUSY, NULL, 0);
+        }
+        break;
+    case FILE_OP_STAT:
+        handleStat(mac_addr, path);
+        break;
+    case FILE_OP_DELETE:
+        handleDelete(mac_addr, path);
+        break;
+    default:
+        reply(mac_addr, (FileOp_t)request->op, FILE_STATUS_FAILED, NULL, 0);
+        break;
+    }
+}
+
+void FileService::Init(void)
+{
+    ESPNowCtrl::RegisterHandler(MSG_FILE_REQUEST, onRequest);
+}
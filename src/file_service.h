@@ -0,0 +1,45 @@
+/***********************************************************************
+ * Filename: file_service.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the FileService class, which lets the master list, stat
+ *     and delete files on storageFS over ESP-NOW. Reading and writing a
+ *     range of a file is a ByteStream on BS_RES_FILE opened at the range
+ *     offset with the range length.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <LittleFS.h>
+#include "esp_now_ctrl.h"
+#include "esp_now_txn.h"
+
+#define FILE_PATH_MAX sizeof(((FileRequestPayload *)0)->path)
+
+typedef struct
+{
+    char path[FILE_PATH_MAX + 1];
+    uint16_t next;
+    bool done;
+} FileListCursor_t;
+
+class FileService
+{
+private:
+    static FileListCursor_t list;
+    static TxnHandle_t listTxn;
+    static const TxnPolicy_t ListPolicy;
+
+    static bool readPath(const FileRequestPayload *request, uint8_t payloadSize, char *path);
+    static uint8_t putEntry(uint8_t *buf, uint8_t room, File &file);
+    static bool listSource(void *ctx, Message *msg);
+    static void reply(const uint8_t *mac_addr, FileOp_t op, FileStatus_t status, const uint8_t *entry, uint8_t entrySize);
+    static void handleStat(const uint8_t *mac_addr, const char *path);
+    static void handleDelete(const uint8_t *mac_addr, const char *path);
+    static void onRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+
+public:
+    static void Init(void);
+};
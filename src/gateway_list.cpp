@@ -0,0 +1,161 @@
+/***********************************************************************
+ * Filename: gateway_list.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the GatewayList class. The list is written to NVS only
+ *     before sleep and only when a gateway was added, moved, failed or
+ *     its RSSI changed noticeably, a wake with a healthy master does not
+ *     touch the flash.
+ *
+ ***********************************************************************/
+
+#include "gateway_list.h"
+#include "common.h"
+#include "link_stats.h"
+
+GatewayEntry_t GatewayList::entries[GATEWAY_LIST_MAX];
+bool GatewayList::dirty = false;
+Preferences GatewayList::store;
+std::mutex GatewayList::mutex;
+
+GatewayEntry_t *GatewayList::find(const uint8_t *mac_addr)
+{
+    for (uint8_t i = 0; i < GATEWAY_LIST_MAX; i++)
+    {
+        if (entries[i].used && (memcmp(entries[i].mac_addr, mac_addr, 6) == 0))
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Fewest failures first, then the strongest signal, unused entries at the end */
+void GatewayList::sort(void)
+{
+    for (uint8_t i = 1; i < GATEWAY_LIST_MAX; i++)
+    {
+        GatewayEntry_t entry = entries[i];
+        int8_t j = i - 1;
+        while ((j >= 0) && entry.used &&
+               (!entries[j].used || (entries[j].failures > entry.failures) ||
+                ((entries[j].failures == entry.failures) && (entries[j].rssi < entry.rssi))))
+        {
+            entries[j + 1] = entries[j];
+            j--;
+        }
+        entries[j + 1] = entry;
+    }
+}
+
+void GatewayList::Init(const uint8_t *master, uint8_t channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memset(entries, 0, sizeof(entries));
+    store.begin("gateways", true);
+    if (store.getBytesLength("list") == sizeof(entries))
+    {
+        store.getBytes("list", entries, sizeof(entries));
+    }
+    store.end();
+
+    /* Feeders paired before the list existed only know their master */
+    if ((memcmp(master, BroadcastAddress, 6) != 0) && (find(master) == NULL))
+    {
+        GatewayEntry_t *entry = &entries[GATEWAY_LIST_MAX - 1];
+        memcpy(entry->mac_addr, master, 6);
+        entry->channel = channel;
+        entry->rssi = GATEWAY_RSSI_UNKNOWN;
+        entry->failures = 0;
+        entry->used = true;
+        entry->lastSeen = (int32_t)Now();
+        sort();
+        dirty = true;
+    }
+}
+
+/* A gateway confirmed the pairing, adds it or replaces the lowest ranked one */
+void GatewayList::Seen(const uint8_t *mac_addr, uint8_t channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    GatewayEntry_t *entry = find(mac_addr);
+    if (entry == NULL)
+    {
+        entry = &entries[GATEWAY_LIST_MAX - 1];
+        memcpy(entry->mac_addr, mac_addr, 6);
+        entry->rssi = GATEWAY_RSSI_UNKNOWN;
+        entry->used = true;
+        dirty = true;
+    }
+    if ((entry->channel != channel) || (entry->failures != 0))
+    {
+        dirty = true;
+    }
+    entry->channel = channel;
+    entry->failures = 0;
+    entry->lastSeen = (int32_t)Now();
+    sort();
+}
+
+void GatewayList::Failed(const uint8_t *mac_addr)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    GatewayEntry_t *entry = find(mac_addr);
+    if ((entry != NULL) && (entry->failures < GATEWAY_FAILURES_MAX))
+    {
+        entry->failures++;
+        sort();
+        dirty = true;
+    }
+}
+
+/* The gateway dropped the pairing, it is not a failover candidate any more */
+void GatewayList::Forget(const uint8_t *mac_addr)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    GatewayEntry_t *entry = find(mac_addr);
+    if (entry != NULL)
+    {
+        entry->used = false;
+        sort();
+        dirty = true;
+    }
+}
+
+/* Copies the entry of rank idx, returns false past the last known gateway */
+bool GatewayList::Get(uint8_t idx, GatewayEntry_t *entry)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((idx >= GATEWAY_LIST_MAX) || !entries[idx].used)
+    {
+        return false;
+    }
+    *entry = entries[idx];
+    return true;
+}
+
+/* Records the link quality of the master and saves the list if it changed */
+void GatewayList::Sleep(const uint8_t *master)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    GatewayEntry_t *entry = find(master);
+    int8_t rssi = LinkStats::GetRssi(master);
+    if ((entry != NULL) && (rssi != 0))
+    {
+        if (abs(rssi - entry->rssi) >= GATEWAY_RSSI_SAVE_DB)
+        {
+            dirty = true;
+        }
+        entry->rssi = rssi;
+        sort();
+    }
+    if (!dirty)
+    {
+        return;
+    }
+    store.begin("gateways", false);
+    store.putBytes("list", entries, sizeof(entries));
+    store.end();
+    dirty = false;
+}
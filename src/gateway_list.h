@@ -0,0 +1,54 @@
+/***********************************************************************
+ * Filename: gateway_list.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the GatewayList class, which keeps the gateways the
+ *     feeder was paired with, ranked by failures and last seen RSSI.
+ *     The list is stored in NVS. When the master stops answering, the
+ *     client probes the other gateways in rank order before falling
+ *     back to the channel scan.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "Preferences.h"
+#include "parameters.h"
+#include "esp_now_ctrl.h"
+
+#define GATEWAY_LIST_MAX 4
+#define GATEWAY_RSSI_UNKNOWN -128
+#define GATEWAY_RSSI_SAVE_DB 6 // smaller RSSI changes are not worth a flash write
+#define GATEWAY_FAILURES_MAX 255
+
+typedef struct
+{
+    uint8_t mac_addr[6];
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t failures;
+    bool used;
+    int32_t lastSeen;
+} GatewayEntry_t;
+
+class GatewayList
+{
+private:
+    static GatewayEntry_t entries[GATEWAY_LIST_MAX];
+    static bool dirty;
+    static Preferences store;
+    static std::mutex mutex;
+
+    static GatewayEntry_t *find(const uint8_t *mac_addr);
+    static void sort(void);
+
+public:
+    static void Init(const uint8_t *master, uint8_t channel);
+    static void Seen(const uint8_t *mac_addr, uint8_t channel);
+    static void Failed(const uint8_t *mac_addr);
+    static void Forget(const uint8_t *mac_addr);
+    static bool Get(uint8_t idx, GatewayEntry_t *entry);
+    static void Sleep(const uint8_t *master);
+};
@@ -0,0 +1,225 @@
+/***********************************************************************
+ * Filename: link_stats.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the LinkStats class. RSSI is taken from the promiscuous
+ *     receive callback, filtered to ESP-NOW vendor action frames. The
+ *     power controller steps TX power down after a run of acknowledged
+ *     frames with good RSSI and steps it up after every MAC failure.
+ *
+ ***********************************************************************/
+
+#include "link_stats.h"
+#include "esp_now_ctrl.h"
+
+RTC_DATA_ATTR LinkPeerStats_t LinkStats::peers[LINK_MAX_PEERS];
+RTC_DATA_ATTR uint8_t LinkStats::powerLevel = 0;
+RTC_DATA_ATTR uint8_t LinkStats::successRun = 0;
+portMUX_TYPE LinkStats::mux = portMUX_INITIALIZER_UNLOCKED;
+
+const wifi_power_t LinkStats::powerLevels[] = {
+    WIFI_POWER_19_5dBm,
+    WIFI_POWER_17dBm,
+    WIFI_POWER_15dBm,
+    WIFI_POWER_13dBm,
+    WIFI_POWER_11dBm,
+    WIFI_POWER_8_5dBm,
+    WIFI_POWER_7dBm,
+    WIFI_POWER_5dBm,
+    WIFI_POWER_2dBm,
+};
+
+const uint16_t LinkStats::latencyBounds_ms[LATENCY_HIST_CNT - 1] = {2, 5, 10, 20, 50, 100, 500};
+
+#define NMR_POWER_LEVELS (sizeof(LinkStats::powerLevels) / sizeof(wifi_power_t))
+
+/* 802.11 action frame carrying ESP-NOW: category 127, Espressif OUI */
+#define WLAN_FC_ACTION 0xD0
+#define WLAN_ADDR2_OFFSET 10
+#define WLAN_BODY_OFFSET 24
+static const uint8_t espnow_oui[] = {0x7F, 0x18, 0xFE, 0x34};
+
+/* Caller holds mux */
+LinkPeerStats_t *LinkStats::findPeer(const uint8_t *mac_addr, bool create)
+{
+    LinkPeerStats_t *freeSlot = NULL;
+    for (int i = 0; i < LINK_MAX_PEERS; i++)
+    {
+        if (peers[i].used)
+        {
+            if (memcmp(peers[i].mac_addr, mac_addr, 6) == 0)
+            {
+                return &peers[i];
+            }
+        }
+        else if (freeSlot == NULL)
+        {
+            freeSlot = &peers[i];
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    if (freeSlot == NULL)
+    {
+        /* Table full, reuse the slot of the least active peer */
+        freeSlot = &peers[0];
+        for (int i = 1; i < LINK_MAX_PEERS; i++)
+        {
+            if (peers[i].attempts < freeSlot->attempts)
+            {
+                freeSlot = &peers[i];
+            }
+        }
+    }
+    memset(freeSlot, 0, sizeof(LinkPeerStats_t));
+    memcpy(freeSlot->mac_addr, mac_addr, 6);
+    freeSlot->used = true;
+    return freeSlot;
+}
+
+void LinkStats::publish(const LinkPeerStats_t *peer)
+{
+    if (memcmp(peer->mac_addr, MasterMacAdresa.Get(), 6) != 0)
+    {
+        return;
+    }
+    RadioOdeslano.Set(peer->attempts);
+    RadioChybyMAC.Set(peer->failures);
+    RadioOpakovani.Set(peer->retries);
+    RadioLatence.Set(peer->latency);
+    if (peer->rssi != 0)
+    {
+        RadioRSSI_dBm.Set(peer->rssi);
+    }
+}
+
+void LinkStats::setPowerLevel(uint8_t level)
+{
+    if (level >= NMR_POWER_LEVELS)
+    {
+        level = NMR_POWER_LEVELS - 1;
+    }
+    powerLevel = level;
+    ESPNowCtrl::SetPower(powerLevels[powerLevel]);
+    RadioVykon.Set(powerLevels[powerLevel]);
+}
+
+void LinkStats::onPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+    if (type != WIFI_PKT_MGMT)
+    {
+        return;
+    }
+    const wifi_promiscuous_pkt_t *pkt = (const wifi_promiscuous_pkt_t *)buf;
+    const uint8_t *frame = pkt->payload;
+    if ((pkt->rx_ctrl.sig_len < (WLAN_BODY_OFFSET + sizeof(espnow_oui))) || (frame[0] != WLAN_FC_ACTION))
+    {
+        return;
+    }
+    if (memcmp(&frame[WLAN_BODY_OFFSET], espnow_oui, sizeof(espnow_oui)) != 0)
+    {
+        return;
+    }
+
+    /* Only the filtered RSSI is updated here, RadioRSSI_dBm follows at the next publish */
+    int8_t rssi = pkt->rx_ctrl.rssi;
+    portENTER_CRITICAL(&mux);
+    LinkPeerStats_t *peer = findPeer(&frame[WLAN_ADDR2_OFFSET], false);
+    if (peer != NULL)
+    {
+        peer->rssi = (peer->rssi == 0) ? rssi : (int8_t)((3 * peer->rssi + rssi) / 4);
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void LinkStats::Init(void)
+{
+    wifi_promiscuous_filter_t filter = {.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT};
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(onPromiscuousRx);
+    esp_wifi_set_promiscuous(true);
+
+    portENTER_CRITICAL(&mux);
+    findPeer(MasterMacAdresa.Get(), true);
+    portEXIT_CRITICAL(&mux);
+    setPowerLevel(AdaptivniVykon.Get() ? powerLevel : 0);
+}
+
+void LinkStats::OnAttempt(const uint8_t *mac_addr, bool retry)
+{
+    portENTER_CRITICAL(&mux);
+    LinkPeerStats_t *peer = findPeer(mac_addr, true);
+    peer->attempts++;
+    if (retry)
+    {
+        peer->retries++;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+void LinkStats::OnResult(const uint8_t *mac_addr, bool success, uint32_t latency_us)
+{
+    bool broadcast = memcmp(mac_addr, BroadcastAddress, 6) == 0;
+
+    portENTER_CRITICAL(&mux);
+    LinkPeerStats_t *peer = findPeer(mac_addr, true);
+    if (success)
+    {
+        uint32_t latency_ms = latency_us / 1000;
+        uint8_t bin = 0;
+        while ((bin < (LATENCY_HIST_CNT - 1)) && (latency_ms >= latencyBounds_ms[bin]))
+        {
+            bin++;
+        }
+        if (peer->latency[bin] < UINT16_MAX)
+        {
+            peer->latency[bin]++;
+        }
+    }
+    else
+    {
+        peer->failures++;
+    }
+    LinkPeerStats_t stats = *peer;
+    portEXIT_CRITICAL(&mux);
+    publish(&stats);
+
+    /* Broadcast frames are never acknowledged, they say nothing about the link */
+    if (broadcast || !AdaptivniVykon.Get())
+    {
+        return;
+    }
+
+    if (!success)
+    {
+        successRun = 0;
+        setPowerLevel((powerLevel > LINK_POWER_UP_STEPS) ? (powerLevel - LINK_POWER_UP_STEPS) : 0);
+    }
+    else if ((stats.rssi != 0) && (stats.rssi > LINK_RSSI_GOOD_DBM))
+    {
+        if (++successRun >= LINK_POWER_DOWN_SUCCESSES)
+        {
+            successRun = 0;
+            if ((powerLevel + 1) < NMR_POWER_LEVELS)
+            {
+                setPowerLevel(powerLevel + 1);
+            }
+        }
+    }
+    else
+    {
+        successRun = 0;
+    }
+}
+
+int8_t LinkStats::GetRssi(const uint8_t *mac_addr)
+{
+    portENTER_CRITICAL(&mux);
+    LinkPeerStats_t *peer = findPeer(mac_addr, false);
+    int8_t rssi = (peer != NULL) ? peer->rssi : 0;
+    portEXIT_CRITICAL(&mux);
+    return rssi;
+}
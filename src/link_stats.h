@@ -0,0 +1,58 @@
+/***********************************************************************
+ * Filename: link_stats.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the LinkStats class, which collects per-peer ESP-NOW link
+ *     statistics (send attempts, MAC failures, retries, ack latency
+ *     histogram and received RSSI) and runs an adaptive TX power
+ *     controller. Statistics of the master peer are published in the
+ *     Radio* registers. The state is kept in RTC memory, so the learned
+ *     power level is reused after waking from deep sleep. The RSSI
+ *     callback runs in the Wi-Fi task, peers[] is guarded by a spinlock
+ *     and the registers are only written from the ESP-NOW task.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "esp_wifi.h"
+#include "parameters.h"
+
+#define LINK_MAX_PEERS 4
+#define LINK_RSSI_GOOD_DBM -67
+#define LINK_POWER_DOWN_SUCCESSES 10
+#define LINK_POWER_UP_STEPS 2
+
+typedef struct
+{
+    uint8_t mac_addr[6];
+    bool used;
+    int8_t rssi;
+    uint32_t attempts;
+    uint32_t failures;
+    uint32_t retries;
+    uint16_t latency[LATENCY_HIST_CNT];
+} LinkPeerStats_t;
+
+class LinkStats
+{
+private:
+    static RTC_DATA_ATTR LinkPeerStats_t peers[LINK_MAX_PEERS];
+    static RTC_DATA_ATTR uint8_t powerLevel;
+    static RTC_DATA_ATTR uint8_t successRun;
+    static const wifi_power_t powerLevels[];
+    static const uint16_t latencyBounds_ms[];
+    static portMUX_TYPE mux;
+
+    static LinkPeerStats_t *findPeer(const uint8_t *mac_addr, bool create);
+    static void publish(const LinkPeerStats_t *peer);
+    static void setPowerLevel(uint8_t level);
+    static void onPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type);
+
+public:
+    static void Init(void);
+    static void OnAttempt(const uint8_t *mac_addr, bool retry);
+    static void OnResult(const uint8_t *mac_addr, bool success, uint32_t latency_us);
+    static int8_t GetRssi(const uint8_t *mac_addr);
+};
@@ -0,0 +1,154 @@
+/***********************************************************************
+ * Filename: load_cell.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the LoadCell class. The SPI bus only exists while the
+ *     HX711 is powered, PowerDown gives PDCLK back to the GPIO so it can
+ *     be held high during deep sleep. SPI mode 1 samples MISO on the
+ *     falling edge of SCK, after the HX711 has shifted out the bit.
+ *
+ ***********************************************************************/
+
+#include "load_cell.h"
+#include "log.h"
+
+spi_device_handle_t LoadCell::device = NULL;
+SemaphoreHandle_t LoadCell::ready = xSemaphoreCreateBinary();
+
+void IRAM_ATTR LoadCell::onDataReady(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    gpio_intr_disable((gpio_num_t)PDO);
+    xSemaphoreGiveFromISR(ready, &woken);
+    if (woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+bool LoadCell::attach(void)
+{
+    spi_bus_config_t bus;
+    memset(&bus, 0, sizeof(bus));
+    bus.mosi_io_num = -1;
+    bus.miso_io_num = PDO;
+    bus.sclk_io_num = PDCLK;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = sizeof(uint32_t);
+    if (spi_bus_initialize(LOAD_CELL_SPI_HOST, &bus, SPI_DMA_DISABLED) != ESP_OK)
+    {
+        SystemLog::PutLog("HX711 SPI bus init failed", v_error);
+        return false;
+    }
+
+    spi_device_interface_config_t dev;
+    memset(&dev, 0, sizeof(dev));
+    dev.mode = 1;
+    dev.clock_speed_hz = LOAD_CELL_CLOCK_HZ;
+    dev.spics_io_num = -1;
+    dev.queue_size = 1;
+    if (spi_bus_add_device(LOAD_CELL_SPI_HOST, &dev, &device) != ESP_OK)
+    {
+        SystemLog::PutLog("HX711 SPI device init failed", v_error);
+        spi_bus_free(LOAD_CELL_SPI_HOST);
+        device = NULL;
+        return false;
+    }
+
+    // the ISR service may already be installed by attachInterrupt()
+    gpio_install_isr_service(0);
+    gpio_set_intr_type((gpio_num_t)PDO, GPIO_INTR_NEGEDGE);
+    gpio_intr_disable((gpio_num_t)PDO);
+    gpio_isr_handler_add((gpio_num_t)PDO, onDataReady, NULL);
+    return true;
+}
+
+void LoadCell::detach(void)
+{
+    if (device == NULL)
+    {
+        return;
+    }
+    gpio_isr_handler_remove((gpio_num_t)PDO);
+    spi_bus_remove_device(device);
+    spi_bus_free(LOAD_CELL_SPI_HOST);
+    device = NULL;
+}
+
+void LoadCell::PowerUp(void)
+{
+    pinMode(PDCLK, OUTPUT);
+    digitalWrite(PDCLK, HIGH);
+    digitalWrite(PDCLK, LOW);
+    pinMode(PDO, INPUT);
+    delay(LOAD_CELL_POWER_UP_MS);
+    attach();
+}
+
+void LoadCell::PowerDown(void)
+{
+    detach();
+    pinMode(PDCLK, OUTPUT);
+    digitalWrite(PDCLK, LOW);
+    digitalWrite(PDCLK, HIGH);
+}
+
+/* The RATE pin is tied low (10 SPS) unless the board routes it to PDRATE */
+void LoadCell::SetRate(LoadCellRate_t rate)
+{
+#ifdef PDRATE
+    pinMode(PDRATE, OUTPUT);
+    digitalWrite(PDRATE, (rate == rychlost_80sps) ? HIGH : LOW);
+#endif
+}
+
+/* DOUT goes low when a conversion is ready, the edge interrupt wakes the task */
+bool LoadCell::WaitReady(uint32_t timeout_ms)
+{
+    if (device == NULL)
+    {
+        uint32_t start = millis();
+        while (digitalRead(PDO))
+        {
+            if ((millis() - start) >= timeout_ms)
+            {
+                return false;
+            }
+            delay(1);
+        }
+        return true;
+    }
+    xSemaphoreTake(ready, 0);
+    gpio_intr_enable((gpio_num_t)PDO);
+    if (digitalRead(PDO))
+    {
+        xSemaphoreTake(ready, pdMS_TO_TICKS(timeout_ms));
+    }
+    gpio_intr_disable((gpio_num_t)PDO);
+    return !digitalRead(PDO);
+}
+
+/* One transaction reads the 24 bit result, mode extra pulses select the gain of the next conversion */
+bool LoadCell::Read(uint8_t mode, int32_t *value)
+{
+    if ((device == NULL) || !WaitReady(LOAD_CELL_READY_TIMEOUT_MS))
+    {
+        return false;
+    }
+
+    spi_transaction_t trans;
+    memset(&trans, 0, sizeof(trans));
+    trans.flags = SPI_TRANS_USE_RXDATA;
+    trans.length = LOAD_CELL_DATA_BITS + mode;
+    trans.rxlength = LOAD_CELL_DATA_BITS + mode;
+    spi_device_transmit(device, &trans);
+
+    uint32_t conv_res = ((uint32_t)trans.rx_data[0] << 16) | ((uint32_t)trans.rx_data[1] << 8) | trans.rx_data[2];
+    if (conv_res >= 0x800000)
+        conv_res = conv_res | 0xFF000000L;
+
+    *value = (int32_t)conv_res;
+    return true;
+}
@@ -0,0 +1,49 @@
+/***********************************************************************
+ * Filename: load_cell.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the LoadCell class, which reads the HX711 with the SPI
+ *     peripheral instead of bit-banging PD_SCK. SCK is routed to PDCLK
+ *     and MISO to PDO, one transaction clocks the 24 data bits and the
+ *     gain pulses. The end of a conversion (DOUT going low) is signalled
+ *     by a GPIO interrupt, so the CPU idles while the HX711 converts.
+ *     A missing or dead HX711 keeps DOUT high, the wait gives up after
+ *     LOAD_CELL_READY_TIMEOUT_MS and the read fails.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "driver/spi_master.h"
+#include "driver/gpio.h"
+#include "pin_map.h"
+#include "parameter_values.h"
+
+#define Channel_A_gain_128 1
+#define Channel_B_gain_32 2
+#define Channel_A_gain_64 3
+
+#define LOAD_CELL_SPI_HOST SPI2_HOST
+#define LOAD_CELL_CLOCK_HZ 1000000 // SCK high for 0.5 us, the HX711 needs 0.2 us and powers down after 60 us
+#define LOAD_CELL_DATA_BITS 24
+#define LOAD_CELL_POWER_UP_MS 2
+#define LOAD_CELL_READY_TIMEOUT_MS 1000 // 10 SPS settles in 400 ms after power up, a longer wait means no HX711
+
+class LoadCell
+{
+private:
+    static spi_device_handle_t device;
+    static SemaphoreHandle_t ready;
+
+    static void IRAM_ATTR onDataReady(void *arg);
+    static bool attach(void);
+    static void detach(void);
+
+public:
+    static void PowerUp(void);
+    static void PowerDown(void);
+    static void SetRate(LoadCellRate_t rate);
+    static bool WaitReady(uint32_t timeout_ms);
+    static bool Read(uint8_t mode, int32_t *value);
+};
@@ -6,7 +6,9 @@
  *     Implements the SystemLog class, providing functions for 
  *     handling system logs. The log queue is managed using FreeRTOS to 
  *     facilitate efficient log handling, while the log entries are 
- *     stored in text files using LittleFS.
+ *     stored in text files using LittleFS. Every record carries a
+ *     sequence number, only records newer than the cursor acknowledged
+ *     by the gateway are uploaded on a normal wake.
  *
  ***********************************************************************/
 
@@ -16,12 +18,23 @@
 #include "freertos/queue.h"
 #include "esp_now_ctrl.h"
 #include "deep_sleep_ctrl.h"
-#include "esp_now_client.h"
+#include "Preferences.h"
 
 uint8_t SystemLog::write_file;
+uint32_t SystemLog::next_seq = 1;
+RTC_DATA_ATTR uint32_t SystemLog::acked_seq = 0;
+uint32_t SystemLog::stored_seq = 0;
 QueueHandle_t SystemLog::log_queue;
+LogCursor_t SystemLog::requestCursor;
+TxnHandle_t SystemLog::requestTxn = TXN_INVALID;
+const TxnPolicy_t SystemLog::LogPolicy = {5, 0, TXN_FLAG_RESCAN};
 
 const char *const SystemLog::log_files[] = {
+    "/log_a.dat",
+    "/log_b.dat",
+};
+
+const char *const SystemLog::log_files_v1[] = {
     "/log_a.txt",
     "/log_b.txt",
 };
@@ -53,39 +66,141 @@ void SystemLog::PutLog(String msg, Verbosity_t lvl, time_t t)
     PutLog(msg.c_str(), lvl, t);
 }
 
-void SystemLog::Init(void)
+uint8_t SystemLog::findWriteFile(const char *const files[], size_t recordSize)
 {
-    active_tasks[FileSystem_Task] = true;
-
-    log_queue = xQueueCreate(5, sizeof(Log_t));
+    uint8_t wf = 0;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        File file = storageFS.open(files[i], "r");
+        if (file)
+        {
+            if ((file.size() / recordSize) >= NMR_RECORDS)
+            {
+                wf = i ^ 1;
+            }
+            file.close();
+        }
+    }
+    return wf;
+}
 
-    size_t file_items = 0;
-    std::lock_guard<std::mutex> lock(storageFS_lock);
-    File file = storageFS.open(log_files[0], "r");
-    write_file = 0;
+uint32_t SystemLog::lastSeq(const char *file_name)
+{
+    uint32_t seq = 0;
+    File file = storageFS.open(file_name, "r");
     if (file)
     {
-        file_items = file.size() / sizeof(Log_t);
-        if (file_items >= NMR_RECORDS)
+        size_t file_items = file.size() / sizeof(Log_t);
+        Log_t log_item;
+        if ((file_items > 0) && file.seek((file_items - 1) * sizeof(Log_t)) && (file.read((uint8_t *)&log_item, sizeof(Log_t)) == sizeof(Log_t)))
         {
-            write_file = 1;
+            seq = log_item.seq;
         }
         file.close();
     }
+    return seq;
+}
 
-    file = storageFS.open(log_files[1], "r");
-    if (file)
+void SystemLog::migrate(void)
+{
+    if (!storageFS.exists(log_files_v1[0]) && !storageFS.exists(log_files_v1[1]))
     {
-        file_items = file.size() / sizeof(Log_t);
+        return;
+    }
 
-        if (file_items >= NMR_RECORDS)
+    uint8_t old_write = findWriteFile(log_files_v1, sizeof(LogV1_t));
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        uint8_t idx = ((old_write ^ 1) + i) % 2;
+        File src = storageFS.open(log_files_v1[idx], "r");
+        if (src)
         {
-            write_file = 0;
+            File dst = storageFS.open(log_files[idx], "w", true);
+            LogV1_t old_item;
+            while (src.read((uint8_t *)&old_item, sizeof(LogV1_t)) == sizeof(LogV1_t))
+            {
+                Log_t log_item;
+                log_item.seq = next_seq++;
+                log_item.lvl = old_item.lvl;
+                log_item.time = old_item.time;
+                memcpy(log_item.log_txt, old_item.log_txt, sizeof(log_item.log_txt));
+                if (dst)
+                {
+                    dst.write((uint8_t *)&log_item, sizeof(Log_t));
+                }
+            }
+            if (dst)
+            {
+                dst.close();
+            }
+            src.close();
         }
-        file.close();
+        storageFS.remove(log_files_v1[idx]);
+    }
+
+    /* The old firmware sent every record on each boot, the gateway already has them */
+    acked_seq = next_seq - 1;
+}
+
+void SystemLog::acknowledge(uint32_t seq)
+{
+    if (seq > acked_seq)
+    {
+        acked_seq = seq;
     }
 }
 
+void SystemLog::storeAck(void)
+{
+    if (acked_seq != stored_seq)
+    {
+        Preferences store;
+        store.begin("log", false);
+        store.putUInt("ack", acked_seq);
+        store.end();
+        stored_seq = acked_seq;
+    }
+}
+
+void SystemLog::Init(void)
+{
+    active_tasks[FileSystem_Task] = true;
+
+    log_queue = xQueueCreate(5, sizeof(Log_t));
+
+    Preferences store;
+    store.begin("log", true);
+    stored_seq = store.getUInt("ack", 0);
+    store.end();
+    if (acked_seq == 0)
+    {
+        acked_seq = stored_seq;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(storageFS_lock);
+        migrate();
+        write_file = findWriteFile(log_files, sizeof(Log_t));
+        next_seq = max(lastSeq(log_files[0]), lastSeq(log_files[1])) + 1;
+    }
+    if (next_seq <= acked_seq)
+    {
+        // files were lost, keep numbering above what the gateway has
+        next_seq = acked_seq + 1;
+    }
+    storeAck();
+
+    ESPNowCtrl::RegisterHandler(MSG_GET_LOG_REQUEST, onLogRequest);
+}
+
+void SystemLog::onLogRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    /* A repeated request restarts the upload from the beginning */
+    ESPNowTxn::Abort(requestTxn);
+    StartLogCursor(&requestCursor, true);
+    requestTxn = ESPNowTxn::Stream(mac_addr, logSource, &requestCursor, LogPolicy, onRequestDone);
+}
+
 void SystemLog::Task(void)
 {
     active_tasks[FileSystem_Task] = false;
@@ -111,6 +226,7 @@ void SystemLog::Task(void)
                 write_file ^= 1;
                 file = storageFS.open(log_files[write_file], "w", true);
             }
+            log_item.seq = next_seq++;
             file.write((uint8_t *)&log_item, sizeof(Log_t));
             file.close();
         }
@@ -198,66 +314,97 @@ size_t SystemLog::GetLogJson(JsonArray doc, size_t pos, size_t nmr_max)
 }
 
 
-bool SystemLog::SendLogsViaEspNow(const uint8_t *mac_addr)
+void SystemLog::StartLogCursor(LogCursor_t *cursor, bool all)
 {
-    std::lock_guard<std::mutex> lock(storageFS_lock);
-    size_t total_nmr = 0;
-    DataPayload payload;
-    bool sendMessageSuccess = true;
-
-    memset(&payload, 0, sizeof(payload));
-    size_t payloadFillIndex = 0;
-    size_t currentIndex = 0;
+    cursor->fromSeq = all ? 0 : (acked_seq + 1);
+    cursor->sentSeq = 0;
+    cursor->first = write_file ^ 1;
+    cursor->part = 0;
+    cursor->offset = 0;
+}
 
-    int read_file = write_file ^ 1;
+bool SystemLog::HasNewLogs(void)
+{
+    return (next_seq - 1) > acked_seq;
+}
 
-    for (int i = 0; i < 2 && sendMessageSuccess; ++i)
+bool SystemLog::NextLogFrame(LogCursor_t *cursor, Message *msg)
+{
+    DataPayload *payload = (DataPayload *)msg->payload;
+    size_t fill = 0;
+    uint32_t frameSeq = 0;
     {
-        int fileIndex = (read_file + i) % 2;
-
-        File file = storageFS.open(log_files[fileIndex], "r");
-        if (!file)
-            continue;
-
-        while (file.available() > 0 && sendMessageSuccess)
+        std::lock_guard<std::mutex> lock(storageFS_lock);
+        bool full = false;
+        while ((cursor->part < 2) && !full)
         {
-            Log_t log_item;
-            size_t readSize = file.readBytes((char *)&log_item, min(sizeof(Log_t), sizeof(payload.data) - payloadFillIndex));
-
-            if (readSize > 0)
+            File file = storageFS.open(log_files[(cursor->first + cursor->part) % 2], "r");
+            if (file)
             {
-                memcpy(payload.data + payloadFillIndex, &log_item, readSize);
-                payloadFillIndex += readSize;
-                currentIndex += readSize;
-
-                if (payloadFillIndex == sizeof(payload.data))
+                Log_t log_item;
+                file.seek(cursor->offset * sizeof(Log_t));
+                while (!(full = ((fill + sizeof(Log_t)) > sizeof(payload->data))) &&
+                       (file.read((uint8_t *)&log_item, sizeof(Log_t)) == sizeof(Log_t)))
                 {
-                    payload.index = currentIndex - payloadFillIndex;
-                    payload.nmr = payloadFillIndex;
-                    CHECK_SEND(ESPNowCtrl::SendMessage(mac_addr, MSG_GET_LOG_RESPONSE, payload, 4 + 1 + payload.nmr, 5), sendMessageSuccess);
-                    total_nmr += payloadFillIndex / sizeof(Log_t);
-
-                    memset(&payload, 0, sizeof(payload));
-                    payloadFillIndex = 0;
+                    cursor->offset++;
+                    if (log_item.seq < cursor->fromSeq)
+                    {
+                        continue;
+                    }
+                    if (fill == 0)
+                    {
+                        payload->index = log_item.seq;
+                    }
+                    memcpy(payload->data + fill, &log_item, sizeof(Log_t));
+                    fill += sizeof(Log_t);
+                    frameSeq = log_item.seq;
                 }
+                file.close();
+            }
+            if (!full)
+            {
+                cursor->part++;
+                cursor->offset = 0;
             }
         }
+    }
 
-        file.close();
+    if (fill == 0)
+    {
+        return false;
     }
+    cursor->sentSeq = frameSeq;
+    payload->nmr = fill;
+    msg->messageType = MSG_GET_LOG_RESPONSE;
+    msg->payloadSize = offsetof(DataPayload, data) + fill;
+    return true;
+}
 
-    if (payloadFillIndex > 0 && sendMessageSuccess)
+/* A MAC ack of a single frame is not enough, the records count as delivered only once the whole transaction succeeded */
+void SystemLog::LogsDelivered(const LogCursor_t *cursor)
+{
+    if (cursor->sentSeq != 0)
     {
-        payload.index = currentIndex - payloadFillIndex;
-        payload.nmr = payloadFillIndex;
-        CHECK_SEND(ESPNowCtrl::SendMessage(mac_addr, MSG_GET_LOG_RESPONSE, payload, 4 + 1 + payload.nmr, 5), sendMessageSuccess);
-        total_nmr += payloadFillIndex / sizeof(Log_t);
+        acknowledge(cursor->sentSeq);
+        storeAck();
     }
+}
 
-    return sendMessageSuccess;
+bool SystemLog::logSource(void *ctx, Message *msg)
+{
+    return NextLogFrame((LogCursor_t *)ctx, msg);
+}
+
+void SystemLog::onRequestDone(TxnHandle_t handle, TxnResult_t result, void *ctx)
+{
+    if ((handle == requestTxn) && (result == TXN_OK))
+    {
+        LogsDelivered(&requestCursor);
+    }
 }
 
     void SystemLog::Sleep(void)
     {
+        storeAck();
         storageFS.end();
     }
\ No newline at end of file
@@ -14,16 +14,37 @@
 #include "Arduino.h"
 #include "parameters.h"
 #include "freertos/queue.h"
+#include "esp_now_txn.h"
 
 #define NMR_RECORDS 25
 
 typedef struct
 {
+    uint32_t seq;
     Verbosity_t lvl;
-    time_t time;
+    int32_t time; // time_t of the target, fixed so the record does not change with the toolchain
     char log_txt[80];
 }__attribute__((packed)) Log_t;
 
+static_assert(sizeof(Log_t) == LOG_RECORD_SIZE, "Log_t does not match the log record of the protocol");
+
+/* Record layout of the original .txt log files, read only for migration */
+typedef struct
+{
+    Verbosity_t lvl;
+    int32_t time;
+    char log_txt[80];
+}__attribute__((packed)) LogV1_t;
+
+typedef struct
+{
+    uint32_t fromSeq;
+    uint32_t sentSeq; // last record put into a frame
+    uint8_t first;
+    uint8_t part;
+    uint32_t offset;
+} LogCursor_t;
+
 class SystemLog
 {
 private:
@@ -32,7 +53,23 @@ private:
     static QueueHandle_t log_queue;
 
     static const char *const log_files[];
+    static const char *const log_files_v1[];
     static uint8_t write_file;
+    static uint32_t next_seq;
+    static RTC_DATA_ATTR uint32_t acked_seq;
+    static uint32_t stored_seq;
+
+    static LogCursor_t requestCursor;
+    static TxnHandle_t requestTxn;
+
+    static void onLogRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+    static bool logSource(void *ctx, Message *msg);
+    static void onRequestDone(TxnHandle_t handle, TxnResult_t result, void *ctx);
+    static uint8_t findWriteFile(const char *const files[], size_t recordSize);
+    static uint32_t lastSeq(const char *file);
+    static void migrate(void);
+    static void acknowledge(uint32_t seq);
+    static void storeAck(void);
 
 public:
     static void PutLog(const char * msg, Verbosity_t lvl = v_info, time_t t = 0);
@@ -46,7 +83,12 @@ public:
 
     static size_t GetLogJson(JsonArray doc, size_t pos, size_t nmr_max);
 
-    static bool SendLogsViaEspNow(const uint8_t *mac_addr);
+    static const TxnPolicy_t LogPolicy;
+
+    static void StartLogCursor(LogCursor_t *cursor, bool all);
+    static bool NextLogFrame(LogCursor_t *cursor, Message *msg);
+    static void LogsDelivered(const LogCursor_t *cursor);
+    static bool HasNewLogs(void);
 
     static void Sleep(void);
 };
\ No newline at end of file
@@ -26,6 +26,11 @@
 #include <LittleFS.h>
 #include "esp_now_client.h"
 #include "time_ctrl.h"
+#include "time_sync.h"
+#include "byte_stream.h"
+#include "file_service.h"
+#include "event_push.h"
+#include "telemetry_batch.h"
 #include "FreeRTOSConfig.h"
 #include "esp_freertos_hooks.h"
 #include "deep_sleep_ctrl.h"
@@ -147,6 +152,18 @@ void ESPNowTask(void *pvParameters)
 
 void ESPNowSlaveTask(void *pvParameters)
 {
+  if (!TelemetryBatch::RadioNeeded())
+  {
+    /* Nothing new to report, Wi-Fi stays off unless the state changes during this wake */
+    active_tasks[Communication_Task] = false;
+    EventPush::SetHook(TelemetryBatch::RequestRadio);
+    if (!EventPush::Pending())
+    {
+      TelemetryBatch::WaitForRadio();
+    }
+  }
+  ESPNowClient::Init();
+  xTaskCreateUniversal(ESPNowTask, "espNowTask", getArduinoLoopTaskStackSize(), NULL, 5, NULL, ARDUINO_RUNNING_CORE);
   while (true)
   {
     ESPNowClient::Task();
@@ -191,6 +208,7 @@ void SleepTask(void *pvParameters)
       xTaskResumeAll();
       Register::Sleep();
       motor.Sleep();
+      ByteStream::Sleep(); // closes its files before SystemLog unmounts LittleFS
       SystemLog::Sleep();
       if (RestartCmd.Get() == povoleno)
       {
@@ -198,8 +216,9 @@ void SleepTask(void *pvParameters)
       }
       else
       {
-        ESPNowClient::Sleep();
-        esp_sleep_enable_timer_wakeup(PeriodaKomunikace_S.Get() * 1000000ULL);
+        int64_t wakeAt_us = TimeSync::NextWake_us(PeriodaKomunikace_S.Get());
+        ESPNowClient::Sleep(wakeAt_us);
+        esp_sleep_enable_timer_wakeup(TimeSync::SleepDuration_us(wakeAt_us));
         pinMode(BTN_WAKE, INPUT);
         esp_deep_sleep_enable_gpio_wakeup(BIT(BTN_WAKE), ESP_GPIO_WAKEUP_GPIO_LOW);
         gpio_hold_en((gpio_num_t)PDCLK);
@@ -226,7 +245,12 @@ void setup()
   weight.Init();
   FeederCtrl::Init();
   TimeCtrl::Init();
-  ESPNowClient::Init();
+  active_tasks[Communication_Task] = true; // the radio is started by the client task
+  TimeSync::Init();
+  EventPush::Init();
+  OtaCtrl::Init();
+  ByteStream::Init();
+  FileService::Init();
   active_tasks[Button_Task] = false;
 
   switch (rtc_get_reset_reason(0))
@@ -276,7 +300,6 @@ void setup()
   xTaskCreateUniversal(SystemLogTask, "logTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[3], ARDUINO_RUNNING_CORE);
   xTaskCreateUniversal(CommandProcessingTask, "cmdTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[4], ARDUINO_RUNNING_CORE);
   xTaskCreateUniversal(TimeControlTask, "timeCtrlTask", getArduinoLoopTaskStackSize(), NULL, 2, &active_task_handle[5], ARDUINO_RUNNING_CORE);
-  xTaskCreateUniversal(ESPNowTask, "espNowTask", getArduinoLoopTaskStackSize(), NULL, 5, NULL, ARDUINO_RUNNING_CORE);
   xTaskCreateUniversal(ESPNowSlaveTask, "espNowSlaveTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[6], ARDUINO_RUNNING_CORE);
   xTaskCreateUniversal(SleepTask, "sleepTask", getArduinoLoopTaskStackSize(), NULL, 1, NULL, ARDUINO_RUNNING_CORE);
 
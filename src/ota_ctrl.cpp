@@ -0,0 +1,538 @@
+/***********************************************************************
+ * Filename: ota_ctrl.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the OtaCtrl class. The image is written with the raw
+ *     partition API instead of the Update library, because the Update
+ *     library keeps its state in RAM only and cannot continue a
+ *     transfer after a reset. The boot partition is switched only
+ *     after the whole image has been received and its digest matches.
+ *
+ ***********************************************************************/
+
+#include "ota_ctrl.h"
+#include "esp_ota_ops.h"
+#include "parameters.h"
+#include "log.h"
+#include "deep_sleep_ctrl.h"
+
+const esp_partition_t *OtaCtrl::partition = NULL;
+mbedtls_sha256_context OtaCtrl::sha;
+Preferences OtaCtrl::store;
+OtaChunk_t OtaCtrl::window[OTA_WINDOW_CHUNKS];
+DeltaPatch OtaCtrl::patch;
+
+bool OtaCtrl::active = false;
+bool OtaCtrl::isFW;
+bool OtaCtrl::isDelta;
+bool OtaCtrl::hasDigest;
+uint8_t OtaCtrl::digest[32];
+uint32_t OtaCtrl::totalSize;
+uint32_t OtaCtrl::expected;
+uint32_t OtaCtrl::written;
+uint32_t OtaCtrl::finalEnd;
+uint32_t OtaCtrl::erasedTo;
+uint32_t OtaCtrl::persistedTo;
+uint16_t OtaCtrl::chunkSize;
+uint8_t OtaCtrl::sinceAck;
+uint32_t OtaCtrl::lastActivity;
+uint8_t OtaCtrl::peer_addr[6];
+
+/* Acks are not retried, the gateway repeats the window when one is lost */
+const TxnPolicy_t OtaCtrl::AckPolicy = {OTA_ACK_RETRIES, 0, 0};
+
+bool OtaCtrl::begin(bool fw, bool delta, uint32_t resumeOffset)
+{
+    if (fw)
+    {
+        partition = esp_ota_get_next_update_partition(NULL);
+    }
+    else
+    {
+        partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, NULL);
+    }
+    if (partition == NULL)
+    {
+        SystemLog::PutLog("Aktualizace: nenalezen cilovy oddil", v_error);
+        active = false;
+        return false;
+    }
+
+    isFW = fw;
+    isDelta = delta && fw;
+    expected = 0;
+    written = 0;
+    erasedTo = 0;
+    finalEnd = 0;
+    chunkSize = 0;
+    sinceAck = 0;
+    memset(window, 0, sizeof(window));
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    if (isDelta)
+    {
+        /* Decoder state lives in RAM only, delta transfers always start from the beginning */
+        patch.Begin(esp_ota_get_running_partition(), writeOutput);
+    }
+    else if ((resumeOffset > 0) && (resumeOffset <= partition->size))
+    {
+        uint8_t buf[256];
+        while (written < resumeOffset)
+        {
+            size_t len = min((size_t)(resumeOffset - written), sizeof(buf));
+            if (esp_partition_read(partition, written, buf, len) != ESP_OK)
+            {
+                break;
+            }
+            mbedtls_sha256_update(&sha, buf, len);
+            written += len;
+        }
+        if (written != resumeOffset)
+        {
+            mbedtls_sha256_starts(&sha, 0);
+            written = 0;
+        }
+        erasedTo = written;
+        expected = written;
+    }
+    persistedTo = written;
+
+    active = true;
+    lastActivity = millis();
+    return true;
+}
+
+bool OtaCtrl::writeOutput(const uint8_t *data, size_t len)
+{
+    if ((written + len) > partition->size)
+    {
+        return false;
+    }
+    while ((written + len) > erasedTo)
+    {
+        if (esp_partition_erase_range(partition, erasedTo, OTA_SECTOR_SIZE) != ESP_OK)
+        {
+            return false;
+        }
+        erasedTo += OTA_SECTOR_SIZE;
+    }
+    if (esp_partition_write(partition, written, data, len) != ESP_OK)
+    {
+        return false;
+    }
+    mbedtls_sha256_update(&sha, data, len);
+    written += len;
+
+    if ((written - persistedTo) >= OTA_PERSIST_BYTES)
+    {
+        persist();
+    }
+    return true;
+}
+
+bool OtaCtrl::consume(const uint8_t *data, size_t len)
+{
+    if (isDelta)
+    {
+        /* The decoder stops taking data while it checks the source image, expected stays there */
+        expected += patch.Feed(data, len);
+        return !patch.IsError();
+    }
+    if (!writeOutput(data, len))
+    {
+        return false;
+    }
+    expected += len;
+    return true;
+}
+
+bool OtaCtrl::storeInWindow(const UpdateRequestPayload *payload)
+{
+    if ((payload->index > expected) && ((payload->index - expected) >= (uint32_t)(OTA_WINDOW_CHUNKS * chunkSize)))
+    {
+        return false;
+    }
+
+    OtaChunk_t *slot = NULL;
+    for (int i = 0; i < OTA_WINDOW_CHUNKS; i++)
+    {
+        if (window[i].used)
+        {
+            if (window[i].index == payload->index)
+            {
+                return true;
+            }
+        }
+        else if (slot == NULL)
+        {
+            slot = &window[i];
+        }
+    }
+    if (slot == NULL)
+    {
+        return false;
+    }
+    slot->index = payload->index;
+    slot->nmr = payload->nmr;
+    memcpy(slot->data, payload->data, payload->nmr);
+    slot->used = true;
+    return true;
+}
+
+void OtaCtrl::drainWindow(void)
+{
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (int i = 0; i < OTA_WINDOW_CHUNKS; i++)
+        {
+            OtaChunk_t &chunk = window[i];
+            if (!chunk.used)
+            {
+                continue;
+            }
+            if ((chunk.index + chunk.nmr) <= expected)
+            {
+                chunk.used = false;
+            }
+            else if (chunk.index <= expected)
+            {
+                uint32_t skip = expected - chunk.index;
+                uint32_t before = expected;
+                if (!consume(chunk.data + skip, chunk.nmr - skip))
+                {
+                    return;
+                }
+                /* A chunk the delta decoder took only partly stays for later */
+                chunk.used = ((chunk.index + chunk.nmr) > expected);
+                progress |= (expected != before);
+            }
+        }
+    }
+}
+
+uint32_t OtaCtrl::windowBitmap(void)
+{
+    uint32_t bitmap = 0;
+    if (chunkSize == 0)
+    {
+        return bitmap;
+    }
+    for (int i = 0; i < OTA_WINDOW_CHUNKS; i++)
+    {
+        if (window[i].used && (window[i].index > expected))
+        {
+            uint32_t bit = (window[i].index - expected) / chunkSize;
+            if (bit < 32)
+            {
+                bitmap |= 1UL << bit;
+            }
+        }
+    }
+    return bitmap;
+}
+
+void OtaCtrl::persist(void)
+{
+    if (!hasDigest || isDelta)
+    {
+        return;
+    }
+    uint32_t offset = written & ~(uint32_t)(OTA_SECTOR_SIZE - 1);
+    store.begin("ota", false);
+    store.putBytes("sha", digest, sizeof(digest));
+    store.putUInt("size", totalSize);
+    store.putBool("fw", isFW);
+    store.putUInt("off", offset);
+    store.end();
+    persistedTo = offset;
+}
+
+void OtaCtrl::clearPersisted(void)
+{
+    store.begin("ota", false);
+    store.clear();
+    store.end();
+}
+
+/* Returns the status reported to the master, a corrupted image is told apart from a flash error so it can be resent */
+UpdateStatus_t OtaCtrl::finish(void)
+{
+    uint8_t result[32];
+    mbedtls_sha256_finish(&sha, result);
+    mbedtls_sha256_free(&sha);
+    active = false;
+    clearPersisted();
+
+    if (isDelta && !patch.IsDone())
+    {
+        SystemLog::PutLog("Aktualizace: neuplny rozdilovy obraz", v_error);
+        return UPDATE_STATUS_SIZE_MISMATCH;
+    }
+
+    if (hasDigest)
+    {
+        if (written != totalSize)
+        {
+            SystemLog::PutLog("Aktualizace: nesouhlasi velikost obrazu", v_error);
+            return UPDATE_STATUS_SIZE_MISMATCH;
+        }
+        if (memcmp(result, digest, sizeof(result)) != 0)
+        {
+            SystemLog::PutLog("Aktualizace: nesouhlasi kontrolni soucet", v_error);
+            return UPDATE_STATUS_DIGEST_MISMATCH;
+        }
+    }
+
+    if (isFW && (esp_ota_set_boot_partition(partition) != ESP_OK))
+    {
+        SystemLog::PutLog("Aktualizace: neplatny obraz firmwaru", v_error);
+        return UPDATE_STATUS_ERROR;
+    }
+    return UPDATE_STATUS_DONE;
+}
+
+/* Finishes the transfer once the whole image is in, the restart follows the final ack */
+bool OtaCtrl::complete(const uint8_t *mac_addr)
+{
+    if (!(((finalEnd != 0) && (expected >= finalEnd)) || (isDelta && patch.IsDone())))
+    {
+        return false;
+    }
+    UpdateStatus_t status = finish();
+    if (status == UPDATE_STATUS_DONE)
+    {
+        SystemLog::PutLog("Aktualizace firmwaru probehla uspesne", v_info);
+    }
+    else
+    {
+        SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe. Zarizeni se restartuje.", v_error);
+    }
+    sendAck(mac_addr, status);
+    delay(1000);
+    RestartCmd.Set(povoleno);
+    return true;
+}
+
+/*
+ * Checks the delta source image a slice per ESP-NOW task pass. The
+ * chunks that came meanwhile are held in the window, the gateway
+ * learns from the ack that they arrived and waits. Once the source
+ * matches they are decoded and acked.
+ */
+bool OtaCtrl::poll(void)
+{
+    if (!active || !isDelta || !patch.IsCheckingSource())
+    {
+        return false;
+    }
+    lastActivity = millis();
+    if (!patch.CheckSource(DELTA_CHECK_STEP))
+    {
+        return true;
+    }
+    if (patch.IsError())
+    {
+        SystemLog::PutLog("Aktualizace: rozdilovy obraz nepatri k bezicimu firmwaru", v_error);
+        active = false;
+        sendAck(peer_addr, UPDATE_STATUS_ERROR);
+        return false;
+    }
+    drainWindow();
+    if (patch.IsError())
+    {
+        SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe zapisu", v_error);
+        active = false;
+        sendAck(peer_addr, UPDATE_STATUS_ERROR);
+        return false;
+    }
+    if (!complete(peer_addr))
+    {
+        sendAck(peer_addr, UPDATE_STATUS_OK);
+    }
+    return false;
+}
+
+void OtaCtrl::sendAck(const uint8_t *mac_addr, UpdateStatus_t status)
+{
+    UpdateResponsePayload response;
+    response.offset = expected;
+    response.bitmap = windowBitmap();
+    response.status = status;
+    sinceAck = 0;
+    ESPNowTxn::Send(mac_addr, MSG_FW_UPDATE_RESPONSE, (const uint8_t *)&response, sizeof(response), AckPolicy);
+}
+
+void OtaCtrl::handleInfo(const uint8_t *mac_addr, const UpdateRequestPayload *payload)
+{
+    UpdateInfoPayload info;
+    memcpy(&info, payload->data, sizeof(info));
+
+    uint32_t resumeOffset = 0;
+    store.begin("ota", true);
+    if (!payload->isDelta && store.getUInt("size", 0) == info.size && store.getBool("fw", false) == (bool)payload->isFW)
+    {
+        uint8_t stored[32];
+        if ((store.getBytes("sha", stored, sizeof(stored)) == sizeof(stored)) && !memcmp(stored, info.sha256, sizeof(stored)))
+        {
+            resumeOffset = store.getUInt("off", 0);
+        }
+    }
+    store.end();
+
+    if (active && hasDigest && !memcmp(digest, info.sha256, sizeof(digest)))
+    {
+        lastActivity = millis();
+        sendAck(mac_addr, UPDATE_STATUS_OK);
+        return;
+    }
+
+    hasDigest = true;
+    totalSize = info.size;
+    memcpy(digest, info.sha256, sizeof(digest));
+
+    if (!begin(payload->isFW, payload->isDelta, resumeOffset))
+    {
+        sendAck(mac_addr, UPDATE_STATUS_ERROR);
+        return;
+    }
+    if (expected > 0)
+    {
+        SystemLog::PutLog("Pokracovani aktualizace od " + String(expected) + " B", v_info);
+    }
+    else
+    {
+        SystemLog::PutLog(isDelta ? "Start rozdilove aktualizace firmwaru" : "Start aktualizace firmwaru", v_info);
+        persist();
+    }
+    sendAck(mac_addr, UPDATE_STATUS_OK);
+}
+
+void OtaCtrl::HandleRequest(const uint8_t *mac_addr, const UpdateRequestPayload *payload)
+{
+    if (payload->isInfo)
+    {
+        handleInfo(mac_addr, payload);
+        return;
+    }
+
+    if (!active)
+    {
+        if (payload->index != 0)
+        {
+            sendAck(mac_addr, UPDATE_STATUS_NOT_STARTED);
+            return;
+        }
+        hasDigest = false;
+        clearPersisted();
+        if (!begin(payload->isFW, payload->isDelta, 0))
+        {
+            sendAck(mac_addr, UPDATE_STATUS_ERROR);
+            return;
+        }
+        SystemLog::PutLog(isDelta ? "Start rozdilove aktualizace firmwaru" : "Start aktualizace firmwaru", v_info);
+    }
+
+    lastActivity = millis();
+    if ((chunkSize == 0) && (!payload->isFinal || payload->index == 0))
+    {
+        chunkSize = payload->nmr;
+    }
+    if (payload->isFinal)
+    {
+        finalEnd = payload->index + payload->nmr;
+    }
+
+    bool ackNow = false;
+    if ((payload->index + payload->nmr) <= expected)
+    {
+        /* Duplicate of already written data, acknowledge only */
+        ackNow = true;
+    }
+    else if (payload->index <= expected)
+    {
+        uint32_t skip = expected - payload->index;
+        if (!consume(payload->data + skip, payload->nmr - skip))
+        {
+            SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe zapisu", v_error);
+            active = false;
+            sendAck(mac_addr, UPDATE_STATUS_ERROR);
+            return;
+        }
+        if ((payload->index + payload->nmr) > expected)
+        {
+            /* Held while the delta source is checked */
+            storeInWindow(payload);
+        }
+        drainWindow();
+    }
+    else
+    {
+        /* Gap in the stream, report missing chunks immediately */
+        storeInWindow(payload);
+        ackNow = true;
+    }
+
+    if (complete(mac_addr))
+    {
+        return;
+    }
+
+    if (ackNow || (++sinceAck >= OTA_WINDOW_CHUNKS))
+    {
+        sendAck(mac_addr, UPDATE_STATUS_OK);
+    }
+}
+
+void OtaCtrl::onRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    const UpdateRequestPayload *request = (const UpdateRequestPayload *)payload;
+    size_t dataSize = payloadSize - offsetof(UpdateRequestPayload, data);
+    if ((request->nmr > dataSize) || (request->isInfo && (dataSize < sizeof(UpdateInfoPayload))))
+    {
+        SystemLog::PutLog("ESP-Now update request too short", v_warning);
+        return;
+    }
+    active_tasks[Communication_Task] = true;
+    memcpy(peer_addr, mac_addr, 6);
+    HandleRequest(mac_addr, request);
+}
+
+void OtaCtrl::Init(void)
+{
+    ESPNowCtrl::RegisterHandler(MSG_FW_UPDATE_REQUEST, onRequest);
+    ESPNowCtrl::SetPollCallback(poll);
+}
+
+bool OtaCtrl::IsActive(void)
+{
+    return active;
+}
+
+bool OtaCtrl::IsStalled(void)
+{
+    return active && ((millis() - lastActivity) > (OTA_IDLE_TIMEOUT_S * 1000));
+}
+
+void OtaCtrl::Suspend(void)
+{
+    if (!active)
+    {
+        return;
+    }
+    active = false;
+    mbedtls_sha256_free(&sha);
+    if (hasDigest && !isDelta)
+    {
+        persist();
+        SystemLog::PutLog("Aktualizace prerusena, pokracuje od " + String(persistedTo) + " B", v_warning);
+    }
+    else
+    {
+        SystemLog::PutLog("Pri aktualizaci firmwaru doslo k chybe: Timeout", v_error);
+    }
+}
@@ -0,0 +1,84 @@
+/***********************************************************************
+ * Filename: ota_ctrl.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the OtaCtrl class, which receives firmware and file
+ *     system images over ESP-NOW. Chunks are written directly to the
+ *     inactive partition at their offset, out of order chunks are kept
+ *     in a small window and acknowledged with a bitmap. Progress is
+ *     persisted so an interrupted transfer resumes where it stopped,
+ *     and the image is checked with a streaming SHA-256 before boot.
+ *     Delta updates are applied on the fly against the running image.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "esp_now_ctrl.h"
+#include "esp_now_txn.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+#include "Preferences.h"
+#include "delta_patch.h"
+
+#define OTA_SECTOR_SIZE 4096
+#define OTA_PERSIST_BYTES (16 * 1024)
+#define OTA_IDLE_TIMEOUT_S 20
+
+typedef struct
+{
+    uint32_t index;
+    uint8_t nmr;
+    bool used;
+    uint8_t data[OTA_CHUNK_SIZE];
+} OtaChunk_t;
+
+class OtaCtrl
+{
+private:
+    static const esp_partition_t *partition;
+    static mbedtls_sha256_context sha;
+    static Preferences store;
+    static OtaChunk_t window[OTA_WINDOW_CHUNKS];
+    static DeltaPatch patch;
+
+    static bool active;
+    static bool isFW;
+    static bool isDelta;
+    static bool hasDigest;
+    static uint8_t digest[32];
+    static uint32_t totalSize;
+    static uint32_t expected;
+    static uint32_t written;
+    static uint32_t finalEnd;
+    static uint32_t erasedTo;
+    static uint32_t persistedTo;
+    static uint16_t chunkSize;
+    static uint8_t sinceAck;
+    static uint32_t lastActivity;
+    static uint8_t peer_addr[6];
+    static const TxnPolicy_t AckPolicy;
+
+    static bool begin(bool fw, bool delta, uint32_t resumeOffset);
+    static bool writeOutput(const uint8_t *data, size_t len);
+    static bool consume(const uint8_t *data, size_t len);
+    static void drainWindow(void);
+    static bool storeInWindow(const UpdateRequestPayload *payload);
+    static uint32_t windowBitmap(void);
+    static void persist(void);
+    static void clearPersisted(void);
+    static UpdateStatus_t finish(void);
+    static bool complete(const uint8_t *mac_addr);
+    static bool poll(void);
+    static void sendAck(const uint8_t *mac_addr, UpdateStatus_t status);
+    static void handleInfo(const uint8_t *mac_addr, const UpdateRequestPayload *payload);
+    static void onRequest(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+
+public:
+    static void Init(void);
+    static void HandleRequest(const uint8_t *mac_addr, const UpdateRequestPayload *payload);
+    static bool IsActive(void);
+    static bool IsStalled(void);
+    static void Suspend(void);
+};
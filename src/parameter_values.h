@@ -23,6 +23,10 @@
 
 
 #define ERR_HISTORY_CNT 16
+#define LATENCY_HIST_CNT 8
+#define WEIGHT_SAMPLES_MIN 3
+#define WEIGHT_SAMPLES_MAX 32
+#define WEIGHT_CALIB_POINTS_MAX 8
 
 typedef enum
 {
@@ -81,6 +85,7 @@ typedef enum
 	NeniProud = 3,
 	ChybaZavirani = 4,
 	ChybaOtevirani = 5,
+	NeniVaha = 6,
 	MAX_ERROR = 100
 } ErrorState_t;
 
@@ -111,8 +116,22 @@ typedef enum
 	kalibrace_neni = 0,
 	kalibrace_provedena = 1,
 	kalibrace_proved = 2,
+	kalibrace_chyba = 3,
+	kalibrace_smaz = 4,
 } TareState_t;
 
+typedef enum
+{
+	odhad_median = 0,
+	odhad_orezany_prumer = 1,
+} WeightEstimator_t;
+
+typedef enum
+{
+	rychlost_10sps = 0,
+	rychlost_80sps = 1,
+} LoadCellRate_t;
+
 typedef enum
 {
 	povel_neni = 0,
@@ -591,6 +591,32 @@ void log_reg::Set(ErrorState_t err)
 	}
 }
 
+//*****************************************************************************
+//! \odvozena trida parametru pro histogram
+//*****************************************************************************
+
+uint8_t hist_reg::readregval(int16_t *out)
+{
+	size_t idx = getidx();
+	*out = (int16_t)bins[idx];
+	return 1;
+}
+
+uint8_t hist_reg::writeregval(int16_t inp)
+{
+	return 0;
+}
+
+void hist_reg::resetval(void)
+{
+	memset(bins, 0, sizeof(bins));
+}
+
+void hist_reg::Set(const uint16_t *values)
+{
+	memcpy(bins, values, sizeof(bins));
+}
+
 //*****************************************************************************
 //! \odvozena trida parametru pro mac adresu
 //*****************************************************************************
@@ -42,6 +42,7 @@
 #include "log.h"
 #include "motor.h"
 #include "feeder_ctrl.h"
+#include "WiFiGeneric.h"
 #undef PAR_DEF_INCLUDES
 
 #else /*PAR_DEF_INCLUDES*/
@@ -101,6 +102,32 @@ DefPar_Nv( AutomatikaDoplnovani,   33,  povoleno, vypnuto,povoleno, U16_,   Par_
 DefPar_Nv( CasProDoplneni_M, 34,  5,    2,    180, U16_,   Par_RW  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
 
 
+/*
+-----------------------------------------------------------------------------------------------------------
+  @ Mereni vahy
+
+-----------------------------------------------------------------------------------------------------------
+*/
+DefPar_Nv( PocetVzorku, 600,  WEIGHT_SAMPLES_MIN,    WEIGHT_SAMPLES_MIN,    WEIGHT_SAMPLES_MAX, U16_,   Par_RW  ,    Par_Installer | Par_ESPNow,    FLAGS_NONE )
+DefPar_Nv( RychlostVahy, 601,  rychlost_10sps,    rychlost_10sps,    rychlost_80sps, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( OdhadVahy, 602,  odhad_orezany_prumer,    odhad_median,    odhad_orezany_prumer, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( MezOdlehlych_x10, 603,  35,    10,    100, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( CilovaChybaVahy, 604,  50,    0,    10000, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_RTC( RozptylVahy, 605,  0,    0,    0, S32_,   Par_R  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
+DefPar_RTC( PouziteVzorky, 607,  0,    0,    WEIGHT_SAMPLES_MAX, U16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( OdlehleVzorky, 608,  0,    0,    WEIGHT_SAMPLES_MAX, U16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( FiltrovanaVaha, 609,  0,     -1000000,    10000000, S32_,   Par_R  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
+DefPar_RTC( SpotrebaVahy_h, 611,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( DoVyprazdneni_M, 613,  -1,    0,    0, S32_,   Par_R  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
+DefPar_Nv( FiltrVahy, 615,  povoleno, vypnuto,povoleno, U16_,   Par_RW  ,   Par_Installer, BOOL_FLAG)
+DefPar_Nv( ZmenaSpotreby, 616,  500,    0,    30000, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( MezSkoku_x10, 617,  50,    20,    200, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_RTC( Vaha_g, 620,  0,     0,    0, S32_,   Par_R  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
+DefPar_RTC( Spotreba_g_h, 622,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_Ram( KalibraceGramy, 624,  0,    0,    1000000L, S32_,   Par_RW  ,    Par_Installer | Par_ESPNow,    FLAGS_NONE )
+DefPar_Ram( KalibraceBodu, 626,  kalibrace_neni,   kalibrace_neni,    kalibrace_smaz, U16_,   Par_RW  ,    Par_Installer | Par_ESPNow,    FLAGS_NONE)
+DefPar_Ram( PocetBodu, 627,  0,    0,    WEIGHT_CALIB_POINTS_MAX, U16_,   Par_R  ,    Par_Installer,    FLAGS_NONE )
+
 /*
 -----------------------------------------------------------------------------------------------------------
   @ ESP-NOW pripojeni
@@ -110,6 +137,24 @@ DefPar_Nv( CasProDoplneni_M, 34,  5,    2,    180, U16_,   Par_RW  ,    Par_Publ
 DefPar_Nv( PeriodaKomunikace_S, 35,  10,    2,    3600, U16_,   Par_RW  ,    Par_Public | Par_ESPNow,    COMM_PERIOD_FLAG)
 DefPar_Fun( MasterMacAdresa, 200,  255,    0,    0, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE, mac_reg_nv)
 DefPar_RTC( WiFiKanal, 203,  1,     1,    13, U16_,   Par_R,    Par_Public,    FLAGS_NONE )
+DefPar_Nv( CekaniNaPovel_ms, 204,  3000,    0,    10000, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( DavkaProbuzeni, 205,  1,    1,    32, U16_,   Par_RW  ,    Par_Public | Par_ESPNow,    FLAGS_NONE )
+DefPar_Nv( ZmenaVahy_proc, 206,  10,    1,    100, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_Nv( ZmenaNapeti_mV, 207,  100,    10,    5000, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+
+/*
+-----------------------------------------------------------------------------------------------------------
+  @ Kvalita spojeni
+
+-----------------------------------------------------------------------------------------------------------
+*/
+DefPar_RTC( RadioOdeslano, 500,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( RadioChybyMAC, 502,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( RadioOpakovani, 504,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( RadioRSSI_dBm, 506,  0,    -128,    0, S16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( RadioVykon, 507,  WIFI_POWER_19_5dBm,    WIFI_POWER_MINUS_1dBm,    WIFI_POWER_19_5dBm, S16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_Fun( RadioLatence, 508,  0,    0,    0, U16_,   Par_R  ,    Par_Public,    FLAGS_NONE, hist_reg)
+DefPar_Nv( AdaptivniVykon,   516,  povoleno, vypnuto,povoleno, U16_,   Par_RW  ,   Par_Installer, BOOL_FLAG)
 
 /*
 -----------------------------------------------------------------------------------------------------------
@@ -119,6 +164,10 @@ DefPar_RTC( WiFiKanal, 203,  1,     1,    13, U16_,   Par_R,    Par_Public,    F
 */
 DefPar_Nv( PopisCasu, 300,  0,    0,    46, STRING_,   Par_RW  ,    Par_Public,    FLAGS_NONE )
 DefPar_Ram( AktualniCas, 323,  0,    0,    20, STRING_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_Nv( PresnostCasu_S, 333,  60,    1,    3600, U16_,   Par_RW  ,    Par_Installer,    FLAGS_NONE )
+DefPar_RTC( DriftHodin_ppm, 334,  0,    0,    0, S16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( ChybaCasu_ms, 335,  0,    0,    0, S32_,   Par_R  ,    Par_Public,    FLAGS_NONE )
+DefPar_RTC( SlotProbuzeni_S, 336,  -1,    -1,    3600, S16_,   Par_R  ,    Par_Public,    FLAGS_NONE )
 
 /*
 -----------------------------------------------------------------------------------------------------------
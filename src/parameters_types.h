@@ -475,6 +475,23 @@ public:
 	void Set(ErrorState_t err);
 };
 
+//*****************************************************************************
+//! \odvozena trida parametru typu U16- pro ulozeni histogramu
+//*****************************************************************************
+class hist_reg : public Register
+{
+protected:
+	uint16_t bins[LATENCY_HIST_CNT];
+
+public:
+	hist_reg(const pardef_t &pd) : Register(pd) {}
+	size_t getsize(void) { return LATENCY_HIST_CNT; }
+	uint8_t readregval(int16_t *out);
+	uint8_t writeregval(int16_t inp);
+	void resetval(void);
+	void Set(const uint16_t *values);
+};
+
 //*****************************************************************************
 //! \odvozena trida parametru - pro ulozeni mac adresy
 //*****************************************************************************
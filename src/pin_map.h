@@ -21,5 +21,6 @@
 #define LBO 1
 #define PDCLK 6
 #define PDO 4
+// #define PDRATE  // HX711 RATE, only on boards that do not tie it low
 #define BAT_AINP 3
 #define BAT_NSENSE 19
@@ -0,0 +1,146 @@
+/***********************************************************************
+ * Filename: telemetry_batch.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the TelemetryBatch class. The decision is taken by the
+ *     client task before the radio is started, it waits for the weight
+ *     measurement of the wake. Samples are only stored on wakes without
+ *     the radio, the other wakes upload the current values anyway.
+ *
+ ***********************************************************************/
+
+#include "telemetry_batch.h"
+#include "common.h"
+#include "event_push.h"
+#include "time_sync.h"
+#include "ota_ctrl.h"
+#include "deep_sleep_ctrl.h"
+
+RTC_DATA_ATTR TelemetrySample TelemetryBatch::samples[TELEMETRY_BATCH_LEN];
+RTC_DATA_ATTR uint8_t TelemetryBatch::count = 0;
+RTC_DATA_ATTR uint16_t TelemetryBatch::skippedWakes = 0;
+RTC_DATA_ATTR TelemetrySample TelemetryBatch::reported;
+RTC_DATA_ATTR bool TelemetryBatch::reportedValid = false;
+SemaphoreHandle_t TelemetryBatch::measured = xSemaphoreCreateBinary();
+SemaphoreHandle_t TelemetryBatch::radioRequest = xSemaphoreCreateBinary();
+std::mutex TelemetryBatch::mutex;
+
+void TelemetryBatch::take(TelemetrySample *sample)
+{
+    sample->time = (int32_t)Now();
+    sample->weight = AktualniVaha.Get();
+    sample->battery_mV = (uint16_t)NapetiBaterie_mV.Get();
+    sample->weight_proc = AktualniVaha_proc.Get();
+    sample->state = StavKrmitka.Get();
+}
+
+bool TelemetryBatch::crossed(const TelemetrySample &sample)
+{
+    if (!reportedValid || (sample.state != reported.state))
+    {
+        return true;
+    }
+    if ((sample.battery_mV ^ reported.battery_mV) & TELEMETRY_LOW_BATTERY)
+    {
+        return true;
+    }
+    int32_t battery = (sample.battery_mV & ~TELEMETRY_LOW_BATTERY) - (reported.battery_mV & ~TELEMETRY_LOW_BATTERY);
+    int32_t weight = (int32_t)sample.weight_proc - reported.weight_proc;
+    return (abs(battery) >= ZmenaNapeti_mV.Get()) || (abs(weight) >= ZmenaVahy_proc.Get());
+}
+
+bool TelemetryBatch::Enabled(void)
+{
+    return DavkaProbuzeni.Get() > 1;
+}
+
+/* Called by the weight task once the wake's measurement is stored */
+void TelemetryBatch::Measured(void)
+{
+    xSemaphoreGive(measured);
+}
+
+/* Decides whether this wake starts the radio, a skipped wake leaves its sample in the batch */
+bool TelemetryBatch::RadioNeeded(void)
+{
+    if (!Enabled() || (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER))
+    {
+        return true;
+    }
+    if (memcmp(MasterMacAdresa.Get(), BroadcastAddress, 6) == 0)
+    {
+        return true;
+    }
+    if (EventPush::Pending() || OtaCtrl::IsActive() || TimeSync::NeedsSync())
+    {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (((skippedWakes + 1) >= DavkaProbuzeni.Get()) || (count >= TELEMETRY_BATCH_LEN))
+        {
+            return true;
+        }
+    }
+
+    xSemaphoreTake(measured, pdMS_TO_TICKS(TELEMETRY_SAMPLE_WAIT_MS));
+    TelemetrySample sample;
+    take(&sample);
+    /* The measurement may have raised an event (missing load cell) before the hook is installed */
+    if (EventPush::Pending())
+    {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (crossed(sample))
+    {
+        return true;
+    }
+    samples[count++] = sample;
+    skippedWakes++;
+    return false;
+}
+
+/* Something to report came up after the radio was left off, e.g. the flap moved */
+void TelemetryBatch::RequestRadio(void)
+{
+    active_tasks[Communication_Task] = true;
+    xSemaphoreGive(radioRequest);
+}
+
+void TelemetryBatch::WaitForRadio(void)
+{
+    xSemaphoreTake(radioRequest, portMAX_DELAY);
+}
+
+/* Upload stage, fills the next frame of samples starting at *next */
+bool TelemetryBatch::NextFrame(uint8_t *next, Message *msg)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (*next >= count)
+    {
+        return false;
+    }
+    TelemetryBatchPayload *payload = (TelemetryBatchPayload *)msg->payload;
+    uint8_t nmr = min((size_t)(count - *next), TELEMETRY_FRAME_MAX);
+    memcpy(payload->samples, &samples[*next], nmr * sizeof(TelemetrySample));
+    payload->nmr = nmr;
+    *next += nmr;
+    payload->last = *next >= count;
+    msg->messageType = MSG_TELEMETRY_BATCH;
+    msg->payloadSize = TelemetryBatchPayloadSize(nmr);
+    return true;
+}
+
+/* The upload went through, nmr samples were delivered and the current values are the new reference */
+void TelemetryBatch::Uploaded(uint8_t nmr)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    nmr = min(nmr, count);
+    memmove(&samples[0], &samples[nmr], (count - nmr) * sizeof(TelemetrySample));
+    count -= nmr;
+    skippedWakes = 0;
+    take(&reported);
+    reportedValid = true;
+}
@@ -0,0 +1,50 @@
+/***********************************************************************
+ * Filename: telemetry_batch.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the TelemetryBatch class, which keeps the radio off on
+ *     timer wakes that have nothing new to report. The values measured
+ *     at such a wake are appended to a ring in RTC memory. The radio is
+ *     brought up every DavkaProbuzeni wakes, when the weight or battery
+ *     moves by more than ZmenaVahy_proc or ZmenaNapeti_mV since the last
+ *     upload, or when the state changes. The stored samples are then
+ *     sent with MSG_TELEMETRY_BATCH as a stage of the upload.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "parameters.h"
+#include "esp_now_ctrl.h"
+
+#define TELEMETRY_BATCH_LEN 32
+#define TELEMETRY_FRAME_MAX (sizeof(((TelemetryBatchPayload *)0)->samples) / sizeof(TelemetrySample))
+#define TELEMETRY_SAMPLE_WAIT_MS 3000 // longest wait for the weight measurement of the wake
+#define TELEMETRY_LOW_BATTERY 0x8000
+
+class TelemetryBatch
+{
+private:
+    static RTC_DATA_ATTR TelemetrySample samples[TELEMETRY_BATCH_LEN];
+    static RTC_DATA_ATTR uint8_t count;
+    static RTC_DATA_ATTR uint16_t skippedWakes;
+    static RTC_DATA_ATTR TelemetrySample reported; // values at the last upload
+    static RTC_DATA_ATTR bool reportedValid;
+    static SemaphoreHandle_t measured;
+    static SemaphoreHandle_t radioRequest;
+    static std::mutex mutex;
+
+    static void take(TelemetrySample *sample);
+    static bool crossed(const TelemetrySample &sample);
+
+public:
+    static bool Enabled(void);
+    static void Measured(void);
+    static bool RadioNeeded(void);
+    static void RequestRadio(void);
+    static void WaitForRadio(void);
+    static bool NextFrame(uint8_t *next, Message *msg);
+    static void Uploaded(uint8_t nmr);
+};
@@ -15,6 +15,7 @@
 #include "parameters.h"
 #include "feeder_ctrl.h"
 #include "deep_sleep_ctrl.h"
+#include "time_sync.h"
 
 #define TIME_CONTROL_TASK_PERIOD_MS 10000
 
@@ -36,6 +37,7 @@ public:
 
     static void Task(void)
     {
+        TimeSync::Correct();
         time_t currentTime = Now();
         time_t sunriseTime = CasVychodu.Get();
         time_t sunsetTime = CasZapadu.Get();
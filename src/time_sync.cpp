@@ -0,0 +1,238 @@
+/***********************************************************************
+ * Filename: time_sync.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the TimeSync class. All times are taken from the local
+ *     clock in microseconds. The offset measured at a sync is what is
+ *     left after the drift correction applied since the previous sync,
+ *     so it refines the current drift estimate instead of replacing it.
+ *     The deep sleep timer runs at the local rate as well, a sleep is
+ *     stretched by the drift so that it ends at the right true time.
+ *
+ ***********************************************************************/
+
+#include "time_sync.h"
+#include "common.h"
+#include "log.h"
+#include <sys/time.h>
+
+#define TIME_SYNC_MIN_DRIFT_ERROR_PPB 20000 // temperature changes the rate of the clock by at least this much
+#define TIME_SYNC_MAX_DRIFT_PPB 50000000    // larger rates mean the clock was changed by something else
+
+RTC_DATA_ATTR int64_t TimeSync::lastSync_us = 0;
+RTC_DATA_ATTR int64_t TimeSync::lastCorrection_us = 0;
+RTC_DATA_ATTR int32_t TimeSync::drift_ppb = 0;
+RTC_DATA_ATTR uint32_t TimeSync::driftError_ppb = 0;
+RTC_DATA_ATTR uint32_t TimeSync::syncError_ms = 0;
+RTC_DATA_ATTR bool TimeSync::driftValid = false;
+RTC_DATA_ATTR uint16_t TimeSync::slotOffset_s = SLOT_NONE;
+int64_t TimeSync::requestSent_us = 0;
+std::mutex TimeSync::mutex;
+
+int64_t TimeSync::localTime_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void TimeSync::setLocalTime_us(int64_t t_us)
+{
+    struct timeval tv = {.tv_sec = (time_t)(t_us / 1000000LL), .tv_usec = (suseconds_t)(t_us % 1000000LL)};
+    settimeofday(&tv, NULL);
+}
+
+void TimeSync::updateDrift(int64_t offset_us, int64_t sinceSync_us, uint32_t sampleError_ms)
+{
+    if (sinceSync_us < TIME_SYNC_MIN_DRIFT_SPAN_S * 1000000LL)
+    {
+        return;
+    }
+    int64_t sample_ppb = drift_ppb + offset_us * 1000LL / (sinceSync_us / 1000000LL);
+    if (llabs(sample_ppb) > TIME_SYNC_MAX_DRIFT_PPB)
+    {
+        return;
+    }
+
+    /* Both sync points are uncertain, spread over the measured interval */
+    int64_t error_ppb = (int64_t)(sampleError_ms + syncError_ms) * 1000000LL / (sinceSync_us / 1000000LL);
+    if (driftValid)
+    {
+        error_ppb = max(error_ppb, (int64_t)llabs(sample_ppb - drift_ppb));
+        drift_ppb = (int32_t)((3 * (int64_t)drift_ppb + sample_ppb) / 4);
+    }
+    else
+    {
+        drift_ppb = (int32_t)sample_ppb;
+        driftValid = true;
+    }
+    driftError_ppb = (uint32_t)max(error_ppb, (int64_t)TIME_SYNC_MIN_DRIFT_ERROR_PPB);
+}
+
+void TimeSync::publish(void)
+{
+    DriftHodin_ppm.Set(drift_ppb / 1000);
+    ChybaCasu_ms.Set((int32_t)min(ErrorBound_ms(), (uint32_t)INT32_MAX));
+    SlotProbuzeni_S.Set((slotOffset_s == SLOT_NONE) ? -1 : slotOffset_s);
+}
+
+void TimeSync::setSlot(uint16_t offset_s)
+{
+    if (offset_s != slotOffset_s)
+    {
+        slotOffset_s = offset_s;
+        SystemLog::PutLog((offset_s == SLOT_NONE) ? String("Wake slot cleared") : "Wake slot " + String(offset_s) + " s", v_info);
+    }
+}
+
+void TimeSync::onResponse(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    const TimeSyncPayload *sync = (const TimeSyncPayload *)payload;
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t received_us = localTime_us();
+
+    /* Without milliseconds the master time is somewhere within the second */
+    bool hasMs = payloadSize >= offsetof(TimeSyncPayload, slotOffset_s);
+    int64_t master_us = (int64_t)sync->currentTime * 1000000LL + (hasMs ? sync->currentTime_ms * 1000LL : 500000LL);
+    uint32_t sampleError_ms = hasMs ? 1 : 500;
+
+    int64_t rtt_us = (requestSent_us != 0) ? (received_us - requestSent_us) : -1;
+    bool rttValid = (rtt_us >= 0) && (rtt_us <= TIME_SYNC_MAX_RTT_MS * 1000LL);
+    if (rttValid)
+    {
+        master_us += rtt_us / 2;
+        sampleError_ms += rtt_us / 2000;
+    }
+    else
+    {
+        sampleError_ms += TIME_SYNC_MAX_RTT_MS;
+    }
+
+    if ((lastSync_us != 0) && rttValid)
+    {
+        updateDrift(received_us - master_us, received_us - lastSync_us, sampleError_ms);
+    }
+
+    int64_t now_us = master_us + (localTime_us() - received_us);
+    setLocalTime_us(now_us);
+    lastSync_us = now_us;
+    lastCorrection_us = now_us;
+    syncError_ms = sampleError_ms;
+    requestSent_us = 0;
+
+    PopisCasu.Set(sync->timezone);
+    SetTimezone(sync->timezone);
+    CasVychodu.Set(sync->sunriseTime);
+    CasZapadu.Set(sync->sunsetTime);
+    if (payloadSize >= sizeof(TimeSyncPayload))
+    {
+        setSlot(sync->slotOffset_s);
+    }
+    publish();
+}
+
+/* MSG_SLEEP from the master assigns the wake slot */
+void TimeSync::onSleep(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize)
+{
+    if (payloadSize < offsetof(SleepPayload, nextWake))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    setSlot(((const SleepPayload *)payload)->slotOffset_s);
+    publish();
+}
+
+void TimeSync::Init(void)
+{
+    ESPNowCtrl::RegisterHandler(MSG_TIME_SYNC_RESPONSE, onResponse);
+    ESPNowCtrl::RegisterHandler(MSG_SLEEP, onSleep);
+    Correct();
+}
+
+void TimeSync::Correct(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (driftValid && (lastCorrection_us != 0))
+    {
+        int64_t now_us = localTime_us();
+        int64_t correction_us = -((now_us - lastCorrection_us) / 1000LL) * drift_ppb / 1000000LL;
+        if (llabs(correction_us) >= TIME_SYNC_MIN_CORRECTION_US)
+        {
+            setLocalTime_us(now_us + correction_us);
+            lastCorrection_us = now_us + correction_us;
+        }
+    }
+    publish();
+}
+
+void TimeSync::FillRequest(Message *msg)
+{
+    msg->messageType = MSG_TIME_SYNC_REQUEST;
+    msg->payloadSize = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    requestSent_us = localTime_us();
+}
+
+uint32_t TimeSync::ErrorBound_ms(void)
+{
+    if (lastSync_us == 0)
+    {
+        return UINT32_MAX;
+    }
+    int64_t since_ms = max((int64_t)((localTime_us() - lastSync_us) / 1000), (int64_t)0);
+    uint32_t rate_ppb = driftValid ? driftError_ppb : TIME_SYNC_DEFAULT_DRIFT_PPB;
+    int64_t bound_ms = syncError_ms + since_ms * rate_ppb / 1000000000LL;
+    return (uint32_t)min(bound_ms, (int64_t)UINT32_MAX);
+}
+
+bool TimeSync::NeedsSync(void)
+{
+    return ErrorBound_ms() > (uint32_t)PresnostCasu_S.Get() * 1000;
+}
+
+int64_t TimeSync::Now_us(void)
+{
+    return localTime_us();
+}
+
+uint16_t TimeSync::Slot(void)
+{
+    return slotOffset_s;
+}
+
+/* Time of the next wake, the start of the slot when the master assigned one and the clock was synchronized */
+int64_t TimeSync::NextWake_us(uint32_t period_s)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t now_us = localTime_us();
+    int64_t period_us = (int64_t)period_s * 1000000LL;
+    if ((slotOffset_s == SLOT_NONE) || (slotOffset_s >= period_s) || (lastSync_us == 0))
+    {
+        return now_us + period_us;
+    }
+    int64_t phase_us = (now_us - (int64_t)slotOffset_s * 1000000LL) % period_us;
+    if (phase_us < 0)
+    {
+        phase_us += period_us;
+    }
+    int64_t wake_us = now_us - phase_us + period_us;
+    if ((wake_us - now_us) < TIME_SYNC_MIN_SLEEP_MS * 1000LL)
+    {
+        wake_us += period_us;
+    }
+    return wake_us;
+}
+
+/* Timer value that ends the sleep at wakeAt_us */
+uint64_t TimeSync::SleepDuration_us(int64_t wakeAt_us)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t sleep_us = max(wakeAt_us - localTime_us(), (int64_t)(TIME_SYNC_MIN_SLEEP_MS * 1000LL));
+    if (driftValid)
+    {
+        sleep_us += (sleep_us / 1000LL) * drift_ppb / 1000000LL;
+    }
+    return (uint64_t)sleep_us;
+}
@@ -0,0 +1,61 @@
+/***********************************************************************
+ * Filename: time_sync.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the TimeSync class, which sets the clock from the master.
+ *     The request is timestamped and half of the round trip is added to
+ *     the received time. The rate error of the local clock is estimated
+ *     from the offset found at consecutive syncs and kept in RTC memory,
+ *     the clock is corrected by it between syncs. A new sync is requested
+ *     only when the estimated error exceeds PresnostCasu_S. The master
+ *     can assign a wake slot within PeriodaKomunikace_S, the sleep time
+ *     is then computed from the synchronized clock so that the feeders
+ *     of one master take turns on the channel.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "parameters.h"
+#include "esp_now_ctrl.h"
+
+#define TIME_SYNC_MAX_RTT_MS 2000            // slower answers still set the clock, but do not update the drift
+#define TIME_SYNC_MIN_DRIFT_SPAN_S 600       // shortest interval the drift is measured over
+#define TIME_SYNC_DEFAULT_DRIFT_PPB 500000   // assumed rate error before the drift is known
+#define TIME_SYNC_MIN_CORRECTION_US 1000
+#define TIME_SYNC_MIN_SLEEP_MS 1000          // a slot closer than this is left for the next period
+
+class TimeSync
+{
+private:
+    static RTC_DATA_ATTR int64_t lastSync_us;
+    static RTC_DATA_ATTR int64_t lastCorrection_us;
+    static RTC_DATA_ATTR int32_t drift_ppb;
+    static RTC_DATA_ATTR uint32_t driftError_ppb;
+    static RTC_DATA_ATTR uint32_t syncError_ms;
+    static RTC_DATA_ATTR bool driftValid;
+    static RTC_DATA_ATTR uint16_t slotOffset_s;
+    static int64_t requestSent_us;
+    static std::mutex mutex;
+
+    static int64_t localTime_us(void);
+    static void setLocalTime_us(int64_t t_us);
+    static void updateDrift(int64_t offset_us, int64_t sinceSync_us, uint32_t sampleError_ms);
+    static void publish(void);
+    static void setSlot(uint16_t offset_s);
+    static void onResponse(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+    static void onSleep(const uint8_t *mac_addr, const uint8_t *payload, uint8_t payloadSize);
+
+public:
+    static void Init(void);
+    static void Correct(void);
+    static void FillRequest(Message *msg);
+    static uint32_t ErrorBound_ms(void);
+    static bool NeedsSync(void);
+    static int64_t Now_us(void);
+    static uint16_t Slot(void);
+    static int64_t NextWake_us(uint32_t period_s);
+    static uint64_t SleepDuration_us(int64_t wakeAt_us);
+};
@@ -6,7 +6,11 @@
  *     Defines the Weight class that performs weight measurements for
  *     monitoring the feed level and manages automatic refilling. It uses
  *     a HX711-like load cell to measure the weight and triggers appropriate
- *     events based on weight thresholds and calibration.
+ *     events based on weight thresholds and calibration. The HX711 is
+ *     read by the LoadCell class. The filling level follows the
+ *     Kalman filtered weight of WeightFilter, AktualniVaha stays the
+ *     raw measurement used for calibration. WeightCalib converts the
+ *     filtered weight to grams.
  ***********************************************************************/
 
 
@@ -19,72 +23,29 @@
 #include "log.h"
 #include "debounce.h"
 #include "feeder_ctrl.h"
-
-#define Channel_A_gain_128 1
-#define Channel_B_gain_32 2
-#define Channel_A_gain_64 3
-
-#define cyclespermicro 160
-#define microcycles(n) (n * cyclespermicro)
+#include "telemetry_batch.h"
+#include "load_cell.h"
+#include "weight_sampler.h"
+#include "weight_filter.h"
+#include "weight_calib.h"
+#include "error.h"
+
+typedef enum
+{
+    MEASURE_OK = 0,
+    MEASURE_NO_LOAD_CELL,
+} MeasureStatus_t;
 
 class Weight
 {
 private:
     static RTC_DATA_ATTR uint32_t weightCnt;
 
-    void ClkPulse(void)
-    {
-        uint32_t startCounter, counter, cpu_cycles;
-        int cyclediff, totalcycles, corrected;
-
-        startCounter = ESP.getCycleCount();
-        totalcycles = startCounter + microcycles(2);
-
-        portMUX_TYPE myMutex = portMUX_INITIALIZER_UNLOCKED;
-        taskENTER_CRITICAL(&myMutex);
-
-        digitalWrite(PDCLK, HIGH);
-
-        while (ESP.getCycleCount() < totalcycles)
-        {
-            __asm__ __volatile__("nop");
-        }
-        digitalWrite(PDCLK, LOW);
-        taskEXIT_CRITICAL(&myMutex);
-    }
-
-    int32_t doConversion(uint8_t mode)
-    {
-        byte index;
-        uint32_t conv_res = 0L;
-
-        while (digitalRead(PDO))
-        {
-            delay(1);
-        }
-
-        for (uint8_t i = 0; i < 24; i++)
-        {
-            ClkPulse();
-            conv_res = (conv_res << 1) | digitalRead(PDO);
-            delayMicroseconds(10);
-        }
-        for (uint8_t i = 0; i < mode; i++)
-        {
-            ClkPulse();
-            delayMicroseconds(10);
-        }
-
-        if (conv_res >= 0x800000)
-            conv_res = conv_res | 0xFF000000L;
-
-        return (int32_t)conv_res;
-    }
-
 public:
     void Init(void)
     {
         gpio_hold_dis((gpio_num_t)PDCLK);
+        WeightCalib::Init();
         FillingUpdate();
         if (StavKrmitka.Get() == Otevreno)
         {
@@ -103,23 +64,21 @@ public:
         }
     }
 
-    int32_t Measure(void)
+    MeasureStatus_t Measure(WeightEstimate_t *estimate)
     {
         Wake();
-        doConversion(Channel_A_gain_64);
-
-        int32_t curr = 0;
-        for (int i = 0; i < 2; i++)
+        LoadCell::SetRate((LoadCellRate_t)RychlostVahy.Get());
+        int32_t conv;
+        bool ok = LoadCell::Read(Channel_A_gain_64, &conv) && WeightSampler::Run(estimate);
+        Sleep();
+        if (!ok)
         {
-            delay(10);
-            curr += doConversion(Channel_A_gain_64);
+            Serial.println("Vaha neodpovida");
+            return MEASURE_NO_LOAD_CELL;
         }
-        curr /= 2;
-        Sleep();
-
-        Serial.printf("Aktualni vaha: %d\n", curr);
 
-        return curr;
+        Serial.printf("Aktualni vaha: %d (%d vzorku, %d odlehlych)\n", estimate->value, estimate->used, estimate->rejected);
+        return MEASURE_OK;
     }
 
     void FillingUpdate(void)
@@ -130,11 +89,11 @@ public:
         {
             if (StavKrmitka.Get() == Otevreno)
             {
-                int32_t delta_x = (AktualniVaha.Get() - empty) * 100;
+                int64_t delta_x = ((int64_t)FiltrovanaVaha.Get() - empty) * 100;
                 delta_x /= (full - empty);
                 delta_x = (delta_x < 0) ? 0 : (delta_x > 100) ? 100
                                                               : delta_x;
-                AktualniVaha_proc.Set(delta_x);
+                AktualniVaha_proc.Set((int32_t)delta_x);
             }
         }
         else
@@ -143,6 +102,17 @@ public:
         }
     }
 
+    /* Grams only with a calibration table, the registers keep zero until then */
+    void GramsUpdate(void)
+    {
+        int32_t grams = 0;
+        int32_t rate = 0;
+        WeightCalib::ToGrams(FiltrovanaVaha.Get(), &grams);
+        WeightCalib::RateToGrams(FiltrovanaVaha.Get(), SpotrebaVahy_h.Get(), &rate);
+        Vaha_g.Set(grams);
+        Spotreba_g_h.Set(rate);
+    }
+
     void Task(void)
     {
         bool empty_tmp = KalibracePrazdne.Get() == kalibrace_proved;
@@ -164,8 +134,38 @@ public:
             KalibracePrazdne.Set(kalibrace_neni);
         }
 
-        int32_t tmp = Measure();
+        bool point_tmp = KalibraceBodu.Get() == kalibrace_proved;
+        if (KalibraceBodu.Get() == kalibrace_smaz)
+        {
+            WeightCalib::Clear();
+            KalibraceBodu.Set(kalibrace_provedena);
+        }
+
+        WeightEstimate_t estimate;
+        if (no_load_cell.Check(Measure(&estimate) != MEASURE_OK))
+        {
+            /* Keep the last weight, a pending calibration cannot be done without the load cell */
+            if (empty_tmp || full_tmp)
+            {
+                KalibracePlne.Set(kalibrace_neni);
+                KalibracePrazdne.Set(kalibrace_neni);
+            }
+            if (point_tmp)
+            {
+                KalibraceBodu.Set(kalibrace_chyba);
+            }
+            TelemetryBatch::Measured();
+            return;
+        }
+        int32_t tmp = estimate.value;
         AktualniVaha.Set(tmp);
+        WeightFilter::Update(&estimate);
+
+        if (point_tmp)
+        {
+            bool ok = WeightCalib::AddPoint(tmp, KalibraceGramy.Get());
+            KalibraceBodu.Set(ok ? kalibrace_provedena : kalibrace_chyba);
+        }
 
         if (empty_tmp)
         {
@@ -180,6 +180,8 @@ public:
             KalibracePlne.Set(kalibrace_provedena);
         }
         FillingUpdate();
+        GramsUpdate();
+        TelemetryBatch::Measured();
 
         if (((weightCnt / 60) >= CasProDoplneni_M.Get()) && (StavKrmitka.Get() == Otevreno))
         {
@@ -203,20 +205,11 @@ public:
 
     void Sleep(void)
     {
-        digitalWrite(PDCLK, LOW);
-        digitalWrite(PDCLK, HIGH);
+        LoadCell::PowerDown();
     }
 
     void Wake(void)
     {
-        pinMode(PDCLK, OUTPUT);
-        digitalWrite(PDCLK, HIGH);
-        digitalWrite(PDCLK, LOW);
-        pinMode(PDO, INPUT);
-        delay(2);
-        while (digitalRead(PDO))
-        {
-            delay(1);
-        }
+        LoadCell::PowerUp();
     }
 };
\ No newline at end of file
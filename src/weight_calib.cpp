@@ -0,0 +1,157 @@
+/***********************************************************************
+ * Filename: weight_calib.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the WeightCalib class. The table is read from NVS
+ *     after a cold boot and kept in RTC memory with its slopes, so a
+ *     wake from deep sleep converts without touching the flash. Flash
+ *     is written only when a point is added or the table is cleared.
+ *
+ ***********************************************************************/
+
+#include "weight_calib.h"
+#include "log.h"
+
+RTC_DATA_ATTR CalibPoint_t WeightCalib::points[WEIGHT_CALIB_POINTS_MAX];
+RTC_DATA_ATTR int64_t WeightCalib::slope_q16[WEIGHT_CALIB_POINTS_MAX - 1];
+RTC_DATA_ATTR uint8_t WeightCalib::count = 0;
+RTC_DATA_ATTR bool WeightCalib::loaded = false;
+Preferences WeightCalib::store;
+std::mutex WeightCalib::mutex;
+
+/* Grams per raw count of every segment in Q16, raw counts are unique so the span is never zero */
+void WeightCalib::prepare(void)
+{
+    for (uint8_t i = 0; (i + 1) < count; i++)
+    {
+        int64_t span = (int64_t)points[i + 1].raw - points[i].raw;
+        slope_q16[i] = (((int64_t)points[i + 1].grams - points[i].grams) << WEIGHT_CALIB_Q) / span;
+    }
+    PocetBodu.Set(count);
+}
+
+void WeightCalib::save(void)
+{
+    store.begin("kalibrace", false);
+    if (count == 0)
+    {
+        /* putBytes refuses an empty blob */
+        store.remove("body");
+    }
+    else
+    {
+        store.putBytes("body", points, count * sizeof(CalibPoint_t));
+    }
+    store.end();
+}
+
+/* Index of the segment used for raw, the end segments also cover the values outside the table */
+uint8_t WeightCalib::segment(int32_t raw)
+{
+    uint8_t i = 0;
+    while (((i + 2) < count) && (raw >= points[i + 1].raw))
+    {
+        i++;
+    }
+    return i;
+}
+
+void WeightCalib::Init(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!loaded)
+    {
+        count = 0;
+        store.begin("kalibrace", true);
+        size_t len = store.getBytesLength("body");
+        if ((len % sizeof(CalibPoint_t) == 0) && (len <= sizeof(points)))
+        {
+            count = store.getBytes("body", points, len) / sizeof(CalibPoint_t);
+        }
+        store.end();
+        loaded = true;
+    }
+    prepare();
+}
+
+/* A point with the same reference load is taken again, otherwise the point is inserted by its raw count */
+bool WeightCalib::AddPoint(int32_t raw, int32_t grams)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint8_t same = count;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (points[i].grams == grams)
+        {
+            same = i;
+        }
+        else if (points[i].raw == raw)
+        {
+            SystemLog::PutLog("Kalibracni bod se shoduje s jinym bodem", v_warning);
+            return false;
+        }
+    }
+    if (same < count)
+    {
+        memmove(&points[same], &points[same + 1], (count - same - 1) * sizeof(CalibPoint_t));
+        count--;
+    }
+    else if (count >= WEIGHT_CALIB_POINTS_MAX)
+    {
+        SystemLog::PutLog("Kalibracni tabulka je plna", v_warning);
+        return false;
+    }
+
+    uint8_t pos = 0;
+    while ((pos < count) && (points[pos].raw < raw))
+    {
+        pos++;
+    }
+    memmove(&points[pos + 1], &points[pos], (count - pos) * sizeof(CalibPoint_t));
+    points[pos].raw = raw;
+    points[pos].grams = grams;
+    count++;
+
+    prepare();
+    save();
+    SystemLog::PutLog("Kalibracni bod " + String(grams) + " g = " + String(raw));
+    return true;
+}
+
+void WeightCalib::Clear(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    count = 0;
+    prepare();
+    save();
+    SystemLog::PutLog("Kalibracni tabulka smazana");
+}
+
+/* Needs two points at least, one point alone gives no scale */
+bool WeightCalib::ToGrams(int32_t raw, int32_t *grams)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count < 2)
+    {
+        return false;
+    }
+    uint8_t i = segment(raw);
+    int64_t delta = ((int64_t)raw - points[i].raw) * slope_q16[i];
+    int64_t value = points[i].grams + ((delta + (1LL << (WEIGHT_CALIB_Q - 1))) >> WEIGHT_CALIB_Q);
+    *grams = (int32_t)constrain(value, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+    return true;
+}
+
+/* Converts a rate of raw counts with the slope of the segment the weight raw is in */
+bool WeightCalib::RateToGrams(int32_t raw, int32_t rate, int32_t *grams)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (count < 2)
+    {
+        return false;
+    }
+    int64_t value = ((int64_t)rate * slope_q16[segment(raw)] + (1LL << (WEIGHT_CALIB_Q - 1))) >> WEIGHT_CALIB_Q;
+    *grams = (int32_t)constrain(value, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+    return true;
+}
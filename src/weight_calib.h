@@ -0,0 +1,52 @@
+/***********************************************************************
+ * Filename: weight_calib.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the WeightCalib class, which converts raw load cell
+ *     counts to grams. Up to WEIGHT_CALIB_POINTS_MAX points (raw count,
+ *     grams) are stored in NVS, sorted by the raw count, and the weight
+ *     is interpolated linearly between neighbouring points and
+ *     extrapolated from the end segments. The slope of each segment is
+ *     precomputed in Q16 grams per count, so the conversion is integer
+ *     only. Points are taken over ESP-NOW: the master writes the
+ *     reference load to KalibraceGramy and kalibrace_proved to
+ *     KalibraceBodu, the next measurement adds the point.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include <mutex>
+#include "Preferences.h"
+#include "parameters.h"
+
+#define WEIGHT_CALIB_Q 16
+
+typedef struct
+{
+    int32_t raw;
+    int32_t grams;
+} CalibPoint_t;
+
+class WeightCalib
+{
+private:
+    static RTC_DATA_ATTR CalibPoint_t points[WEIGHT_CALIB_POINTS_MAX];
+    static RTC_DATA_ATTR int64_t slope_q16[WEIGHT_CALIB_POINTS_MAX - 1];
+    static RTC_DATA_ATTR uint8_t count;
+    static RTC_DATA_ATTR bool loaded;
+    static Preferences store;
+    static std::mutex mutex;
+
+    static void prepare(void);
+    static void save(void);
+    static uint8_t segment(int32_t raw);
+
+public:
+    static void Init(void);
+    static bool AddPoint(int32_t raw, int32_t grams);
+    static void Clear(void);
+    static bool ToGrams(int32_t raw, int32_t *grams);
+    static bool RateToGrams(int32_t raw, int32_t rate, int32_t *grams);
+};
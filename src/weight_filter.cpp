@@ -0,0 +1,110 @@
+/***********************************************************************
+ * Filename: weight_filter.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the WeightFilter class. Time is in hours so the rate
+ *     and its noise stay in a comfortable float range. The measurement
+ *     variance is the variance of the mean reported by WeightSampler.
+ *
+ ***********************************************************************/
+
+#include "weight_filter.h"
+#include "log.h"
+
+RTC_DATA_ATTR WeightFilterState_t WeightFilter::state = {0, 0, {{0, 0}, {0, 0}}, 0, false};
+
+void WeightFilter::restart(float mass, float variance, int64_t now_us)
+{
+    state.mass = mass;
+    state.rate = 0;
+    state.P[0][0] = variance;
+    state.P[0][1] = 0;
+    state.P[1][0] = 0;
+    state.P[1][1] = WEIGHT_FILTER_RATE_VARIANCE;
+    state.time_us = now_us;
+    state.valid = true;
+}
+
+/* x = F x, P = F P F' + Q, F = [1 dt; 0 1], Q of a white noise rate change */
+void WeightFilter::predict(float dt_h)
+{
+    float q = (float)ZmenaSpotreby.Get() * ZmenaSpotreby.Get();
+    float p01 = state.P[0][1] + dt_h * state.P[1][1];
+
+    state.mass += state.rate * dt_h;
+    state.P[0][0] += dt_h * (state.P[0][1] + state.P[1][0]) + dt_h * dt_h * state.P[1][1] + q * dt_h * dt_h * dt_h / 3;
+    state.P[0][1] = p01 + q * dt_h * dt_h / 2;
+    state.P[1][0] = state.P[0][1];
+    state.P[1][1] += q * dt_h;
+}
+
+/* Returns false when the innovation is outside the gate, the state is then left untouched */
+bool WeightFilter::correct(float mass, float variance)
+{
+    float innovation = mass - state.mass;
+    float s = state.P[0][0] + variance;
+    float gate = MezSkoku_x10.Get() / 10.0f;
+    if ((innovation * innovation) > (gate * gate * s))
+    {
+        return false;
+    }
+
+    float k0 = state.P[0][0] / s;
+    float k1 = state.P[1][0] / s;
+    state.mass += k0 * innovation;
+    state.rate += k1 * innovation;
+
+    float p00 = state.P[0][0];
+    float p01 = state.P[0][1];
+    state.P[0][0] = (1 - k0) * p00;
+    state.P[0][1] = (1 - k0) * p01;
+    state.P[1][0] = state.P[0][1];
+    state.P[1][1] -= k1 * p01;
+    return true;
+}
+
+void WeightFilter::publish(void)
+{
+    FiltrovanaVaha.Set((int32_t)lroundf(state.mass));
+    SpotrebaVahy_h.Set((int32_t)lroundf(-state.rate));
+
+    /* Time to empty only when the consumption is clearly above its own uncertainty */
+    int32_t empty = VahaPrazdne.Get();
+    float consumption = -state.rate;
+    int32_t minutes = WEIGHT_FILTER_UNKNOWN;
+    if ((empty > 0) && (consumption > 2 * sqrtf(state.P[1][1])))
+    {
+        float left_m = max(state.mass - (float)empty, 0.0f) * 60 / consumption;
+        minutes = (int32_t)min(left_m, (float)INT32_MAX / 2);
+    }
+    DoVyprazdneni_M.Set(minutes);
+}
+
+void WeightFilter::Update(const WeightEstimate_t *estimate)
+{
+    int64_t now_us = TimeSync::Now_us();
+    float variance = max((float)estimate->variance / max(estimate->used, (uint8_t)1), WEIGHT_FILTER_MIN_VARIANCE);
+    float mass = (float)estimate->value;
+    float dt_h = (float)(now_us - state.time_us) / 3.6e9f;
+
+    if (!FiltrVahy.Get() || !state.valid || (dt_h <= 0) || (dt_h > WEIGHT_FILTER_MAX_GAP_H))
+    {
+        restart(mass, variance, now_us);
+    }
+    else
+    {
+        predict(dt_h);
+        if (!correct(mass, variance))
+        {
+            /* Refill or a knock, start the mass over but keep the learned consumption */
+            SystemLog::PutLog("Skok vahy, filtr restartovan");
+            state.mass = mass;
+            state.P[0][0] = variance;
+            state.P[0][1] = 0;
+            state.P[1][0] = 0;
+        }
+        state.time_us = now_us;
+    }
+    publish();
+}
@@ -0,0 +1,50 @@
+/***********************************************************************
+ * Filename: weight_filter.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the WeightFilter class, a Kalman filter over the feed
+ *     mass and its rate of change. The state is kept in RTC memory and
+ *     advanced by the real time between wakes, so the noise of single
+ *     measurements averages out over many wakes and fewer conversions
+ *     per wake are needed. The model is constant consumption, the rate
+ *     may drift by ZmenaSpotreby raw counts per hour each hour. A
+ *     measurement further than MezSkoku_x10 / 10 standard deviations
+ *     from the prediction (refill, feeder moved) restarts the mass at
+ *     the measurement and keeps the learned rate.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "parameters.h"
+#include "time_sync.h"
+#include "weight_sampler.h"
+
+#define WEIGHT_FILTER_MAX_GAP_H 24.0f        // a longer gap (or a clock jump) restarts the filter
+#define WEIGHT_FILTER_MIN_VARIANCE 1.0f      // floor of the measurement variance, raw counts squared
+#define WEIGHT_FILTER_RATE_VARIANCE 1.0e8f   // initial rate uncertainty, (raw counts / h) squared
+#define WEIGHT_FILTER_UNKNOWN -1
+
+typedef struct
+{
+    float mass;        // raw counts
+    float rate;        // raw counts per hour, negative while feed is eaten
+    float P[2][2];
+    int64_t time_us;
+    bool valid;
+} WeightFilterState_t;
+
+class WeightFilter
+{
+private:
+    static RTC_DATA_ATTR WeightFilterState_t state;
+
+    static void restart(float mass, float variance, int64_t now_us);
+    static void predict(float dt_h);
+    static bool correct(float mass, float variance);
+    static void publish(void);
+
+public:
+    static void Update(const WeightEstimate_t *estimate);
+};
@@ -0,0 +1,115 @@
+/***********************************************************************
+ * Filename: weight_sampler.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Implements the WeightSampler class. Everything is integer math,
+ *     deviations are taken from the median so the sums stay small
+ *     enough for int64 even at full scale.
+ *
+ ***********************************************************************/
+
+#include "weight_sampler.h"
+
+int32_t WeightSampler::samples[WEIGHT_SAMPLES_MAX];
+int32_t WeightSampler::sorted[WEIGHT_SAMPLES_MAX];
+
+void WeightSampler::sort(int32_t *data, uint8_t nmr)
+{
+    for (uint8_t i = 1; i < nmr; i++)
+    {
+        int32_t value = data[i];
+        int8_t j = i - 1;
+        while ((j >= 0) && (data[j] > value))
+        {
+            data[j + 1] = data[j];
+            j--;
+        }
+        data[j + 1] = value;
+    }
+}
+
+/* Rejects the outliers of the first nmr samples, returns true when the standard error target is met */
+bool WeightSampler::evaluate(uint8_t nmr, WeightEstimate_t *estimate)
+{
+    memcpy(sorted, samples, nmr * sizeof(int32_t));
+    sort(sorted, nmr);
+    int32_t median = sorted[nmr / 2];
+
+    int32_t deviation[WEIGHT_SAMPLES_MAX];
+    for (uint8_t i = 0; i < nmr; i++)
+    {
+        deviation[i] = abs(sorted[i] - median);
+    }
+    sort(deviation, nmr);
+    int64_t limit = (int64_t)deviation[nmr / 2] * MezOdlehlych_x10.Get() * WEIGHT_MAD_SIGMA_PPM / 10000000LL;
+    limit = max(limit, (int64_t)1);
+
+    /* Inliers stay sorted, first..last */
+    uint8_t first = 0;
+    uint8_t last = nmr;
+    while ((first < last) && ((median - sorted[first]) > limit))
+    {
+        first++;
+    }
+    while ((last > first) && ((sorted[last - 1] - median) > limit))
+    {
+        last--;
+    }
+    uint8_t used = last - first;
+
+    int64_t sum = 0;
+    int64_t sumSq = 0;
+    for (uint8_t i = first; i < last; i++)
+    {
+        int64_t d = sorted[i] - median;
+        sum += d;
+        sumSq += d * d;
+    }
+    int64_t variance = (used > 1) ? (sumSq - sum * sum / used) / (used - 1) : 0;
+
+    if (OdhadVahy.Get() == odhad_median)
+    {
+        estimate->value = sorted[first + used / 2];
+    }
+    else
+    {
+        uint8_t trim = used / WEIGHT_TRIM_DIV;
+        int64_t trimmed = 0;
+        for (uint8_t i = first + trim; i < last - trim; i++)
+        {
+            trimmed += sorted[i] - median;
+        }
+        estimate->value = median + (int32_t)(trimmed / (used - 2 * trim));
+    }
+    estimate->variance = (int32_t)min(variance, (int64_t)INT32_MAX);
+    estimate->used = used;
+    estimate->rejected = nmr - used;
+
+    /* Standard error of the mean below the target, variance / n <= target^2 */
+    int64_t target = CilovaChybaVahy.Get();
+    return (target > 0) && (used >= WEIGHT_SAMPLES_MIN) && (variance <= target * target * used);
+}
+
+bool WeightSampler::Run(WeightEstimate_t *estimate)
+{
+    uint8_t count = constrain(PocetVzorku.Get(), WEIGHT_SAMPLES_MIN, WEIGHT_SAMPLES_MAX);
+    uint8_t nmr = 0;
+    while (nmr < count)
+    {
+        if (!LoadCell::Read(Channel_A_gain_64, &samples[nmr]))
+        {
+            return false;
+        }
+        nmr++;
+        if ((nmr >= WEIGHT_SAMPLES_MIN) && evaluate(nmr, estimate))
+        {
+            break;
+        }
+    }
+
+    RozptylVahy.Set(estimate->variance);
+    PouziteVzorky.Set(estimate->used);
+    OdlehleVzorky.Set(estimate->rejected);
+    return true;
+}
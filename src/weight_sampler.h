@@ -0,0 +1,44 @@
+/***********************************************************************
+ * Filename: weight_sampler.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Declares the WeightSampler class, which turns a series of HX711
+ *     conversions into one weight value. Up to PocetVzorku conversions
+ *     are taken, samples further than MezOdlehlych_x10 / 10 robust
+ *     standard deviations (scaled MAD) from the median are rejected,
+ *     and the value is the median or the trimmed mean of the rest
+ *     (OdhadVahy). Sampling stops early once the standard error of the
+ *     mean drops below CilovaChybaVahy raw counts. The sample variance
+ *     is published in RozptylVahy as a quality indicator.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+#include "parameters.h"
+#include "load_cell.h"
+
+#define WEIGHT_TRIM_DIV 5          // trimmed mean drops 1/5 of the inliers at each end
+#define WEIGHT_MAD_SIGMA_PPM 1482600 // MAD to standard deviation of a normal distribution
+
+typedef struct
+{
+    int32_t value;
+    int32_t variance; // raw counts squared, saturated
+    uint8_t used;
+    uint8_t rejected;
+} WeightEstimate_t;
+
+class WeightSampler
+{
+private:
+    static int32_t samples[WEIGHT_SAMPLES_MAX];
+    static int32_t sorted[WEIGHT_SAMPLES_MAX];
+
+    static void sort(int32_t *data, uint8_t nmr);
+    static bool evaluate(uint8_t nmr, WeightEstimate_t *estimate);
+
+public:
+    static bool Run(WeightEstimate_t *estimate);
+};
@@ -0,0 +1,279 @@
+/***********************************************************************
+ * Filename: delta_gen.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Builds the delta patches the emulated gateway sends, in the
+ *     format DeltaPatch of the firmware applies (see delta_patch.h):
+ *     the KDP1 header with the SHA-256 of the source and a heatshrink
+ *     compressed body of diff/extra/seek entries. The diff is a greedy
+ *     bsdiff: matches are found through an index of 8-byte blocks of
+ *     the source and run on across short changed spans, the bytes
+ *     between the matches go to the extra data. The heatshrink encoder
+ *     is a plain greedy one searching the whole window. Also builds
+ *     the target images: the source with bytes changed in place,
+ *     blocks inserted, removed and moved, like a rebuilt firmware.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+#include "mbedtls/sha256.h"
+
+#define DELTA_GEN_MAGIC "KDP1"
+#define DELTA_GEN_HEADER_SIZE 48
+#define DELTA_GEN_WINDOW_SZ2 10
+#define DELTA_GEN_LOOKAHEAD_SZ2 8
+#define DELTA_GEN_BLOCK 8     // bytes of the source index, also the shortest match
+#define DELTA_GEN_BRIDGE 8    // changed bytes a match runs on across
+#define DELTA_GEN_MIN_BACKREF 2
+
+class DeltaGen
+{
+private:
+    typedef struct
+    {
+        uint32_t target;
+        uint32_t source;
+        uint32_t len;
+    } Match_t;
+
+    class BitWriter
+    {
+    public:
+        std::vector<uint8_t> &out;
+        uint32_t acc;
+        uint8_t cnt;
+
+        explicit BitWriter(std::vector<uint8_t> &buf) : out(buf), acc(0), cnt(0) {}
+
+        void Put(uint32_t value, uint8_t bits)
+        {
+            while (bits > 0)
+            {
+                bits--;
+                acc = (acc << 1) | ((value >> bits) & 1);
+                if (++cnt == 8)
+                {
+                    out.push_back((uint8_t)acc);
+                    acc = 0;
+                    cnt = 0;
+                }
+            }
+        }
+
+        /* The decoder ignores the zero bits after the last entry */
+        void Flush(void)
+        {
+            if (cnt > 0)
+            {
+                out.push_back((uint8_t)(acc << (8 - cnt)));
+                acc = 0;
+                cnt = 0;
+            }
+        }
+    };
+
+    static uint64_t block(const uint8_t *p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void putVarint(std::vector<uint8_t> &out, uint32_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    static void putEntry(std::vector<uint8_t> &out, const std::vector<uint8_t> &src, const std::vector<uint8_t> &tgt, uint32_t diffAt,
+                         uint32_t sourceAt, uint32_t diffLen, uint32_t extraLen, int32_t seek)
+    {
+        putVarint(out, diffLen);
+        putVarint(out, extraLen);
+        putVarint(out, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+        for (uint32_t i = 0; i < diffLen; i++)
+        {
+            out.push_back((uint8_t)(tgt[diffAt + i] - src[sourceAt + i]));
+        }
+        out.insert(out.end(), tgt.begin() + diffAt + diffLen, tgt.begin() + diffAt + diffLen + extraLen);
+    }
+
+    static std::vector<Match_t> findMatches(const std::vector<uint8_t> &src, const std::vector<uint8_t> &tgt)
+    {
+        std::unordered_map<uint64_t, uint32_t> index;
+        for (uint32_t i = 0; (i + DELTA_GEN_BLOCK) <= src.size(); i++)
+        {
+            index.insert(std::make_pair(block(&src[i]), i));
+        }
+
+        std::vector<Match_t> matches;
+        uint32_t t = 0;
+        while ((t + DELTA_GEN_BLOCK) <= tgt.size())
+        {
+            std::unordered_map<uint64_t, uint32_t>::const_iterator it = index.find(block(&tgt[t]));
+            if (it == index.end())
+            {
+                t++;
+                continue;
+            }
+            uint32_t s = it->second;
+            uint32_t len = 0;
+            while (true)
+            {
+                while (((t + len) < tgt.size()) && ((s + len) < src.size()) && (tgt[t + len] == src[s + len]))
+                {
+                    len++;
+                }
+                /* A few changed bytes inside a match cost less as diff bytes than as a new entry */
+                uint32_t gap = 1;
+                while ((gap <= DELTA_GEN_BRIDGE) && !(((t + len + gap + DELTA_GEN_BLOCK) <= tgt.size()) && ((s + len + gap + DELTA_GEN_BLOCK) <= src.size()) &&
+                                                      (memcmp(&tgt[t + len + gap], &src[s + len + gap], DELTA_GEN_BLOCK) == 0)))
+                {
+                    gap++;
+                }
+                if (gap > DELTA_GEN_BRIDGE)
+                {
+                    break;
+                }
+                len += gap;
+            }
+            Match_t match = {t, s, len};
+            matches.push_back(match);
+            t += len;
+        }
+        return matches;
+    }
+
+    static std::vector<uint8_t> compress(const std::vector<uint8_t> &in)
+    {
+        const uint32_t window = 1UL << DELTA_GEN_WINDOW_SZ2;
+        const uint32_t lookahead = 1UL << DELTA_GEN_LOOKAHEAD_SZ2;
+        std::vector<uint8_t> out;
+        BitWriter bits(out);
+        uint32_t i = 0;
+        while (i < in.size())
+        {
+            uint32_t bestLen = 0;
+            uint32_t bestDist = 0;
+            uint32_t maxLen = std::min<uint32_t>(lookahead, in.size() - i);
+            for (uint32_t dist = 1; (dist <= window) && (dist <= i) && (bestLen < maxLen); dist++)
+            {
+                uint32_t len = 0;
+                while ((len < maxLen) && (in[i + len] == in[i + len - dist]))
+                {
+                    len++;
+                }
+                if (len > bestLen)
+                {
+                    bestLen = len;
+                    bestDist = dist;
+                }
+            }
+            if (bestLen >= DELTA_GEN_MIN_BACKREF)
+            {
+                bits.Put(0, 1);
+                bits.Put(bestDist - 1, DELTA_GEN_WINDOW_SZ2);
+                bits.Put(bestLen - 1, DELTA_GEN_LOOKAHEAD_SZ2);
+                i += bestLen;
+            }
+            else
+            {
+                bits.Put(1, 1);
+                bits.Put(in[i], 8);
+                i++;
+            }
+        }
+        bits.Flush();
+        return out;
+    }
+
+public:
+    /* Patch turning src into tgt */
+    static std::vector<uint8_t> Make(const std::vector<uint8_t> &src, const std::vector<uint8_t> &tgt)
+    {
+        std::vector<Match_t> matches = findMatches(src, tgt);
+        std::vector<uint8_t> body;
+        uint32_t sourcePos = 0;
+        uint32_t t = 0;
+        if (matches.empty() || (matches[0].target > 0))
+        {
+            /* The target starts with new data */
+            uint32_t extra = matches.empty() ? tgt.size() : matches[0].target;
+            int32_t seek = matches.empty() ? 0 : (int32_t)matches[0].source;
+            putEntry(body, src, tgt, 0, 0, 0, extra, seek);
+            sourcePos += seek;
+            t = extra;
+        }
+        for (size_t k = 0; k < matches.size(); k++)
+        {
+            const Match_t &m = matches[k];
+            uint32_t end = (k + 1 < matches.size()) ? matches[k + 1].target : tgt.size();
+            int32_t seek = (k + 1 < matches.size()) ? (int32_t)(matches[k + 1].source - (m.source + m.len)) : 0;
+            putEntry(body, src, tgt, t, sourcePos, m.len, end - (m.target + m.len), seek);
+            sourcePos = m.source + m.len + seek;
+            t = end;
+        }
+
+        std::vector<uint8_t> patch(DELTA_GEN_HEADER_SIZE, 0);
+        uint32_t sourceSize = src.size();
+        uint32_t targetSize = tgt.size();
+        memcpy(&patch[0], DELTA_GEN_MAGIC, 4);
+        memcpy(&patch[4], &sourceSize, sizeof(sourceSize));
+        memcpy(&patch[8], &targetSize, sizeof(targetSize));
+        patch[12] = DELTA_GEN_WINDOW_SZ2;
+        patch[13] = DELTA_GEN_LOOKAHEAD_SZ2;
+        mbedtls_sha256(src.data(), src.size(), &patch[16], 0);
+        std::vector<uint8_t> packed = compress(body);
+        patch.insert(patch.end(), packed.begin(), packed.end());
+        return patch;
+    }
+
+    /* A rebuilt firmware: bytes changed in place, code inserted, removed and moved */
+    static std::vector<uint8_t> Mutate(const std::vector<uint8_t> &src, std::mt19937 &rng)
+    {
+        std::vector<uint8_t> tgt = src;
+        for (int i = 0; i < 200; i++)
+        {
+            size_t at = rng() % tgt.size();
+            size_t len = 1 + rng() % 4;
+            for (size_t k = 0; (k < len) && ((at + k) < tgt.size()); k++)
+            {
+                tgt[at + k] = (uint8_t)rng();
+            }
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            size_t at = rng() % tgt.size();
+            std::vector<uint8_t> code(256 + rng() % 2048);
+            for (size_t k = 0; k < code.size(); k++)
+            {
+                code[k] = (uint8_t)rng();
+            }
+            tgt.insert(tgt.begin() + at, code.begin(), code.end());
+        }
+        for (int i = 0; i < 4; i++)
+        {
+            size_t len = 256 + rng() % 2048;
+            size_t at = rng() % (tgt.size() - len);
+            tgt.erase(tgt.begin() + at, tgt.begin() + at + len);
+        }
+        size_t len = 4096 + rng() % 8192;
+        size_t from = rng() % (tgt.size() - len);
+        std::vector<uint8_t> moved(tgt.begin() + from, tgt.begin() + from + len);
+        tgt.erase(tgt.begin() + from, tgt.begin() + from + len);
+        size_t to = rng() % tgt.size();
+        tgt.insert(tgt.begin() + to, moved.begin(), moved.end());
+        return tgt;
+    }
+};
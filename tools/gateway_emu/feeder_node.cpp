@@ -0,0 +1,223 @@
+/***********************************************************************
+ * Filename: feeder_node.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Entry of the feeder firmware in the emulator, the part of
+ *     main.cpp that drives the radio: setup, the ESP-NOW, log and
+ *     sleep tasks and the long press that starts pairing are kept as
+ *     they are. The motor, the load cell and the buttons are not
+ *     emulated, the feeder control and the weight task are replaced by
+ *     stand-ins that move the door on a command after a travel time
+ *     and report the reading of the emulated scale.
+ *
+ ***********************************************************************/
+
+#include <Arduino.h>
+#include "parameters.h"
+#include "log.h"
+#include "feeder_ctrl.h"
+#include "common.h"
+#include <LittleFS.h>
+#include "esp_now_client.h"
+#include "time_sync.h"
+#include "byte_stream.h"
+#include "file_service.h"
+#include "event_push.h"
+#include "telemetry_batch.h"
+#include "deep_sleep_ctrl.h"
+#include "weight.h"
+#include "host_node.h"
+
+#define NODE_DOOR_TRAVEL_MS 4000 // open or close with the motor at the nominal current
+#define NODE_MEASURE_MS 450      // HX711 power up and settling at 10 SPS
+#define NODE_PAIRING_WINDOW_MS 60000
+
+Weight weight;
+std::atomic<uint32_t> FeederCtrl::events; // feeder_ctrl.cpp drives the motor, it is not built here
+
+extern "C" char __start_rtc_data[];
+extern "C" char __stop_rtc_data[];
+
+static uint32_t pairingSince;
+
+void FeederControlTask(void *pvParameters)
+{
+  while (true)
+  {
+    if (active_tasks[Position_Task])
+    {
+      delay(NODE_DOOR_TRAVEL_MS);
+      switch (ManualniOvladani.Get())
+      {
+      case manual_otevrit:
+        StavKrmitka.Set(Otevreno);
+        break;
+      case manual_zavrit:
+        StavKrmitka.Set(Zavreno);
+        break;
+      default:
+        break;
+      }
+      EventPush::Changed();
+      active_tasks[Position_Task] = false;
+    }
+    delay(FEEDER_CONTROL_TASK_PERIOD_MS);
+  }
+}
+
+void SystemLogTask(void *pvParameters)
+{
+  while (true)
+  {
+    SystemLog::Task();
+
+    delay(200);
+  }
+}
+
+void ESPNowTask(void *pvParameters)
+{
+  while (true)
+  {
+    ESPNowCtrl::Task();
+  }
+}
+
+void ESPNowSlaveTask(void *pvParameters)
+{
+  if (!TelemetryBatch::RadioNeeded())
+  {
+    /* Nothing new to report, Wi-Fi stays off unless the state changes during this wake */
+    active_tasks[Communication_Task] = false;
+    EventPush::SetHook(TelemetryBatch::RequestRadio);
+    if (!EventPush::Pending())
+    {
+      TelemetryBatch::WaitForRadio();
+    }
+  }
+  ESPNowClient::Init();
+  xTaskCreateUniversal(ESPNowTask, "espNowTask", getArduinoLoopTaskStackSize(), NULL, 5, NULL, ARDUINO_RUNNING_CORE);
+  while (true)
+  {
+    ESPNowClient::Task();
+  }
+}
+
+void CommandProcessingTask(void *pvParameters)
+{
+  while (true)
+  {
+    active_tasks[Write_Command_Task] = true;
+    delay(NODE_MEASURE_MS);
+    AktualniVaha.Set(HostScale());
+    TelemetryBatch::Measured();
+    active_tasks[Write_Command_Task] = false;
+    xSemaphoreTake(write_cmd_sem, pdMS_TO_TICKS(1000));
+  }
+}
+
+void SleepTask(void *pvParameters)
+{
+  while (true)
+  {
+    if (IsSystemIdle())
+    {
+      vTaskSuspendAll();
+      for (int i = 0; i < NUMBER_TASK_HANDLES; i++)
+      {
+        if (active_task_handle[i] != 0)
+        {
+          vTaskDelete(active_task_handle[i]);
+        }
+      }
+      xTaskResumeAll();
+      Register::Sleep();
+      ByteStream::Sleep(); // closes its files before SystemLog unmounts LittleFS
+      SystemLog::Sleep();
+      if (RestartCmd.Get() == povoleno)
+      {
+        ESP.restart();
+      }
+      else
+      {
+        int64_t wakeAt_us = TimeSync::NextWake_us(PeriodaKomunikace_S.Get());
+        ESPNowClient::Sleep(wakeAt_us);
+        esp_sleep_enable_timer_wakeup(TimeSync::SleepDuration_us(wakeAt_us));
+        esp_deep_sleep_start();
+      }
+    }
+    delay(10);
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  Register::InitAll();
+  storageFS.begin(true, "/storage", 5);
+
+  SystemLog::Init();
+  active_tasks[Communication_Task] = true; // the radio is started by the client task
+  TimeSync::Init();
+  EventPush::Init();
+  OtaCtrl::Init();
+  ByteStream::Init();
+  FileService::Init();
+  active_tasks[Button_Task] = false;
+
+  switch (HostResetReason())
+  {
+  case NODE_RESET_POWERON:
+    ResetReason.Set(rst_Poweron);
+    break;
+  case NODE_RESET_SOFTWARE:
+    ResetReason.Set(rst_Software);
+    break;
+  case NODE_RESET_DEEPSLEEP:
+    ResetReason.Set(rst_Deepsleep);
+    break;
+  default:
+    ResetReason.Set(rst_Unknown);
+  }
+
+  memset(active_task_handle, 0, sizeof(active_task_handle));
+
+  xTaskCreateUniversal(FeederControlTask, "feederCtrlTask", getArduinoLoopTaskStackSize(), NULL, 2, &active_task_handle[1], ARDUINO_RUNNING_CORE);
+  xTaskCreateUniversal(SystemLogTask, "logTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[3], ARDUINO_RUNNING_CORE);
+  xTaskCreateUniversal(CommandProcessingTask, "cmdTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[4], ARDUINO_RUNNING_CORE);
+  xTaskCreateUniversal(ESPNowSlaveTask, "espNowSlaveTask", getArduinoLoopTaskStackSize(), NULL, 1, &active_task_handle[6], ARDUINO_RUNNING_CORE);
+  xTaskCreateUniversal(SleepTask, "sleepTask", getArduinoLoopTaskStackSize(), NULL, 1, NULL, ARDUINO_RUNNING_CORE);
+}
+
+void loop()
+{
+  if (HostPairButton())
+  {
+    active_tasks[Button_Task] = true;
+    pairingSince = millis();
+    ESPNowClient::StartPairing();
+  }
+
+  if (active_tasks[Button_Task] && ((millis() - pairingSince) >= NODE_PAIRING_WINDOW_MS))
+  {
+    active_tasks[Button_Task] = false;
+  }
+  delay(COMMON_LOOP_TASK_PERIOD_MS);
+}
+
+/* Arduino loop task */
+extern "C" void NodeMain(void *param)
+{
+  setup();
+  while (true)
+  {
+    loop();
+  }
+}
+
+extern "C" void NodeRtcMemory(uint8_t **start, size_t *size)
+{
+  *start = (uint8_t *)__start_rtc_data;
+  *size = __stop_rtc_data - __start_rtc_data;
+}
@@ -0,0 +1,1368 @@
+/***********************************************************************
+ * Filename: gateway_emu.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the coop door gateway, run against the feeder
+ *     firmware. The ESP-NOW stack of the feeder (ESPNowCtrl,
+ *     ESPNowTxn, the client, OTA, byte streams, the file service, logs
+ *     and time sync) is built unchanged into libfeeder.so and loaded at
+ *     every wake, the radio and flash calls go to the shims in host/.
+ *     The gateway answers discovery and pairing, serves time sync,
+ *     takes the upload, events and telemetry batches, and after the
+ *     feeder's transmit done runs the session planned for the wake:
+ *     door commands, reads, the file list and a byte stream read of
+ *     the log, the windowed OTA of a full image or of a delta patch
+ *     (delta_gen.h). It ends the session with its own transmit done,
+ *     the feeder then goes to sleep on its own. The benchmark reports
+ *     frames, bytes and airtime per wake and per OTA.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "sim_link.h"
+#include "delta_gen.h"
+#include "mbedtls/sha256.h"
+
+#define EMU_LIBRARY "./libfeeder.so"
+#define EMU_WAKE_LIMIT_S 300     // the pairing wake stays up for the pairing window
+#define EMU_OTA_LIMIT_S 3600
+#define EMU_FIRMWARE_SIZE 921600 // running image the feeder boots first
+#define EMU_EPOCH_S 1790000000   // gateway time at the start of the emulation
+#define EMU_TIMEZONE "CET-1CEST,M3.5.0,M10.5.0/3"
+#define EMU_SUNRISE_S (6 * 3600 + 30 * 60)
+#define EMU_SUNSET_S (18 * 3600 + 45 * 60)
+#define EMU_SCALE_RAW 84210
+#define EMU_RESPONSE_TIMEOUT_MS 1000 // read, list and stream steps ask again after this silence
+#define EMU_STEP_TRIES 5
+#define EMU_STREAM_ID 1
+#define EMU_STREAM_WINDOW 8
+#define EMU_OTA_GAP_MS 20        // a chunk missing behind a received one is sent again after this time
+#define EMU_OTA_CHUNK_RETRIES 2  // the window is resent on the ack timeout anyway
+#define EMU_OTA_TIMEOUTS 20      // ack timeouts in a row before the update is given up
+
+/* Registers of the feeder, parameters_table.h */
+#define REG_STAV_KRMITKA 2
+#define REG_MANUALNI_OVLADANI 3
+#define REG_DAVKA_PROBUZENI 205
+#define READ_REGS 6 // StavKrmitka .. AktualniVaha
+#define DOOR_OPEN 2   // Otevreno
+#define DOOR_CLOSED 6 // Zavreno
+#define MANUAL_OPEN 1
+#define MANUAL_CLOSE 2
+
+/* Byte stream framing, byte_stream.h */
+#define STREAM_HEADER_SIZE offsetof(ByteStreamPayload, data.data)
+#define STREAM_CHUNK_SIZE sizeof(((ByteStreamPayload *)0)->data.data)
+#define STREAM_RES_FILE 0
+#define STREAM_OP(type) ((type) & 0x0F)
+#define STREAM_ID(type) ((type) >> 4)
+#define STREAM_TYPE(op, id) ((uint8_t)(((id) << 4) | (op)))
+
+/* Duplicate window of the feeder frames, the same as ESPNowCtrl keeps */
+#define GW_SEQ_WINDOW_SIZE 32
+#define GW_SEQ_WINDOW_TIMEOUT_S 30
+#define GW_SEQ_SPACE 255
+
+#define CHUNK_SENT 0x01
+#define CHUNK_QUEUED 0x02
+#define CHUNK_GOT 0x04
+
+typedef struct
+{
+    uint32_t wakes;
+    uint32_t commands; // door commands per radio wake
+    uint32_t reads;    // read requests per radio wake
+    uint16_t batch;    // DavkaProbuzeni written at the first wake, 0 = kept
+    bool files;        // list the root and read the files at the last wake
+    uint32_t otaSize;  // 0 = no OTA
+    bool delta;        // OTA of a rebuilt running image sent as a delta patch
+    uint16_t slot;
+    uint8_t channel;
+    double drift_ppm;
+    uint32_t seed;
+    const char *library;
+    bool serial;
+    bool verbose;
+} EmuConfig_t;
+
+typedef enum
+{
+    STEP_WRITE = 0,
+    STEP_READ,
+    STEP_LIST,
+    STEP_STREAM,
+    STEP_OTA,
+} StepType_t;
+
+typedef struct
+{
+    StepType_t type;
+    uint16_t reg;
+    int16_t value;
+    uint16_t nmr;
+    std::string path;
+} Step_t;
+
+typedef enum
+{
+    OTA_IDLE = 0,
+    OTA_INFO,
+    OTA_DATA,
+    OTA_DONE,
+    OTA_FAILED,
+} OtaState_t;
+
+typedef struct
+{
+    uint32_t discoveries;
+    uint32_t pairings;
+    uint32_t defs;
+    uint32_t values;
+    uint32_t samples;
+    uint32_t events;
+    uint32_t logRecords;
+    uint32_t timeSyncs;
+    uint32_t sleeps;
+    uint32_t writes;
+    uint32_t reads;
+    uint32_t files;
+    uint32_t streamBytes;
+    uint32_t streamReopens;
+    uint32_t failedSteps;
+    uint32_t dropped;
+    uint32_t duplicates;
+    uint32_t invalid;
+} GatewayStats_t;
+
+class Gateway : public SimStation
+{
+private:
+    typedef struct
+    {
+        uint8_t dst[6];
+        Message msg;
+        uint8_t attempt;
+        uint8_t retries;
+        std::function<void(bool)> done;
+    } GatewayTx_t;
+
+    SimLink &link;
+    const EmuConfig_t &cfg;
+    uint8_t mac[6];
+    uint8_t node[6];
+    bool paired;
+
+    std::deque<GatewayTx_t> txq;
+    bool txBusy;
+    uint32_t txGeneration; // completions of frames flushed at the end of a wake are dropped
+    uint8_t txSeq;
+
+    uint8_t rxTop;
+    uint32_t rxSeen;
+    int64_t rxTime_us;
+    bool eventSeen;
+    uint16_t eventSeq;
+    uint32_t logNext;
+
+    std::deque<Step_t> wakeSteps; // commands and reads of this wake
+    std::deque<Step_t> jobs;      // files and OTA, kept until a wake with the radio up runs them
+    Step_t step;
+    bool stepActive;
+    bool stepIsJob;
+    uint8_t stepTries;
+    uint32_t timer; // a newer timeout cancels the older one
+
+    /* List and stream steps */
+    uint16_t listNext;
+    std::vector<std::string> listed;
+    std::vector<uint8_t> streamData;
+    uint32_t streamEnd;
+    uint8_t streamSinceCredit;
+    uint32_t streamRewound;
+
+    /* OTA sender */
+    std::vector<uint8_t> otaImage; // sent image, the patch for a delta update
+    UpdateInfoPayload otaInfo;     // of the image the feeder ends up with
+    bool otaDelta;
+    uint32_t otaOffset;
+    uint32_t otaChunks;
+    std::vector<uint8_t> otaFlags;
+    std::vector<int64_t> otaSentAt;
+    uint32_t otaTimeouts;
+
+    bool duplicate(uint8_t seq)
+    {
+        if (seq == 0)
+        {
+            return false;
+        }
+        int64_t now = HostNow_us();
+        int16_t diff = ((int16_t)seq - rxTop + GW_SEQ_SPACE) % GW_SEQ_SPACE;
+        if (diff > (GW_SEQ_SPACE / 2))
+        {
+            diff -= GW_SEQ_SPACE;
+        }
+        bool dup = false;
+        if ((rxTop == 0) || ((now - rxTime_us) > GW_SEQ_WINDOW_TIMEOUT_S * 1000000LL) || (diff <= -GW_SEQ_WINDOW_SIZE))
+        {
+            rxTop = seq;
+            rxSeen = 1;
+        }
+        else if (diff > 0)
+        {
+            rxSeen = (diff >= GW_SEQ_WINDOW_SIZE) ? 1 : ((rxSeen << diff) | 1);
+            rxTop = seq;
+        }
+        else
+        {
+            dup = (rxSeen & (1UL << -diff)) != 0;
+            rxSeen |= 1UL << -diff;
+        }
+        rxTime_us = now;
+        return dup;
+    }
+
+    void send(const uint8_t *dst, uint8_t type, const void *payload, size_t size, uint8_t retries = COMMUNICATION_RETRIES,
+              std::function<void(bool)> done = NULL)
+    {
+        GatewayTx_t tx;
+        memcpy(tx.dst, dst, 6);
+        tx.msg.messageType = type;
+        tx.msg.payloadSize = (uint8_t)size;
+        txSeq = (txSeq >= GW_SEQ_SPACE) ? 1 : txSeq + 1;
+        tx.msg.seq = txSeq;
+        if (size > 0)
+        {
+            memcpy(tx.msg.payload, payload, size);
+        }
+        tx.attempt = 0;
+        tx.retries = retries;
+        tx.done = done;
+        txq.push_back(tx);
+        startTx();
+    }
+
+    void send(uint8_t type, const void *payload, size_t size, uint8_t retries = COMMUNICATION_RETRIES, std::function<void(bool)> done = NULL)
+    {
+        send(node, type, payload, size, retries, done);
+    }
+
+    void startTx(void)
+    {
+        if (txBusy || txq.empty())
+        {
+            return;
+        }
+        txBusy = true;
+        uint32_t gen = txGeneration;
+        const GatewayTx_t &tx = txq.front();
+        link.Transmit(SIM_GATEWAY, tx.dst, cfg.channel, (const uint8_t *)&tx.msg, MESSAGE_HEADER_SIZE + tx.msg.payloadSize,
+                      [this, gen](bool acked) { txDone(gen, acked); });
+    }
+
+    void txDone(uint32_t gen, bool acked)
+    {
+        if (gen != txGeneration)
+        {
+            return;
+        }
+        GatewayTx_t &tx = txq.front();
+        if (!acked && (++tx.attempt < tx.retries))
+        {
+            /* The same frame with the same seq, as ESPNowTxn retries */
+            HostAt(HostNow_us() + TXN_RETRY_DELAY_MS * 1000LL, [this, gen]() {
+                if (gen == txGeneration)
+                {
+                    txBusy = false;
+                    startTx();
+                }
+            });
+            return;
+        }
+        if (!acked)
+        {
+            stats.dropped++;
+        }
+        std::function<void(bool)> done = tx.done;
+        txq.pop_front();
+        txBusy = false;
+        if (done)
+        {
+            done(acked);
+        }
+        startTx();
+    }
+
+    void arm(uint32_t timeout_ms)
+    {
+        uint32_t gen = ++timer;
+        HostAt(HostNow_us() + timeout_ms * 1000LL, [this, gen]() {
+            if (gen == timer)
+            {
+                onTimeout();
+            }
+        });
+    }
+
+    void disarm(void)
+    {
+        timer++;
+    }
+
+    /* Session */
+    void runNext(void)
+    {
+        disarm();
+        stepActive = false;
+        std::deque<Step_t> &from = !wakeSteps.empty() ? wakeSteps : jobs;
+        if (from.empty())
+        {
+            TransmitDonePayload done;
+            done.linger_ms = 0;
+            send(MSG_TRANSMIT_DONE, &done, sizeof(done));
+            return;
+        }
+        stepIsJob = wakeSteps.empty();
+        step = from.front();
+        from.pop_front();
+        stepActive = true;
+        stepTries = 0;
+        startStep();
+    }
+
+    void stepFailed(void)
+    {
+        stats.failedSteps++;
+        if (cfg.verbose)
+        {
+            printf("%10.3f  gateway: step %d failed\n", HostNow_us() / 1e6, (int)step.type);
+        }
+        runNext();
+    }
+
+    void startStep(void)
+    {
+        switch (step.type)
+        {
+        case STEP_WRITE:
+        {
+            WriteRequestPayload request;
+            request.regAddr = step.reg;
+            request.nmr = 1;
+            request.values[0] = step.value;
+            send(MSG_WRITE_PARAM_REQUEST, &request, WriteRequestPayloadSize(1), COMMUNICATION_RETRIES, [this](bool acked) {
+                if (!acked)
+                {
+                    stepFailed();
+                    return;
+                }
+                stats.writes++;
+                if (step.reg == REG_MANUALNI_OVLADANI)
+                {
+                    LastCommand = step.value;
+                }
+                runNext();
+            });
+            break;
+        }
+        case STEP_READ:
+        {
+            ReadRequestPayload request;
+            request.regAddr = step.reg;
+            request.nmr = step.nmr;
+            send(MSG_READ_PARAM_REQUEST, &request, sizeof(request));
+            arm(EMU_RESPONSE_TIMEOUT_MS);
+            break;
+        }
+        case STEP_LIST:
+            if (stepTries == 0)
+            {
+                listNext = 0;
+                listed.clear();
+            }
+            sendList();
+            break;
+        case STEP_STREAM:
+            if (stepTries == 0)
+            {
+                streamData.clear();
+            }
+            openStream();
+            break;
+        case STEP_OTA:
+            otaStart_us = HostNow_us();
+            otaLinkStart = link.stats;
+            otaResent = 0;
+            otaTimeouts = 0;
+            otaOffset = 0;
+            otaFlags.assign(otaChunks, 0);
+            otaSentAt.assign(otaChunks, 0);
+            otaState = OTA_INFO;
+            sendInfo();
+            break;
+        default:
+            runNext();
+            break;
+        }
+    }
+
+    void onTimeout(void)
+    {
+        if (!stepActive)
+        {
+            return;
+        }
+        if (step.type == STEP_OTA)
+        {
+            otaTimeout();
+            return;
+        }
+        if (++stepTries >= EMU_STEP_TRIES)
+        {
+            stepFailed();
+            return;
+        }
+        switch (step.type)
+        {
+        case STEP_READ:
+        case STEP_LIST:
+            startStep();
+            break;
+        case STEP_STREAM:
+            stats.streamReopens++;
+            openStream();
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* File list and the byte stream read of a file */
+    void sendList(void)
+    {
+        FileRequestPayload request;
+        request.op = FILE_OP_LIST;
+        request.start = listNext;
+        size_t len = step.path.size();
+        memcpy(request.path, step.path.c_str(), len);
+        send(MSG_FILE_REQUEST, &request, offsetof(FileRequestPayload, path) + len);
+        arm(EMU_RESPONSE_TIMEOUT_MS);
+    }
+
+    void onFileResponse(const FileResponsePayload *response, uint8_t payloadSize)
+    {
+        if (!stepActive || (step.type != STEP_LIST) || (response->op != FILE_OP_LIST) || (response->index != listNext))
+        {
+            return;
+        }
+        if (response->status != FILE_STATUS_OK)
+        {
+            stepFailed();
+            return;
+        }
+        size_t used = 0;
+        size_t size = payloadSize - offsetof(FileResponsePayload, data);
+        for (uint8_t i = 0; (i < response->nmr) && ((used + sizeof(FileEntryHeader)) <= size); i++)
+        {
+            const FileEntryHeader *entry = (const FileEntryHeader *)&response->data[used];
+            if (cfg.verbose)
+            {
+                printf("%10.3f  gateway: %.*s%s %u B\n", HostNow_us() / 1e6, (int)entry->nameLen, (const char *)(entry + 1),
+                       (entry->flags & FILE_ENTRY_DIR) ? "/" : "", (unsigned)entry->size);
+            }
+            if (!(entry->flags & FILE_ENTRY_DIR))
+            {
+                std::string dir = (step.path == "/") ? step.path : step.path + "/";
+                listed.push_back(dir + std::string((const char *)(entry + 1), entry->nameLen));
+            }
+            used += sizeof(FileEntryHeader) + entry->nameLen;
+            stats.files++;
+            listNext++;
+        }
+        if (response->last)
+        {
+            /* Every file listed is read next */
+            for (size_t i = listed.size(); i > 0; i--)
+            {
+                Step_t read = step;
+                read.type = STEP_STREAM;
+                read.path = listed[i - 1];
+                jobs.push_front(read);
+            }
+            runNext();
+            return;
+        }
+        arm(EMU_RESPONSE_TIMEOUT_MS);
+    }
+
+    void streamReply(ByteStreamOp_t op, uint32_t index, uint32_t bytes)
+    {
+        ByteStreamPayload frame;
+        frame.max_mr_bytes = bytes;
+        frame.type = STREAM_TYPE(op, EMU_STREAM_ID);
+        frame.data.index = index;
+        frame.data.nmr = 0;
+        send(MSG_BYTE_STREAM, &frame, STREAM_HEADER_SIZE);
+    }
+
+    void openStream(void)
+    {
+        ByteStreamPayload frame;
+        ByteStreamOpenPayload *open = (ByteStreamOpenPayload *)frame.data.data;
+        size_t len = step.path.size();
+        frame.max_mr_bytes = 0;
+        frame.type = STREAM_TYPE(BS_OP_OPEN, EMU_STREAM_ID);
+        frame.data.index = streamData.size();
+        frame.data.nmr = offsetof(ByteStreamOpenPayload, name) + len;
+        open->resource = STREAM_RES_FILE;
+        open->flags = 0;
+        open->window = EMU_STREAM_WINDOW;
+        memcpy(open->name, step.path.c_str(), len);
+        streamSinceCredit = 0;
+        streamRewound = UINT32_MAX;
+        send(MSG_BYTE_STREAM, &frame, STREAM_HEADER_SIZE + frame.data.nmr);
+        arm(EMU_RESPONSE_TIMEOUT_MS);
+    }
+
+    void streamDone(void)
+    {
+        /* The log only grows during the wake, what came must be the start of the file */
+        std::vector<uint8_t> file;
+        if (!HostReadFile(step.path.c_str(), file) || (file.size() < streamData.size()) || !std::equal(streamData.begin(), streamData.end(), file.begin()))
+        {
+            printf("stream     %s does not match the file of the feeder\n", step.path.c_str());
+            stepFailed();
+            return;
+        }
+        stats.streamBytes += streamData.size();
+        runNext();
+    }
+
+    void onStream(const ByteStreamPayload *frame, uint8_t payloadSize)
+    {
+        if (!stepActive || (step.type != STEP_STREAM) || (STREAM_ID(frame->type) != EMU_STREAM_ID) || (frame->data.nmr > (payloadSize - STREAM_HEADER_SIZE)))
+        {
+            return;
+        }
+        uint32_t next = streamData.size();
+        switch (STREAM_OP(frame->type))
+        {
+        case BS_OP_OPEN_ACK:
+            if ((frame->data.nmr > 0) && (frame->data.data[0] != BS_STATUS_OK))
+            {
+                stepFailed();
+                return;
+            }
+            streamEnd = frame->max_mr_bytes;
+            break;
+        case BS_OP_DATA:
+            if (frame->data.index == next)
+            {
+                streamData.insert(streamData.end(), frame->data.data, frame->data.data + frame->data.nmr);
+                next = streamData.size();
+                if (++streamSinceCredit >= (EMU_STREAM_WINDOW / 2))
+                {
+                    streamSinceCredit = 0;
+                    streamReply(BS_OP_CREDIT, next, next + EMU_STREAM_WINDOW * STREAM_CHUNK_SIZE);
+                }
+            }
+            else if ((frame->data.index > next) && (streamRewound != next))
+            {
+                /* A frame is missing, the feeder goes back to it */
+                streamRewound = next;
+                streamSinceCredit = 0;
+                streamReply(BS_OP_CREDIT, next, next + EMU_STREAM_WINDOW * STREAM_CHUNK_SIZE);
+            }
+            break;
+        case BS_OP_CLOSE:
+            disarm();
+            if ((frame->data.nmr > 0) && (frame->data.data[0] != BS_STATUS_OK))
+            {
+                stepFailed();
+            }
+            else if ((frame->data.index == next) && (next == streamEnd))
+            {
+                streamDone();
+            }
+            else
+            {
+                /* The CLOSE is acknowledged already, the stream is gone, resume with a new OPEN */
+                stats.streamReopens++;
+                openStream();
+            }
+            return;
+        default:
+            return;
+        }
+        arm(EMU_RESPONSE_TIMEOUT_MS);
+    }
+
+    /* OTA sender */
+    void sendInfo(void)
+    {
+        UpdateRequestPayload request;
+        memset(&request, 0, offsetof(UpdateRequestPayload, data));
+        request.index = 0;
+        request.nmr = sizeof(UpdateInfoPayload);
+        request.isFW = 1;
+        request.isInfo = 1;
+        request.isDelta = otaDelta;
+        memcpy(request.data, &otaInfo, sizeof(otaInfo));
+        send(MSG_FW_UPDATE_REQUEST, &request, offsetof(UpdateRequestPayload, data) + sizeof(otaInfo));
+        arm(OTA_ACK_TIMEOUT_MS);
+    }
+
+    void sendChunk(uint32_t i)
+    {
+        UpdateRequestPayload request;
+        uint32_t index = i * OTA_CHUNK_SIZE;
+        memset(&request, 0, offsetof(UpdateRequestPayload, data));
+        request.index = index;
+        request.nmr = (uint8_t)std::min((size_t)OTA_CHUNK_SIZE, otaImage.size() - index);
+        request.isFW = 1;
+        request.isDelta = otaDelta;
+        request.isFinal = (i == (otaChunks - 1));
+        memcpy(request.data, &otaImage[index], request.nmr);
+        if (otaFlags[i] & CHUNK_SENT)
+        {
+            otaResent++;
+        }
+        otaFlags[i] |= CHUNK_SENT | CHUNK_QUEUED;
+        send(MSG_FW_UPDATE_REQUEST, &request, offsetof(UpdateRequestPayload, data) + request.nmr, EMU_OTA_CHUNK_RETRIES, [this, i](bool acked) {
+            (void)acked;
+            if (i < otaFlags.size())
+            {
+                otaFlags[i] &= ~CHUNK_QUEUED;
+                otaSentAt[i] = HostNow_us();
+            }
+            pumpOta(false);
+        });
+    }
+
+    /* Chunks the feeder has, the one holding the acked offset stays in its window */
+    bool otaHas(uint32_t i) const
+    {
+        return ((i * OTA_CHUNK_SIZE) < otaOffset) || (otaFlags[i] & CHUNK_GOT);
+    }
+
+    void pumpOta(bool resend)
+    {
+        if (!stepActive || (step.type != STEP_OTA) || (otaState != OTA_DATA))
+        {
+            return;
+        }
+        uint32_t base = otaOffset / OTA_CHUNK_SIZE;
+        uint32_t last = std::min(base + OTA_WINDOW_CHUNKS, otaChunks);
+        uint32_t highest = base;
+        for (uint32_t i = base; i < last; i++)
+        {
+            if (otaFlags[i] & CHUNK_GOT)
+            {
+                highest = i;
+            }
+        }
+        int64_t now = HostNow_us();
+        bool sent = false;
+        for (uint32_t i = base; i < last; i++)
+        {
+            if (otaHas(i) || (otaFlags[i] & CHUNK_QUEUED))
+            {
+                continue;
+            }
+            bool gap = (i < highest) && ((now - otaSentAt[i]) >= EMU_OTA_GAP_MS * 1000LL);
+            if (!(otaFlags[i] & CHUNK_SENT) || gap || resend)
+            {
+                sendChunk(i);
+                sent = true;
+            }
+        }
+        if (resend && !sent)
+        {
+            /* Everything in the window is in, the info frame asks for the ack again */
+            sendInfo();
+        }
+    }
+
+    void otaTimeout(void)
+    {
+        if (++otaTimeouts >= EMU_OTA_TIMEOUTS)
+        {
+            otaState = OTA_FAILED;
+            stepFailed();
+            return;
+        }
+        arm(OTA_ACK_TIMEOUT_MS);
+        if (otaState == OTA_INFO)
+        {
+            sendInfo();
+            return;
+        }
+        pumpOta(true);
+    }
+
+    void otaFinished(OtaState_t state)
+    {
+        otaState = state;
+        otaEnd_us = HostNow_us();
+        otaLink = link.stats;
+        otaLink.frames -= otaLinkStart.frames;
+        otaLink.retries -= otaLinkStart.retries;
+        otaLink.lost -= otaLinkStart.lost;
+        otaLink.unheard -= otaLinkStart.unheard;
+        otaLink.bytes -= otaLinkStart.bytes;
+        otaLink.airtime_us -= otaLinkStart.airtime_us;
+    }
+
+    void onUpdateResponse(const UpdateResponsePayload *response)
+    {
+        if (!stepActive || (step.type != STEP_OTA) || ((otaState != OTA_INFO) && (otaState != OTA_DATA)))
+        {
+            return;
+        }
+        switch (response->status)
+        {
+        case UPDATE_STATUS_OK:
+            break;
+        case UPDATE_STATUS_DONE:
+            otaFinished(OTA_DONE);
+            runNext();
+            return;
+        case UPDATE_STATUS_NOT_STARTED:
+            if (response->offset >= otaImage.size())
+            {
+                /* The feeder took all of it, only its DONE was lost */
+                otaFinished(OTA_DONE);
+                runNext();
+                return;
+            }
+            /* The feeder lost the transfer, the info frame starts it again where its flash ends */
+            otaOffset = 0;
+            otaFlags.assign(otaChunks, CHUNK_SENT);
+            otaState = OTA_INFO;
+            sendInfo();
+            return;
+        default:
+            printf("ota        the feeder reported status %u\n", (unsigned)response->status);
+            otaFinished(OTA_FAILED);
+            stepFailed();
+            return;
+        }
+
+        otaTimeouts = 0;
+        otaState = OTA_DATA;
+        if (response->offset > otaOffset)
+        {
+            otaOffset = response->offset;
+        }
+        for (uint32_t i = otaOffset / OTA_CHUNK_SIZE; i < otaChunks; i++)
+        {
+            uint32_t index = i * OTA_CHUNK_SIZE;
+            if (index > response->offset)
+            {
+                uint32_t bit = (index - response->offset) / OTA_CHUNK_SIZE;
+                if ((bit < 32) && (response->bitmap & (1UL << bit)))
+                {
+                    otaFlags[i] |= CHUNK_GOT;
+                }
+            }
+        }
+        arm(OTA_ACK_TIMEOUT_MS);
+        pumpOta(false);
+    }
+
+    /* Frames of the feeder */
+    void handle(const uint8_t *src, const Message &msg, int8_t rssi)
+    {
+        const uint8_t *payload = msg.payload;
+        switch (msg.messageType)
+        {
+        case MSG_DISCOVERY:
+        {
+            DiscoveryResponsePayload response;
+            response.deviceType = DEVICE_TYPE_DOOR_CONTROL;
+            response.channel = cfg.channel;
+            response.protocolVersion = ESPNOW_PROTOCOL_VERSION;
+            response.capabilities = GATEWAY_CAP_PAIRING | GATEWAY_CAP_TIME | ((paired && !memcmp(src, node, 6)) ? GATEWAY_CAP_KNOWN : 0) |
+                                    (!jobs.empty() ? GATEWAY_CAP_OTA : 0);
+            response.rssi = rssi;
+            response.feeders = paired ? 1 : 0;
+            stats.discoveries++;
+            send(src, MSG_DISCOVERY_RESPONSE, &response, sizeof(response), 1);
+            break;
+        }
+        case MSG_PAIR_REQUEST:
+        {
+            PairResponsePayload response;
+            memcpy(node, src, 6);
+            paired = true;
+            response.deviceType = DEVICE_TYPE_DOOR_CONTROL;
+            response.channel = cfg.channel;
+            response.state = PAIR_STATE_PAIRED;
+            response.protocolVersion = ESPNOW_PROTOCOL_VERSION;
+            stats.pairings++;
+            send(MSG_PAIR_RESPONSE, &response, sizeof(response));
+            break;
+        }
+        case MSG_GET_PARAM_DEFS_RESPONSE:
+            stats.defs += ((const ParamDefsPayload *)payload)->numParams;
+            break;
+        case MSG_READ_PARAM_RESPONSE:
+        {
+            const ReadResponsePayload *response = (const ReadResponsePayload *)payload;
+            stats.values++;
+            if (stepActive && (step.type == STEP_READ) && (response->regAddr == step.reg) && (response->nmr == step.nmr))
+            {
+                stats.reads++;
+                runNext();
+            }
+            break;
+        }
+        case MSG_TELEMETRY_BATCH:
+            stats.samples += ((const TelemetryBatchPayload *)payload)->nmr;
+            break;
+        case MSG_EVENT_NOTIFY:
+        {
+            const EventNotifyPayload *notify = (const EventNotifyPayload *)payload;
+            for (uint8_t i = 0; (i < notify->nmr) && (EventNotifyPayloadSize(i + 1) <= msg.payloadSize); i++)
+            {
+                const EventRecord &event = notify->events[i];
+                if (!eventSeen || ((int16_t)(event.seq - eventSeq) > 0))
+                {
+                    eventSeen = true;
+                    eventSeq = event.seq;
+                    DoorState = event.state;
+                    stats.events++;
+                }
+            }
+            break;
+        }
+        case MSG_GET_LOG_RESPONSE:
+        {
+            const DataPayload *logs = (const DataPayload *)payload;
+            uint32_t records = logs->nmr / LOG_RECORD_SIZE;
+            if ((logs->index + records) > logNext)
+            {
+                stats.logRecords += std::min(records, logs->index + records - logNext);
+                logNext = logs->index + records;
+            }
+            break;
+        }
+        case MSG_TIME_SYNC_REQUEST:
+        {
+            TimeSyncPayload sync;
+            int64_t now_us = HostNow_us();
+            int32_t day = (int32_t)((EMU_EPOCH_S + now_us / 1000000LL) / 86400) * 86400;
+            memset(&sync, 0, sizeof(sync));
+            sync.currentTime = (int32_t)(EMU_EPOCH_S + now_us / 1000000LL);
+            sync.currentTime_ms = (uint16_t)((now_us / 1000) % 1000);
+            strncpy(sync.timezone, EMU_TIMEZONE, sizeof(sync.timezone) - 1);
+            sync.sunriseTime = day + EMU_SUNRISE_S;
+            sync.sunsetTime = day + EMU_SUNSET_S;
+            sync.slotOffset_s = cfg.slot;
+            stats.timeSyncs++;
+            send(MSG_TIME_SYNC_RESPONSE, &sync, sizeof(sync));
+            break;
+        }
+        case MSG_TRANSMIT_DONE:
+            /* The upload is in, the session of this wake follows */
+            if (!stepActive)
+            {
+                runNext();
+            }
+            break;
+        case MSG_SLEEP:
+            stats.sleeps++;
+            break;
+        case MSG_FW_UPDATE_RESPONSE:
+            onUpdateResponse((const UpdateResponsePayload *)payload);
+            break;
+        case MSG_BYTE_STREAM:
+            onStream((const ByteStreamPayload *)payload, msg.payloadSize);
+            break;
+        case MSG_FILE_RESPONSE:
+            onFileResponse((const FileResponsePayload *)payload, msg.payloadSize);
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    GatewayStats_t stats;
+    int32_t DoorState;   // StavKrmitka from the last event, -1 before any
+    int16_t LastCommand; // ManualniOvladani last written, 0 before any
+    OtaState_t otaState;
+    int64_t otaStart_us;
+    int64_t otaEnd_us;
+    uint32_t otaResent;
+    LinkStats_t otaLinkStart;
+    LinkStats_t otaLink;
+
+    Gateway(SimLink &simLink, const EmuConfig_t &config)
+        : link(simLink), cfg(config), paired(false), txBusy(false), txGeneration(0), txSeq(0), rxTop(0), rxSeen(0), rxTime_us(0),
+          eventSeen(false), eventSeq(0), logNext(0), stepActive(false), stepIsJob(false), stepTries(0), timer(0), listNext(0), streamEnd(0),
+          streamSinceCredit(0), streamRewound(0), otaDelta(false), otaOffset(0), otaChunks(0), otaTimeouts(0), DoorState(-1), LastCommand(0),
+          otaState(OTA_IDLE), otaStart_us(0), otaEnd_us(0), otaResent(0), otaLinkStart(), otaLink()
+    {
+        static const uint8_t gatewayMac[6] = {0x24, 0x6F, 0x28, 0xAA, 0x00, 0x01};
+        memcpy(mac, gatewayMac, 6);
+        memset(node, 0xFF, 6);
+        memset(&otaInfo, 0, sizeof(otaInfo));
+        stats = GatewayStats_t();
+    }
+
+    const uint8_t *Mac(void) const
+    {
+        return mac;
+    }
+
+    bool Listening(uint8_t channel) const
+    {
+        return channel == cfg.channel;
+    }
+
+    void Deliver(const uint8_t *src, const uint8_t *data, size_t len, int8_t rssi)
+    {
+        if (ProtoCheckFrame(data, len) != PROTO_OK)
+        {
+            stats.invalid++;
+            return;
+        }
+        Message msg;
+        memcpy(&msg, data, len);
+        /* Discovery is a broadcast, the feeder numbers it apart from the frames to the gateway */
+        if ((msg.messageType != MSG_DISCOVERY) && duplicate(msg.seq))
+        {
+            stats.duplicates++;
+            return;
+        }
+        handle(src, msg, rssi);
+    }
+
+    bool Paired(void) const
+    {
+        return paired;
+    }
+
+    /* Steps run after the upload of the next wake, the ones not reached are dropped with the wake */
+    void Plan(const std::deque<Step_t> &steps)
+    {
+        wakeSteps = steps;
+    }
+
+    void Queue(const Step_t &job)
+    {
+        jobs.push_back(job);
+    }
+
+    bool JobsPending(void) const
+    {
+        return !jobs.empty() || (stepActive && stepIsJob);
+    }
+
+    void SetOta(const std::vector<uint8_t> &image, const std::vector<uint8_t> &target, bool delta)
+    {
+        otaImage = image;
+        otaDelta = delta;
+        otaChunks = (image.size() + OTA_CHUNK_SIZE - 1) / OTA_CHUNK_SIZE;
+        otaInfo.size = target.size();
+        mbedtls_sha256(target.data(), target.size(), otaInfo.sha256, 0);
+        Step_t job;
+        job.type = STEP_OTA;
+        job.reg = 0;
+        job.value = 0;
+        job.nmr = 0;
+        Queue(job);
+    }
+
+    /* The feeder went to sleep or restarted, frames to it are dropped and a job in progress runs again next time */
+    void EndWake(void)
+    {
+        txq.clear();
+        txBusy = false;
+        txGeneration++;
+        disarm();
+        if (stepActive)
+        {
+            bool sent = true;
+            if ((step.type == STEP_OTA) && (otaState == OTA_DATA))
+            {
+                /* The last ack before the restart was lost, the running image tells */
+                for (uint32_t i = 0; i < otaChunks; i++)
+                {
+                    sent &= otaHas(i);
+                }
+            }
+            if ((step.type == STEP_OTA) && (otaState == OTA_DATA) && sent)
+            {
+                otaFinished(OTA_DONE);
+            }
+            else if (stepIsJob)
+            {
+                jobs.push_front(step);
+            }
+            else
+            {
+                stats.failedSteps++;
+            }
+        }
+        stepActive = false;
+        wakeSteps.clear();
+    }
+};
+
+typedef struct
+{
+    LinkStats_t link;
+    int64_t awake_us;
+    int64_t radio_us;
+    NodeState_t end;
+} WakeResult_t;
+
+/* Boots the feeder, runs it until it sleeps or restarts and then through its sleep */
+static bool runWake(const EmuConfig_t &cfg, SimLink &link, Gateway &gateway, NodeReset_t reason, int64_t limit_s, WakeResult_t &r)
+{
+    LinkStats_t before = link.stats;
+    int64_t radioBefore = HostRadioOn_us();
+    int64_t boot = HostNow_us();
+    if (!HostBoot(cfg.library, reason))
+    {
+        return false;
+    }
+    bool stopped = HostRun(boot + limit_s * 1000000LL, []() { return HostNodeState() != NODE_RUNNING; });
+    r.awake_us = HostNow_us() - boot;
+    r.end = HostNodeState();
+    HostShutdown();
+    gateway.EndWake();
+    if (!stopped)
+    {
+        printf("wake       the feeder did not sleep within %u s\n", (unsigned)limit_s);
+        return false;
+    }
+    if (r.end == NODE_DEEP_SLEEP)
+    {
+        HostRun(HostNow_us() + HostSleepTime_us());
+    }
+    r.link = link.stats;
+    r.link.frames -= before.frames;
+    r.link.retries -= before.retries;
+    r.link.lost -= before.lost;
+    r.link.unheard -= before.unheard;
+    r.link.bytes -= before.bytes;
+    r.link.airtime_us -= before.airtime_us;
+    r.radio_us = HostRadioOn_us() - radioBefore;
+    return true;
+}
+
+static void accumulate(WakeResult_t &sum, const WakeResult_t &r)
+{
+    sum.link.frames += r.link.frames;
+    sum.link.retries += r.link.retries;
+    sum.link.lost += r.link.lost;
+    sum.link.unheard += r.link.unheard;
+    sum.link.bytes += r.link.bytes;
+    sum.link.airtime_us += r.link.airtime_us;
+    sum.awake_us += r.awake_us;
+    sum.radio_us += r.radio_us;
+}
+
+static void printWake(const char *name, const WakeResult_t &r, double divisor)
+{
+    printf("%-10s frames %7.1f  retries %5.1f  bytes %9.0f  airtime %8.1f ms  awake %9.1f ms  radio on %9.1f ms\n", name,
+           r.link.frames / divisor, r.link.retries / divisor, r.link.bytes / divisor, r.link.airtime_us / 1000.0 / divisor,
+           r.awake_us / 1000.0 / divisor, r.radio_us / 1000.0 / divisor);
+}
+
+static std::vector<uint8_t> randomImage(std::mt19937 &rng, size_t size)
+{
+    std::vector<uint8_t> image(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        image[i] = (uint8_t)rng();
+    }
+    return image;
+}
+
+static std::deque<Step_t> planWake(const EmuConfig_t &cfg, uint32_t wake, uint32_t &commandNo)
+{
+    std::deque<Step_t> steps;
+    Step_t step;
+    step.nmr = 0;
+    if ((wake == 0) && (cfg.batch > 0))
+    {
+        step.type = STEP_WRITE;
+        step.reg = REG_DAVKA_PROBUZENI;
+        step.value = cfg.batch;
+        steps.push_back(step);
+    }
+    for (uint32_t i = 0; i < cfg.commands; i++)
+    {
+        step.type = STEP_WRITE;
+        step.reg = REG_MANUALNI_OVLADANI;
+        step.value = ((commandNo++ % 2) == 0) ? MANUAL_OPEN : MANUAL_CLOSE;
+        steps.push_back(step);
+    }
+    for (uint32_t i = 0; i < cfg.reads; i++)
+    {
+        step.type = STEP_READ;
+        step.reg = REG_STAV_KRMITKA;
+        step.nmr = READ_REGS;
+        steps.push_back(step);
+    }
+    return steps;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  --wakes N        wakes to simulate (20)\n"
+           "  --loss P         frame and ack loss probability 0..1 (0.02)\n"
+           "  --latency MS     receive delay (1.0)\n"
+           "  --jitter MS      random extra delay (0.5)\n"
+           "  --reorder P      probability a frame is held back (0)\n"
+           "  --reorder-ms MS  hold back time (20)\n"
+           "  --rssi DBM       signal of the frames (-60)\n"
+           "  --channel N      Wi-Fi channel of the gateway (1)\n"
+           "  --commands N     door commands per radio wake (0)\n"
+           "  --reads N        read requests per radio wake (0)\n"
+           "  --batch N        DavkaProbuzeni written at the first wake, 0 = kept (0)\n"
+           "  --files          list the files and read them at the last wake\n"
+           "  --slot S         wake slot sent with the time, -1 = none (-1)\n"
+           "  --drift PPM      clock drift of the feeder (0)\n"
+           "  --ota BYTES      firmware image sent after the wakes, 0 = no OTA (0)\n"
+           "  --delta          OTA of the running image rebuilt, sent as a delta patch\n"
+           "  --lib PATH       feeder firmware (" EMU_LIBRARY ")\n"
+           "  --seed N         random seed (1)\n"
+           "  --serial         print the serial output of the feeder\n"
+           "  --verbose        print every wake\n",
+           prog);
+}
+
+int main(int argc, char **argv)
+{
+    EmuConfig_t cfg = {20, 0, 0, 0, false, 0, false, SLOT_NONE, 1, 0.0, 1, EMU_LIBRARY, false, false};
+    LinkConfig_t linkCfg = {0.02, 1.0, 0.5, 0.0, 20.0, -60, 1};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--verbose") == 0)
+        {
+            cfg.verbose = true;
+            continue;
+        }
+        if (strcmp(arg, "--serial") == 0)
+        {
+            cfg.serial = true;
+            continue;
+        }
+        if (strcmp(arg, "--files") == 0)
+        {
+            cfg.files = true;
+            continue;
+        }
+        if (strcmp(arg, "--delta") == 0)
+        {
+            cfg.delta = true;
+            continue;
+        }
+        if (val == NULL)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--wakes") == 0)
+            cfg.wakes = atoi(val);
+        else if (strcmp(arg, "--loss") == 0)
+            linkCfg.loss = atof(val);
+        else if (strcmp(arg, "--latency") == 0)
+            linkCfg.latency_ms = atof(val);
+        else if (strcmp(arg, "--jitter") == 0)
+            linkCfg.jitter_ms = atof(val);
+        else if (strcmp(arg, "--reorder") == 0)
+            linkCfg.reorder = atof(val);
+        else if (strcmp(arg, "--reorder-ms") == 0)
+            linkCfg.reorder_ms = atof(val);
+        else if (strcmp(arg, "--rssi") == 0)
+            linkCfg.rssi = atoi(val);
+        else if (strcmp(arg, "--channel") == 0)
+            cfg.channel = atoi(val);
+        else if (strcmp(arg, "--commands") == 0)
+            cfg.commands = atoi(val);
+        else if (strcmp(arg, "--reads") == 0)
+            cfg.reads = atoi(val);
+        else if (strcmp(arg, "--batch") == 0)
+            cfg.batch = atoi(val);
+        else if (strcmp(arg, "--slot") == 0)
+            cfg.slot = (atoi(val) < 0) ? SLOT_NONE : atoi(val);
+        else if (strcmp(arg, "--drift") == 0)
+            cfg.drift_ppm = atof(val);
+        else if (strcmp(arg, "--ota") == 0)
+            cfg.otaSize = atoi(val);
+        else if (strcmp(arg, "--lib") == 0)
+            cfg.library = val;
+        else if (strcmp(arg, "--seed") == 0)
+            cfg.seed = linkCfg.seed = atoi(val);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((cfg.wakes == 0) || (cfg.channel < 1) || (cfg.channel > 13))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::mt19937 rng(cfg.seed);
+    std::vector<uint8_t> firmware = randomImage(rng, EMU_FIRMWARE_SIZE);
+    SimLink link(linkCfg);
+    Gateway gateway(link, cfg);
+    link.Attach(SIM_GATEWAY, &gateway);
+    HostRadioAttach(&link, SIM_FEEDER);
+    HostFlashInit(firmware);
+    HostSetScale(EMU_SCALE_RAW);
+    HostSetClockDrift(cfg.drift_ppm);
+    HostSetSerialEcho(cfg.serial);
+
+    printf("link: loss %.1f %%, latency %.1f ms, jitter %.1f ms, reorder %.1f %%, channel %u\n", linkCfg.loss * 100, linkCfg.latency_ms,
+           linkCfg.jitter_ms, linkCfg.reorder * 100, (unsigned)cfg.channel);
+
+    bool ok = true;
+    uint32_t commandNo = 0;
+    uint32_t radioWakes = 0;
+    WakeResult_t first = WakeResult_t();
+    WakeResult_t sum = WakeResult_t();
+    NodeReset_t reason = NODE_RESET_POWERON;
+    HostSetPairButton(true);
+    for (uint32_t w = 0; ok && (w < cfg.wakes); w++)
+    {
+        WakeResult_t r;
+        gateway.Plan(planWake(cfg, w, commandNo));
+        if (cfg.files && (w == (cfg.wakes - 1)))
+        {
+            Step_t step;
+            step.type = STEP_LIST;
+            step.path = "/";
+            gateway.Queue(step);
+        }
+        ok = runWake(cfg, link, gateway, reason, EMU_WAKE_LIMIT_S, r);
+        if (!ok)
+        {
+            break;
+        }
+        reason = (r.end == NODE_RESTART) ? NODE_RESET_SOFTWARE : NODE_RESET_DEEPSLEEP;
+        radioWakes += (r.radio_us > 0) ? 1 : 0;
+        if (w == 0)
+        {
+            first = r;
+        }
+        else
+        {
+            accumulate(sum, r);
+        }
+        if (cfg.verbose)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "wake %u", (unsigned)(w + 1));
+            printWake(name, r, 1);
+        }
+    }
+    if (ok)
+    {
+        printWake("first", first, 1);
+        if (cfg.wakes > 1)
+        {
+            printWake("per wake", sum, cfg.wakes - 1);
+            printf("radio      up at %u of %u wakes\n", (unsigned)radioWakes, (unsigned)cfg.wakes);
+        }
+    }
+    if (!gateway.Paired())
+    {
+        printf("pairing    the feeder did not pair\n");
+        ok = false;
+    }
+
+    if (ok && ((cfg.otaSize > 0) || cfg.delta))
+    {
+        std::vector<uint8_t> target;
+        std::vector<uint8_t> image;
+        if (cfg.delta)
+        {
+            target = DeltaGen::Mutate(firmware, rng);
+            image = DeltaGen::Make(firmware, target);
+            printf("delta      %u B patch for the %u B image, %.1f %%\n", (unsigned)image.size(), (unsigned)target.size(),
+                   100.0 * image.size() / target.size());
+        }
+        else
+        {
+            target = randomImage(rng, cfg.otaSize);
+            image = target;
+        }
+        gateway.SetOta(image, target, cfg.delta);
+        /* The update waits for a wake that brings the radio up */
+        WakeResult_t r = WakeResult_t();
+        for (uint32_t w = 0; ok && gateway.JobsPending() && (w <= 32); w++)
+        {
+            gateway.Plan(std::deque<Step_t>());
+            ok = runWake(cfg, link, gateway, reason, EMU_OTA_LIMIT_S, r);
+            reason = (r.end == NODE_RESTART) ? NODE_RESET_SOFTWARE : NODE_RESET_DEEPSLEEP;
+        }
+        if (ok && (gateway.otaState == OTA_DONE))
+        {
+            double ota_s = (gateway.otaEnd_us - gateway.otaStart_us) / 1e6;
+            printWake("ota wake", r, 1);
+            uint32_t sent = image.size();
+            printf("ota        %u B in %.1f s, %.1f kB/s, %u frames, %u resent chunks, %.1f %% of the airtime is image data\n", (unsigned)sent,
+                   ota_s, sent / 1000.0 / ota_s, (unsigned)gateway.otaLink.frames, (unsigned)gateway.otaResent,
+                   100.0 * (sent * AIR_US_PER_BYTE) / gateway.otaLink.airtime_us);
+
+            /* The feeder has to come back on the new image and go on as before */
+            ok = (r.end == NODE_RESTART) && runWake(cfg, link, gateway, NODE_RESET_SOFTWARE, EMU_WAKE_LIMIT_S, r);
+            std::vector<uint8_t> running;
+            if (ok && (!HostReadRunningImage(running, target.size()) || (running != target)))
+            {
+                printf("ota        the feeder does not run the new image\n");
+                ok = false;
+            }
+            if (ok)
+            {
+                printWake("after ota", r, 1);
+            }
+        }
+        else if (ok)
+        {
+            printf("ota        not finished\n");
+            ok = false;
+        }
+    }
+
+    const GatewayStats_t &s = gateway.stats;
+    printf("gateway    defs %u, values %u, samples %u, events %u, log records %u, time syncs %u, sleeps %u\n", (unsigned)s.defs, (unsigned)s.values,
+           (unsigned)s.samples, (unsigned)s.events, (unsigned)s.logRecords, (unsigned)s.timeSyncs, (unsigned)s.sleeps);
+    printf("session    writes %u, reads %u, files %u, stream %u B, reopened %u, failed steps %u\n", (unsigned)s.writes, (unsigned)s.reads,
+           (unsigned)s.files, (unsigned)s.streamBytes, (unsigned)s.streamReopens, (unsigned)s.failedSteps);
+    printf("dropped    gateway %u, duplicates %u, invalid %u\n", (unsigned)s.dropped, (unsigned)s.duplicates, (unsigned)s.invalid);
+    if ((gateway.LastCommand != 0) && (gateway.DoorState != ((gateway.LastCommand == MANUAL_OPEN) ? DOOR_OPEN : DOOR_CLOSED)))
+    {
+        printf("door       the last event does not report the commanded state\n");
+        ok = false;
+    }
+    if (s.failedSteps > 0)
+    {
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
@@ -0,0 +1,258 @@
+/***********************************************************************
+ * Filename: Arduino.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the Arduino core, only the part the firmware
+ *     sources of the ESP-NOW stack use. String keeps its text in a
+ *     std::string, Serial goes to the emulator log, millis() and
+ *     micros() run on the virtual time of the emulator.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_sleep.h"
+
+using std::max;
+using std::min;
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#define BIT(nr) (1UL << (nr))
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define LOW 0x0
+#define HIGH 0x1
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+class String
+{
+private:
+    std::string s;
+
+public:
+    String() {}
+    String(const char *cstr) : s(cstr ? cstr : "") {}
+    String(const std::string &str) : s(str) {}
+    explicit String(char c) : s(1, c) {}
+    explicit String(unsigned char v) : s(std::to_string(v)) {}
+    explicit String(int v) : s(std::to_string(v)) {}
+    explicit String(unsigned int v) : s(std::to_string(v)) {}
+    explicit String(long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long v) : s(std::to_string(v)) {}
+    explicit String(long long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long long v) : s(std::to_string(v)) {}
+    explicit String(double v, unsigned int decimals = 2)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+        s = buf;
+    }
+
+    const char *c_str(void) const { return s.c_str(); }
+    unsigned int length(void) const { return (unsigned int)s.length(); }
+    bool isEmpty(void) const { return s.empty(); }
+    void clear(void) { s.clear(); }
+    bool reserve(unsigned int size)
+    {
+        s.reserve(size);
+        return true;
+    }
+    char charAt(unsigned int idx) const { return (idx < s.length()) ? s[idx] : 0; }
+    char operator[](unsigned int idx) const { return charAt(idx); }
+    long toInt(void) const { return atol(s.c_str()); }
+    int compareTo(const String &other) const { return s.compare(other.s); }
+    bool equals(const String &other) const { return s == other.s; }
+    bool startsWith(const String &prefix) const { return s.compare(0, prefix.s.length(), prefix.s) == 0; }
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t pos = s.find(c, from);
+        return (pos == std::string::npos) ? -1 : (int)pos;
+    }
+    String substring(unsigned int from) const { return (from < s.length()) ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const { return (from < s.length() && to > from) ? String(s.substr(from, to - from)) : String(); }
+    void remove(unsigned int idx) { remove(idx, (unsigned int)s.length()); }
+    void remove(unsigned int idx, unsigned int count)
+    {
+        if (idx < s.length())
+        {
+            s.erase(idx, count);
+        }
+    }
+    void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index = 0) const
+    {
+        if ((buf == NULL) || (bufsize == 0))
+        {
+            return;
+        }
+        size_t n = (index < s.length()) ? std::min<size_t>(bufsize - 1, s.length() - index) : 0;
+        memcpy(buf, s.data() + index, n);
+        buf[n] = 0;
+    }
+
+    String &operator+=(const String &rhs)
+    {
+        s += rhs.s;
+        return *this;
+    }
+    String &operator+=(const char *rhs)
+    {
+        s += rhs;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        s += c;
+        return *this;
+    }
+    bool concat(const String &rhs)
+    {
+        s += rhs.s;
+        return true;
+    }
+
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s); }
+    friend String operator+(const String &a, char c) { return String(a.s + c); }
+    friend bool operator==(const String &a, const String &b) { return a.s == b.s; }
+    friend bool operator==(const String &a, const char *b) { return a.s == b; }
+    friend bool operator!=(const String &a, const String &b) { return a.s != b.s; }
+    friend bool operator!=(const String &a, const char *b) { return a.s != b; }
+    friend bool operator<(const String &a, const String &b) { return a.s < b.s; }
+};
+
+/* Serial output goes to the emulator, which prints it with --serial */
+void HostSerialWrite(const char *text, size_t len);
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        len = std::min<int>(std::max(len, 0), sizeof(buf) - 1);
+        HostSerialWrite(buf, len);
+        return len;
+    }
+    size_t print(const String &text)
+    {
+        HostSerialWrite(text.c_str(), text.length());
+        return text.length();
+    }
+    size_t print(const char *text) { return print(String(text)); }
+    size_t print(long v) { return print(String(v)); }
+    size_t println(const String &text) { return print(text + "\n"); }
+    size_t println(const char *text) { return println(String(text)); }
+    size_t println(long v) { return println(String(v)); }
+    size_t println(void) { return print("\n"); }
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress
+{
+private:
+    uint8_t octets[4];
+
+public:
+    IPAddress() { memset(octets, 0, sizeof(octets)); }
+    IPAddress(uint32_t address) { memcpy(octets, &address, sizeof(octets)); }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        octets[0] = a;
+        octets[1] = b;
+        octets[2] = c;
+        octets[3] = d;
+    }
+    operator uint32_t() const
+    {
+        uint32_t address;
+        memcpy(&address, octets, sizeof(address));
+        return address;
+    }
+    uint8_t operator[](int idx) const { return octets[idx]; }
+    bool fromString(const char *address)
+    {
+        unsigned int a, b, c, d;
+        char tail;
+        if ((address == NULL) || (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) || (a > 255) || (b > 255) || (c > 255) || (d > 255))
+        {
+            return false;
+        }
+        *this = IPAddress(a, b, c, d);
+        return true;
+    }
+    bool fromString(const String &address) { return fromString(address.c_str()); }
+    String toString(void) const
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(buf);
+    }
+};
+
+class EspClass
+{
+public:
+    void restart(void);
+};
+
+extern EspClass ESP;
+
+/* unsigned long is 32 bits on the target, keep the same wrap */
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+inline void digitalWrite(uint8_t pin, uint8_t val)
+{
+    (void)pin;
+    (void)val;
+}
+inline int digitalRead(uint8_t pin)
+{
+    (void)pin;
+    return HIGH;
+}
+inline uint16_t analogRead(uint8_t pin)
+{
+    (void)pin;
+    return 0;
+}
+inline uint32_t analogReadMilliVolts(uint8_t pin)
+{
+    (void)pin;
+    return 0;
+}
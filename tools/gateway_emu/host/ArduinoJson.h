@@ -0,0 +1,82 @@
+/***********************************************************************
+ * Filename: ArduinoJson.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for ArduinoJson. The web interface that renders the
+ *     registers as JSON is not part of the emulated feeder, the types
+ *     only let the register classes compile and hold no data.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include "Arduino.h"
+
+class JsonArray;
+class JsonObject;
+
+class JsonVariant
+{
+public:
+    template <typename T>
+    bool set(const T &value)
+    {
+        (void)value;
+        return false;
+    }
+    template <typename T>
+    bool is(void) const
+    {
+        return false;
+    }
+    template <typename T>
+    T as(void) const
+    {
+        return T();
+    }
+    template <typename T>
+    T to(void)
+    {
+        return T();
+    }
+    template <typename T>
+    JsonVariant &operator=(const T &value)
+    {
+        set(value);
+        return *this;
+    }
+};
+
+class JsonArray
+{
+public:
+    template <typename T>
+    bool add(const T &value)
+    {
+        (void)value;
+        return false;
+    }
+};
+
+class JsonObject
+{
+public:
+    template <typename T>
+    JsonVariant operator[](const T &key)
+    {
+        (void)key;
+        return JsonVariant();
+    }
+};
+
+class JsonPair
+{
+public:
+    String key(void) const { return String(); }
+    JsonVariant value(void) const { return JsonVariant(); }
+};
+
+class JsonDocument : public JsonObject
+{
+};
@@ -0,0 +1,73 @@
+/***********************************************************************
+ * Filename: LittleFS.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for LittleFS. Files and directories live in the
+ *     emulator and survive the wakes, open handles share the position
+ *     like the Arduino File class. Opening a file for writing with
+ *     create set makes the missing directories.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include "Arduino.h"
+
+namespace fs
+{
+    struct FileImpl;
+
+    class File
+    {
+    private:
+        std::shared_ptr<FileImpl> impl;
+
+    public:
+        File() {}
+        explicit File(std::shared_ptr<FileImpl> file) : impl(file) {}
+
+        operator bool() const;
+        size_t size(void) const;
+        size_t position(void) const;
+        bool seek(uint32_t pos);
+        int available(void);
+        int read(void);
+        size_t read(uint8_t *buf, size_t size);
+        size_t readBytes(char *buf, size_t length) { return read((uint8_t *)buf, length); }
+        size_t write(const uint8_t *buf, size_t size);
+        size_t write(uint8_t c) { return write(&c, 1); }
+        void flush(void) {}
+        void close(void);
+        bool isDirectory(void) const;
+        const char *name(void) const;
+        const char *path(void) const;
+        File openNextFile(const char *mode = "r");
+        void rewindDirectory(void);
+    };
+
+    class LittleFSFS
+    {
+    public:
+        bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+        void end(void);
+        File open(const char *path, const char *mode = "r", bool create = false);
+        File open(const String &path, const char *mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+        bool exists(const char *path);
+        bool exists(const String &path) { return exists(path.c_str()); }
+        bool remove(const char *path);
+        bool remove(const String &path) { return remove(path.c_str()); }
+        bool rename(const char *from, const char *to);
+        bool mkdir(const char *path);
+        bool rmdir(const char *path);
+        bool rmdir(const String &path) { return rmdir(path.c_str()); }
+        size_t totalBytes(void);
+        size_t usedBytes(void);
+    };
+}
+
+using fs::File;
+
+extern fs::LittleFSFS LittleFS;
@@ -0,0 +1,83 @@
+/***********************************************************************
+ * Filename: Preferences.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the NVS key-value store. The namespaces are
+ *     kept by the emulator, so they survive the reload of the firmware
+ *     at every wake like the flash of the feeder.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "Arduino.h"
+
+class Preferences
+{
+private:
+    String ns;
+    bool started;
+    bool readOnly;
+
+    bool put(const char *key, const void *value, size_t len);
+    size_t get(const char *key, void *value, size_t maxLen) const;
+
+public:
+    Preferences() : started(false), readOnly(false) {}
+    ~Preferences() { end(); }
+
+    bool begin(const char *name, bool readOnly = false, const char *partition_label = NULL);
+    void end(void);
+    bool clear(void);
+    bool remove(const char *key);
+    bool isKey(const char *key) const;
+
+    size_t putShort(const char *key, int16_t value) { return put(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putUShort(const char *key, uint16_t value) { return put(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putUInt(const char *key, uint32_t value) { return put(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putLong(const char *key, int32_t value) { return put(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putBool(const char *key, bool value) { return putUShort(key, value ? 1 : 0); }
+    size_t putBytes(const char *key, const void *value, size_t len) { return put(key, value, len) ? len : 0; }
+    size_t putString(const char *key, const String &value) { return put(key, value.c_str(), value.length() + 1) ? value.length() : 0; }
+
+    int16_t getShort(const char *key, int16_t defaultValue = 0) const
+    {
+        int16_t value = defaultValue;
+        return (get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+    }
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0) const
+    {
+        uint16_t value = defaultValue;
+        return (get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+    }
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) const
+    {
+        uint32_t value = defaultValue;
+        return (get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+    }
+    int32_t getLong(const char *key, int32_t defaultValue = 0) const
+    {
+        int32_t value = defaultValue;
+        return (get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+    }
+    bool getBool(const char *key, bool defaultValue = false) const { return getUShort(key, defaultValue ? 1 : 0) != 0; }
+    size_t getBytesLength(const char *key) const { return get(key, NULL, 0); }
+    size_t getBytes(const char *key, void *buf, size_t maxLen) const
+    {
+        size_t len = getBytesLength(key);
+        return ((len == 0) || (len > maxLen)) ? 0 : get(key, buf, maxLen);
+    }
+    String getString(const char *key, const String &defaultValue = String()) const
+    {
+        size_t len = getBytesLength(key);
+        if (len == 0)
+        {
+            return defaultValue;
+        }
+        std::string value(len, '\0');
+        get(key, &value[0], len);
+        return String(value.c_str());
+    }
+};
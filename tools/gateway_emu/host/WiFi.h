@@ -0,0 +1,13 @@
+/***********************************************************************
+ * Filename: WiFi.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the Arduino Wi-Fi object.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "WiFiGeneric.h"
+
+extern WiFiGenericClass WiFi;
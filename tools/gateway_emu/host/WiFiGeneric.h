@@ -0,0 +1,27 @@
+/***********************************************************************
+ * Filename: WiFiGeneric.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the Arduino Wi-Fi class, only the mode and the
+ *     TX power the ESP-NOW stack sets.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "esp_wifi.h"
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA,
+    WIFI_AP,
+    WIFI_AP_STA,
+} wifi_mode_t;
+
+class WiFiGenericClass
+{
+public:
+    bool mode(wifi_mode_t mode);
+    bool setTxPower(wifi_power_t power);
+};
@@ -0,0 +1,25 @@
+/***********************************************************************
+ * Filename: gpio.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the GPIO driver, the pins of the feeder are not
+ *     emulated.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+
+typedef int gpio_num_t;
+
+inline esp_err_t gpio_hold_en(gpio_num_t gpio_num)
+{
+    (void)gpio_num;
+    return ESP_OK;
+}
+inline esp_err_t gpio_hold_dis(gpio_num_t gpio_num)
+{
+    (void)gpio_num;
+    return ESP_OK;
+}
@@ -0,0 +1,20 @@
+/***********************************************************************
+ * Filename: spi_master.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the SPI master driver, the load cell is not
+ *     emulated.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
+
+typedef enum
+{
+    SPI1_HOST = 0,
+    SPI2_HOST = 1,
+} spi_host_device_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
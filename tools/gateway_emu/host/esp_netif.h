@@ -0,0 +1,11 @@
+/***********************************************************************
+ * Filename: esp_netif.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in, nothing of it is used by the ESP-NOW stack.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "Arduino.h"
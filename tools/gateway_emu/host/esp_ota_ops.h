@@ -0,0 +1,16 @@
+/***********************************************************************
+ * Filename: esp_ota_ops.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the OTA partition selection, the emulator boots
+ *     the selected partition at the next restart.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "esp_partition.h"
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
@@ -0,0 +1,81 @@
+/***********************************************************************
+ * Filename: esp_wifi.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in for the Wi-Fi driver calls of the ESP-NOW stack:
+ *     channel, power save, TX power and the promiscuous callback that
+ *     LinkStats reads the RSSI from.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "Arduino.h"
+
+typedef enum
+{
+    WIFI_SECOND_CHAN_NONE = 0,
+    WIFI_SECOND_CHAN_ABOVE,
+    WIFI_SECOND_CHAN_BELOW,
+} wifi_second_chan_t;
+
+typedef enum
+{
+    WIFI_PS_NONE = 0,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM,
+} wifi_ps_type_t;
+
+typedef enum
+{
+    WIFI_POWER_19_5dBm = 78,
+    WIFI_POWER_19dBm = 76,
+    WIFI_POWER_18_5dBm = 74,
+    WIFI_POWER_17dBm = 68,
+    WIFI_POWER_15dBm = 60,
+    WIFI_POWER_13dBm = 52,
+    WIFI_POWER_11dBm = 44,
+    WIFI_POWER_8_5dBm = 34,
+    WIFI_POWER_7dBm = 28,
+    WIFI_POWER_5dBm = 20,
+    WIFI_POWER_2dBm = 8,
+    WIFI_POWER_MINUS_1dBm = -4
+} wifi_power_t;
+
+typedef enum
+{
+    WIFI_PKT_MGMT = 0,
+    WIFI_PKT_CTRL,
+    WIFI_PKT_DATA,
+    WIFI_PKT_MISC,
+} wifi_promiscuous_pkt_type_t;
+
+#define WIFI_PROMIS_FILTER_MASK_MGMT (1 << 0)
+
+typedef struct
+{
+    uint32_t filter_mask;
+} wifi_promiscuous_filter_t;
+
+typedef struct
+{
+    signed rssi : 8;
+    unsigned channel : 4;
+    unsigned sig_len : 12;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct
+{
+    wifi_pkt_rx_ctrl_t rx_ctrl;
+    uint8_t payload[0];
+} wifi_promiscuous_pkt_t;
+
+typedef void (*wifi_promiscuous_cb_t)(void *buf, wifi_promiscuous_pkt_type_t type);
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second);
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type);
+esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t *filter);
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb);
+esp_err_t esp_wifi_set_promiscuous(bool en);
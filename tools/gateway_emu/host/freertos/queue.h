@@ -0,0 +1,11 @@
+/***********************************************************************
+ * Filename: queue.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Host stand-in, the whole FreeRTOS API is declared in FreeRTOS.h.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include "freertos/FreeRTOS.h"
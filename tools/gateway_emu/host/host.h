@@ -0,0 +1,68 @@
+/***********************************************************************
+ * Filename: host.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Emulator side of the host build of the feeder firmware. Declares
+ *     the virtual time and the scheduler the firmware tasks run on,
+ *     the loading of the firmware library for one wake, the radio of
+ *     the feeder on the simulated link and the flash that outlives the
+ *     wakes. Time only moves when every task waits, so a run does not
+ *     depend on the speed of the host and repeats exactly.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+#include "host_node.h"
+
+#define HOST_FOREVER INT64_MAX
+
+typedef enum
+{
+    NODE_OFF = 0,
+    NODE_RUNNING,
+    NODE_DEEP_SLEEP,
+    NODE_RESTART,
+} NodeState_t;
+
+class SimLink;
+
+/* Virtual time in microseconds since the start of the emulator */
+int64_t HostNow_us(void);
+/* Runs fn at at_us outside of the firmware tasks, events due at the same time keep their order */
+void HostAt(int64_t at_us, std::function<void()> fn);
+/* Runs tasks and events until stop() returns true (true) or the time reaches until_us (false) */
+bool HostRun(int64_t until_us, std::function<bool()> stop = NULL);
+
+/* Loads the firmware library and starts its loop task, RTC memory is kept unless the reset is a power on */
+bool HostBoot(const char *library, NodeReset_t reason);
+/* Drops the tasks, keeps RTC memory and unloads the library */
+void HostShutdown(void);
+NodeState_t HostNodeState(void);
+int64_t HostBootTime_us(void);
+/* Deep sleep timer as set by the feeder, in microseconds of its RTC clock */
+uint64_t HostSleepTimer_us(void);
+/* Real length of that sleep, the RTC clock of the feeder runs off by the drift */
+int64_t HostSleepTime_us(void);
+void HostSetClockDrift(double ppm);
+void HostSetPairButton(bool pressed);
+void HostSetScale(int32_t raw);
+void HostSetSerialEcho(bool echo);
+
+/* Radio of the feeder */
+void HostRadioAttach(SimLink *link, int station);
+const uint8_t *HostRadioMac(void);
+int64_t HostRadioOn_us(void); // time with Wi-Fi on since the emulator started
+void HostRadioReset(void);
+
+/* Flash of the feeder */
+void HostFlashInit(const std::vector<uint8_t> &firmware);
+void HostFlashBoot(void); // the partition selected by an update runs from the next boot
+const char *HostBootPartition(void);
+bool HostReadRunningImage(std::vector<uint8_t> &image, size_t size);
+size_t HostFileSize(const char *path); // LittleFS file, 0 when missing
+bool HostReadFile(const char *path, std::vector<uint8_t> &data);
@@ -0,0 +1,596 @@
+/***********************************************************************
+ * Filename: host_flash.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Flash of the feeder in the emulator: the two OTA partitions and
+ *     the data partition of the default 4 MB layout of the ESP32-C3,
+ *     the NVS namespaces of Preferences and the files of LittleFS. All
+ *     of it lives in the emulator process, so it outlives the firmware
+ *     library that is loaded again at every wake.
+ *
+ ***********************************************************************/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include "Arduino.h"
+#include "Preferences.h"
+#include "LittleFS.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "host.h"
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PARTITIONS 3
+#define FLASH_APP0 0
+#define FLASH_APP1 1
+#define FLASH_DATA 2
+
+static const esp_partition_t partitions[FLASH_PARTITIONS] = {
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x140000, "app0"},
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000, 0x140000, "app1"},
+    {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, 0x160000, "spiffs"},
+};
+
+static std::vector<uint8_t> flash[FLASH_PARTITIONS];
+static int running = FLASH_APP0;
+static int boot = FLASH_APP0;
+
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs;
+
+struct FsNode
+{
+    bool dir;
+    std::shared_ptr<std::vector<uint8_t>> data;
+};
+
+static std::map<std::string, FsNode> files;
+
+static int partitionIndex(const esp_partition_t *partition)
+{
+    for (int i = 0; i < FLASH_PARTITIONS; i++)
+    {
+        if (partition == &partitions[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool inRange(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return (partitionIndex(partition) >= 0) && (offset <= partition->size) && (size <= partition->size - offset);
+}
+
+void HostFlashInit(const std::vector<uint8_t> &firmware)
+{
+    for (int i = 0; i < FLASH_PARTITIONS; i++)
+    {
+        flash[i].assign(partitions[i].size, 0xFF);
+    }
+    memcpy(flash[FLASH_APP0].data(), firmware.data(), std::min<size_t>(firmware.size(), partitions[FLASH_APP0].size));
+    running = FLASH_APP0;
+    boot = FLASH_APP0;
+    nvs.clear();
+    files.clear();
+    files["/"] = FsNode{true, NULL};
+}
+
+void HostFlashBoot(void)
+{
+    running = boot;
+}
+
+const char *HostBootPartition(void)
+{
+    return partitions[running].label;
+}
+
+bool HostReadRunningImage(std::vector<uint8_t> &image, size_t size)
+{
+    if (size > partitions[running].size)
+    {
+        return false;
+    }
+    image.assign(flash[running].begin(), flash[running].begin() + size);
+    return true;
+}
+
+/*************************************************************************
+ * Partitions
+ *************************************************************************/
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    for (int i = 0; i < FLASH_PARTITIONS; i++)
+    {
+        if ((partitions[i].type == type) && ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (partitions[i].subtype == subtype)) &&
+            ((label == NULL) || (strcmp(label, partitions[i].label) == 0)))
+        {
+            return &partitions[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (!inRange(partition, src_offset, size))
+    {
+        return ESP_FAIL;
+    }
+    memcpy(dst, flash[partitionIndex(partition)].data() + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (!inRange(partition, dst_offset, size))
+    {
+        return ESP_FAIL;
+    }
+    uint8_t *dst = flash[partitionIndex(partition)].data() + dst_offset;
+    for (size_t i = 0; i < size; i++)
+    {
+        dst[i] &= ((const uint8_t *)src)[i]; // a write only clears bits
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (!inRange(partition, offset, size) || (offset % FLASH_SECTOR_SIZE) || (size % FLASH_SECTOR_SIZE))
+    {
+        return ESP_FAIL;
+    }
+    memset(flash[partitionIndex(partition)].data() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &partitions[running];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    int from = (start_from == NULL) ? running : partitionIndex(start_from);
+    return (from == FLASH_APP0) ? &partitions[FLASH_APP1] : &partitions[FLASH_APP0];
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    int idx = partitionIndex(partition);
+    if ((idx < 0) || (partition->type != ESP_PARTITION_TYPE_APP))
+    {
+        return ESP_FAIL;
+    }
+    boot = idx;
+    return ESP_OK;
+}
+
+/*************************************************************************
+ * Preferences
+ *************************************************************************/
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition_label)
+{
+    (void)partition_label;
+    if (started || (name == NULL))
+    {
+        return false;
+    }
+    ns = name;
+    this->readOnly = readOnly;
+    started = true;
+    return true;
+}
+
+void Preferences::end(void)
+{
+    started = false;
+}
+
+bool Preferences::clear(void)
+{
+    if (!started || readOnly)
+    {
+        return false;
+    }
+    nvs[ns.c_str()].clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key)
+{
+    if (!started || readOnly)
+    {
+        return false;
+    }
+    return nvs[ns.c_str()].erase(key) != 0;
+}
+
+bool Preferences::isKey(const char *key) const
+{
+    return get(key, NULL, 0) != 0;
+}
+
+bool Preferences::put(const char *key, const void *value, size_t len)
+{
+    if (!started || readOnly || (key == NULL))
+    {
+        return false;
+    }
+    nvs[ns.c_str()][key].assign((const uint8_t *)value, (const uint8_t *)value + len);
+    return true;
+}
+
+size_t Preferences::get(const char *key, void *value, size_t maxLen) const
+{
+    if (!started || (key == NULL))
+    {
+        return 0;
+    }
+    auto space = nvs.find(ns.c_str());
+    if (space == nvs.end())
+    {
+        return 0;
+    }
+    auto item = space->second.find(key);
+    if (item == space->second.end())
+    {
+        return 0;
+    }
+    if (value != NULL)
+    {
+        if (item->second.size() > maxLen)
+        {
+            return 0;
+        }
+        memcpy(value, item->second.data(), item->second.size());
+    }
+    return item->second.size();
+}
+
+/*************************************************************************
+ * LittleFS
+ *************************************************************************/
+
+namespace fs
+{
+    struct FileImpl
+    {
+        std::string path;
+        bool dir;
+        std::shared_ptr<std::vector<uint8_t>> data;
+        size_t pos;
+        bool readable;
+        bool writable;
+        bool append;
+        bool open;
+        std::vector<std::string> listing; // children when the directory was opened
+        size_t next;
+    };
+}
+
+static std::string normalize(const char *path)
+{
+    std::string p = (path == NULL) ? "" : path;
+    if (p.empty() || (p[0] != '/'))
+    {
+        p = "/" + p;
+    }
+    while ((p.length() > 1) && (p[p.length() - 1] == '/'))
+    {
+        p.erase(p.length() - 1);
+    }
+    return p;
+}
+
+static std::string parentOf(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return (slash == 0) ? "/" : path.substr(0, slash);
+}
+
+static bool isDir(const std::string &path)
+{
+    auto node = files.find(path);
+    return (node != files.end()) && node->second.dir;
+}
+
+static std::vector<std::string> children(const std::string &dir)
+{
+    std::vector<std::string> list;
+    std::string prefix = (dir == "/") ? "/" : dir + "/";
+    for (auto it = files.lower_bound(prefix); (it != files.end()) && (it->first.compare(0, prefix.length(), prefix) == 0); ++it)
+    {
+        if ((it->first != prefix) && (it->first.find('/', prefix.length()) == std::string::npos))
+        {
+            list.push_back(it->first);
+        }
+    }
+    return list;
+}
+
+fs::File::operator bool() const
+{
+    return impl && impl->open;
+}
+
+size_t fs::File::size(void) const
+{
+    return (*this && !impl->dir) ? impl->data->size() : 0;
+}
+
+size_t fs::File::position(void) const
+{
+    return *this ? impl->pos : 0;
+}
+
+bool fs::File::seek(uint32_t pos)
+{
+    if (!*this || impl->dir || (pos > impl->data->size()))
+    {
+        return false;
+    }
+    impl->pos = pos;
+    return true;
+}
+
+int fs::File::available(void)
+{
+    return (*this && !impl->dir && impl->readable) ? (int)(impl->data->size() - impl->pos) : 0;
+}
+
+int fs::File::read(void)
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+size_t fs::File::read(uint8_t *buf, size_t size)
+{
+    if (!*this || impl->dir || !impl->readable)
+    {
+        return 0;
+    }
+    size_t len = std::min(size, impl->data->size() - impl->pos);
+    memcpy(buf, impl->data->data() + impl->pos, len);
+    impl->pos += len;
+    return len;
+}
+
+size_t fs::File::write(const uint8_t *buf, size_t size)
+{
+    if (!*this || impl->dir || !impl->writable)
+    {
+        return 0;
+    }
+    std::vector<uint8_t> &data = *impl->data;
+    if (impl->append)
+    {
+        impl->pos = data.size();
+    }
+    if (impl->pos + size > data.size())
+    {
+        data.resize(impl->pos + size);
+    }
+    memcpy(data.data() + impl->pos, buf, size);
+    impl->pos += size;
+    return size;
+}
+
+void fs::File::close(void)
+{
+    if (impl)
+    {
+        impl->open = false;
+    }
+    impl.reset();
+}
+
+bool fs::File::isDirectory(void) const
+{
+    return *this && impl->dir;
+}
+
+const char *fs::File::name(void) const
+{
+    if (!*this)
+    {
+        return NULL;
+    }
+    return (impl->path == "/") ? impl->path.c_str() : impl->path.c_str() + impl->path.rfind('/') + 1;
+}
+
+const char *fs::File::path(void) const
+{
+    return *this ? impl->path.c_str() : NULL;
+}
+
+fs::File fs::File::openNextFile(const char *mode)
+{
+    while (*this && impl->dir && (impl->next < impl->listing.size()))
+    {
+        File file = LittleFS.open(impl->listing[impl->next++].c_str(), mode);
+        if (file)
+        {
+            return file;
+        }
+    }
+    return File();
+}
+
+void fs::File::rewindDirectory(void)
+{
+    if (*this && impl->dir)
+    {
+        impl->listing = children(impl->path);
+        impl->next = 0;
+    }
+}
+
+bool fs::LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel)
+{
+    (void)formatOnFail;
+    (void)basePath;
+    (void)maxOpenFiles;
+    (void)partitionLabel;
+    if (files.empty())
+    {
+        files["/"] = FsNode{true, NULL};
+    }
+    return true;
+}
+
+void fs::LittleFSFS::end(void)
+{
+}
+
+fs::File fs::LittleFSFS::open(const char *path, const char *mode, bool create)
+{
+    std::string p = normalize(path);
+    std::string m = (mode == NULL) ? "r" : mode;
+    auto node = files.find(p);
+    bool write = (m[0] == 'w') || (m[0] == 'a');
+
+    if (node == files.end())
+    {
+        if (!write)
+        {
+            return File();
+        }
+        if (!isDir(parentOf(p)))
+        {
+            if (!create)
+            {
+                return File();
+            }
+            for (size_t slash = p.find('/', 1); slash != std::string::npos; slash = p.find('/', slash + 1))
+            {
+                mkdir(p.substr(0, slash).c_str());
+            }
+        }
+        node = files.insert(std::make_pair(p, FsNode{false, std::make_shared<std::vector<uint8_t>>()})).first;
+    }
+    else if (node->second.dir && write)
+    {
+        return File();
+    }
+
+    std::shared_ptr<FileImpl> impl = std::make_shared<FileImpl>();
+    impl->path = p;
+    impl->dir = node->second.dir;
+    impl->data = node->second.data;
+    impl->pos = 0;
+    impl->readable = (m[0] == 'r') || (m.find('+') != std::string::npos);
+    impl->writable = write || (m.find('+') != std::string::npos);
+    impl->append = (m[0] == 'a');
+    impl->open = true;
+    impl->next = 0;
+    if (impl->dir)
+    {
+        impl->listing = children(p);
+    }
+    else if (m[0] == 'w')
+    {
+        impl->data->clear();
+    }
+    return File(impl);
+}
+
+bool fs::LittleFSFS::exists(const char *path)
+{
+    return files.count(normalize(path)) != 0;
+}
+
+bool fs::LittleFSFS::remove(const char *path)
+{
+    auto node = files.find(normalize(path));
+    if ((node == files.end()) || node->second.dir)
+    {
+        return false;
+    }
+    files.erase(node);
+    return true;
+}
+
+bool fs::LittleFSFS::rename(const char *from, const char *to)
+{
+    std::string src = normalize(from);
+    std::string dst = normalize(to);
+    auto node = files.find(src);
+    if ((node == files.end()) || node->second.dir || !isDir(parentOf(dst)) || isDir(dst))
+    {
+        return false;
+    }
+    FsNode moved = node->second;
+    files.erase(node);
+    files[dst] = moved;
+    return true;
+}
+
+bool fs::LittleFSFS::mkdir(const char *path)
+{
+    std::string p = normalize(path);
+    if (files.count(p) != 0)
+    {
+        return isDir(p);
+    }
+    if (!isDir(parentOf(p)))
+    {
+        return false;
+    }
+    files[p] = FsNode{true, NULL};
+    return true;
+}
+
+bool fs::LittleFSFS::rmdir(const char *path)
+{
+    std::string p = normalize(path);
+    if ((p == "/") || !isDir(p) || !children(p).empty())
+    {
+        return false;
+    }
+    files.erase(p);
+    return true;
+}
+
+size_t fs::LittleFSFS::totalBytes(void)
+{
+    return partitions[FLASH_DATA].size;
+}
+
+size_t fs::LittleFSFS::usedBytes(void)
+{
+    size_t used = 0;
+    for (auto it = files.begin(); it != files.end(); ++it)
+    {
+        size_t size = it->second.dir ? 0 : it->second.data->size();
+        used += ((size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE + 1) * FLASH_SECTOR_SIZE;
+    }
+    return used;
+}
+
+fs::LittleFSFS LittleFS;
+
+size_t HostFileSize(const char *path)
+{
+    auto node = files.find(normalize(path));
+    return ((node == files.end()) || node->second.dir) ? 0 : node->second.data->size();
+}
+
+bool HostReadFile(const char *path, std::vector<uint8_t> &data)
+{
+    auto node = files.find(normalize(path));
+    if ((node == files.end()) || node->second.dir)
+    {
+        return false;
+    }
+    data = *node->second.data;
+    return true;
+}
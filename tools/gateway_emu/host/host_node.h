@@ -0,0 +1,37 @@
+/***********************************************************************
+ * Filename: host_node.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Interface between the emulator and the firmware build of the
+ *     feeder. The firmware sources are linked into a shared library
+ *     that the emulator loads at every wake and unloads when the
+ *     feeder goes to deep sleep or restarts, so each wake starts from
+ *     the static initialisation like on the chip. Only the RTC_DATA_ATTR
+ *     section is carried over, NVS, LittleFS and the flash partitions
+ *     are kept by the emulator.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum
+{
+    NODE_RESET_POWERON = 0,
+    NODE_RESET_SOFTWARE,
+    NODE_RESET_DEEPSLEEP,
+} NodeReset_t;
+
+/* Provided by the emulator, called by the feeder */
+NodeReset_t HostResetReason(void);
+bool HostPairButton(void);  // long press of button 2 during this wake
+int32_t HostScale(void);    // raw reading of the load cell
+
+/* Provided by the firmware library, looked up with dlsym() */
+#define NODE_MAIN_SYMBOL "NodeMain"
+#define NODE_RTC_SYMBOL "NodeRtcMemory"
+
+typedef void (*NodeMain_t)(void *param);
+typedef void (*NodeRtcMemory_t)(uint8_t **start, size_t *size);
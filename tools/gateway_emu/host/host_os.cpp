@@ -0,0 +1,702 @@
+/***********************************************************************
+ * Filename: host_os.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Scheduler, FreeRTOS calls and the system part of the Arduino core
+ *     for the host build of the feeder. Tasks are ucontext coroutines,
+ *     a task runs until it blocks in a queue, semaphore, notification
+ *     or delay, then the next ready task runs. Time moves to the next
+ *     timeout or event only when no task is ready. A task that keeps
+ *     polling without blocking is switched out after HOST_SPIN_LIMIT
+ *     calls for one tick, as the tick interrupt would do.
+ *
+ *     The firmware library is loaded for every wake and unloaded at
+ *     deep sleep or restart, the RTC_DATA_ATTR section is saved and
+ *     put back. gettimeofday(), settimeofday() and time() are taken
+ *     over for the whole process and return the RTC clock of the
+ *     feeder, which starts at 0 on power on like on the chip.
+ *
+ ***********************************************************************/
+
+#include <ucontext.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <time.h>
+#include <deque>
+#include <queue>
+#include <string>
+#include "Arduino.h"
+#include "host.h"
+
+#define HOST_STACK_SIZE (256 * 1024)
+#define HOST_SPIN_LIMIT 1000
+#define HOST_TICK_US 1000
+
+struct HostTask
+{
+    ucontext_t ctx;
+    std::vector<uint8_t> stack;
+    TaskFunction_t fn;
+    void *param;
+    std::string name;
+    std::function<bool()> ready; // condition the task waits for
+    int64_t deadline_us;
+    bool blocked;
+    bool deleted;
+    uint32_t spins;
+    bool notifyPending;
+    uint32_t notifyValue;
+};
+
+struct HostQueue
+{
+    size_t itemSize;
+    size_t length;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+typedef struct
+{
+    int64_t at_us;
+    uint64_t order;
+    std::function<void()> fn;
+} HostEvent_t;
+
+struct HostEventLater
+{
+    bool operator()(const HostEvent_t &a, const HostEvent_t &b) const
+    {
+        return (a.at_us != b.at_us) ? (a.at_us > b.at_us) : (a.order > b.order);
+    }
+};
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static int64_t now_us = 0;
+static uint64_t eventOrder = 0;
+static std::priority_queue<HostEvent_t, std::vector<HostEvent_t>, HostEventLater> events;
+static std::vector<HostTask *> tasks;
+static std::vector<HostQueue *> queues;
+static HostTask *current = NULL;
+static ucontext_t schedulerCtx;
+
+static void *library = NULL;
+static std::vector<uint8_t> rtcMemory;
+static NodeState_t nodeState = NODE_OFF;
+static NodeReset_t resetReason = NODE_RESET_POWERON;
+static int64_t bootAt_us = 0;
+static uint64_t sleepTimer_us = 0;
+static double clockDrift_ppm = 0;
+static bool pairButton = false;
+static int32_t scale = 0;
+static bool serialEcho = false;
+static bool lineStart = true;
+
+/* RTC clock of the feeder, clockBase_us at clockAt_us, it stands still while the library is unloaded */
+static int64_t clockBase_us = 0;
+static int64_t clockAt_us = 0;
+
+static int64_t nodeClock_us(void)
+{
+    return clockBase_us + ((nodeState == NODE_RUNNING) ? (now_us - clockAt_us) : 0);
+}
+
+/*
+ * Waits until ready() holds or timeout_us passes, -1 = forever. Outside
+ * of a task (events, static constructors) and with no timeout it only
+ * checks, like a FreeRTOS call from an ISR.
+ */
+static bool waitFor(const std::function<bool()> &ready, int64_t timeout_us)
+{
+    if (ready())
+    {
+        if (current != NULL)
+        {
+            current->spins = 0;
+        }
+        return true;
+    }
+    if (current == NULL)
+    {
+        return false;
+    }
+    HostTask *task = current;
+    if (timeout_us == 0)
+    {
+        if (++task->spins < HOST_SPIN_LIMIT)
+        {
+            return false;
+        }
+        timeout_us = HOST_TICK_US;
+    }
+    task->spins = 0;
+    task->ready = ready;
+    task->deadline_us = (timeout_us < 0) ? HOST_FOREVER : (now_us + timeout_us);
+    task->blocked = true;
+    swapcontext(&task->ctx, &schedulerCtx);
+    task->blocked = false;
+    task->ready = NULL;
+    return ready();
+}
+
+static int64_t ticksToUs(TickType_t ticks)
+{
+    return (ticks == portMAX_DELAY) ? -1 : (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+static void taskEntry(void)
+{
+    HostTask *task = current;
+    task->fn(task->param);
+    /* A FreeRTOS task must not return, it is deleted like vTaskDelete(NULL) */
+    task->deleted = true;
+    swapcontext(&task->ctx, &schedulerCtx);
+}
+
+static bool runnable(HostTask *task)
+{
+    if (task->deleted)
+    {
+        return false;
+    }
+    return !task->blocked || (task->deadline_us <= now_us) || task->ready();
+}
+
+static void reapTasks(void)
+{
+    for (size_t i = 0; i < tasks.size();)
+    {
+        if (tasks[i]->deleted)
+        {
+            delete tasks[i];
+            tasks.erase(tasks.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+int64_t HostNow_us(void)
+{
+    return now_us;
+}
+
+void HostAt(int64_t at_us, std::function<void()> fn)
+{
+    HostEvent_t event;
+    event.at_us = std::max(at_us, now_us);
+    event.order = eventOrder++;
+    event.fn = fn;
+    events.push(event);
+}
+
+bool HostRun(int64_t until_us, std::function<bool()> stop)
+{
+    while (true)
+    {
+        if (stop && stop())
+        {
+            return true;
+        }
+        bool ran = false;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            HostTask *task = tasks[i];
+            if (runnable(task))
+            {
+                current = task;
+                swapcontext(&schedulerCtx, &task->ctx);
+                current = NULL;
+                ran = true;
+                if (stop && stop())
+                {
+                    /* Deep sleep or restart stops the other tasks on the spot */
+                    return true;
+                }
+            }
+        }
+        reapTasks();
+        if (!events.empty() && (events.top().at_us <= now_us))
+        {
+            HostEvent_t event = events.top();
+            events.pop();
+            event.fn();
+            continue;
+        }
+        if (ran)
+        {
+            continue;
+        }
+
+        int64_t next = events.empty() ? HOST_FOREVER : events.top().at_us;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            if (!tasks[i]->deleted && tasks[i]->blocked)
+            {
+                next = std::min(next, tasks[i]->deadline_us);
+            }
+        }
+        if (next > until_us)
+        {
+            now_us = std::max(now_us, until_us);
+            return false;
+        }
+        now_us = next;
+    }
+}
+
+bool HostBoot(const char *path, NodeReset_t reason)
+{
+    if (library != NULL)
+    {
+        HostShutdown();
+    }
+    HostFlashBoot();
+    resetReason = reason;
+    if (reason == NODE_RESET_POWERON)
+    {
+        clockBase_us = 0;
+        rtcMemory.clear();
+    }
+    else if (reason == NODE_RESET_DEEPSLEEP)
+    {
+        clockBase_us += sleepTimer_us;
+    }
+    sleepTimer_us = 0;
+    clockAt_us = now_us;
+    bootAt_us = now_us;
+    lineStart = true;
+
+    /* Static constructors of the firmware run here */
+    nodeState = NODE_RUNNING;
+    library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL)
+    {
+        fprintf(stderr, "%s\n", dlerror());
+        nodeState = NODE_OFF;
+        return false;
+    }
+    NodeMain_t nodeMain = (NodeMain_t)dlsym(library, NODE_MAIN_SYMBOL);
+    NodeRtcMemory_t nodeRtc = (NodeRtcMemory_t)dlsym(library, NODE_RTC_SYMBOL);
+    if ((nodeMain == NULL) || (nodeRtc == NULL))
+    {
+        fprintf(stderr, "%s: missing %s or %s\n", path, NODE_MAIN_SYMBOL, NODE_RTC_SYMBOL);
+        HostShutdown();
+        return false;
+    }
+    uint8_t *rtc;
+    size_t rtcSize;
+    nodeRtc(&rtc, &rtcSize);
+    if (rtcMemory.size() == rtcSize)
+    {
+        memcpy(rtc, rtcMemory.data(), rtcSize);
+    }
+    xTaskCreateUniversal(nodeMain, "loopTask", getArduinoLoopTaskStackSize(), NULL, 1, NULL, ARDUINO_RUNNING_CORE);
+    return true;
+}
+
+void HostShutdown(void)
+{
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        delete tasks[i];
+    }
+    tasks.clear();
+    HostRadioReset();
+    clockBase_us = nodeClock_us();
+    clockAt_us = now_us;
+    if (nodeState == NODE_RUNNING)
+    {
+        nodeState = NODE_OFF;
+    }
+
+    if (library != NULL)
+    {
+        NodeRtcMemory_t nodeRtc = (NodeRtcMemory_t)dlsym(library, NODE_RTC_SYMBOL);
+        if (nodeRtc != NULL)
+        {
+            uint8_t *rtc;
+            size_t rtcSize;
+            nodeRtc(&rtc, &rtcSize);
+            rtcMemory.assign(rtc, rtc + rtcSize);
+        }
+        /* Static destructors of the firmware run here */
+        dlclose(library);
+        library = NULL;
+    }
+    for (size_t i = 0; i < queues.size(); i++)
+    {
+        delete queues[i];
+    }
+    queues.clear();
+}
+
+NodeState_t HostNodeState(void)
+{
+    return nodeState;
+}
+
+int64_t HostBootTime_us(void)
+{
+    return bootAt_us;
+}
+
+uint64_t HostSleepTimer_us(void)
+{
+    return sleepTimer_us;
+}
+
+int64_t HostSleepTime_us(void)
+{
+    return (int64_t)(sleepTimer_us / (1.0 + clockDrift_ppm / 1e6));
+}
+
+void HostSetClockDrift(double ppm)
+{
+    clockDrift_ppm = ppm;
+}
+
+void HostSetPairButton(bool pressed)
+{
+    pairButton = pressed;
+}
+
+void HostSetScale(int32_t raw)
+{
+    scale = raw;
+}
+
+void HostSetSerialEcho(bool echo)
+{
+    serialEcho = echo;
+}
+
+/* host_node.h, called by the feeder */
+NodeReset_t HostResetReason(void)
+{
+    return resetReason;
+}
+
+bool HostPairButton(void)
+{
+    bool pressed = pairButton;
+    pairButton = false;
+    return pressed;
+}
+
+int32_t HostScale(void)
+{
+    return scale;
+}
+
+/* Arduino core */
+void HostSerialWrite(const char *text, size_t len)
+{
+    if (!serialEcho)
+    {
+        return;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (lineStart)
+        {
+            printf("%10.3f  ", now_us / 1e6);
+            lineStart = false;
+        }
+        putchar(text[i]);
+        lineStart = (text[i] == '\n');
+    }
+}
+
+void EspClass::restart(void)
+{
+    nodeState = NODE_RESTART;
+    waitFor([]() { return false; }, -1);
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t)((now_us - bootAt_us) / 1000);
+}
+
+uint32_t micros(void)
+{
+    return (uint32_t)(now_us - bootAt_us);
+}
+
+void delay(uint32_t ms)
+{
+    waitFor([]() { return false; }, (int64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    waitFor([]() { return false; }, us);
+}
+
+/* esp_sleep.h */
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return (resetReason == NODE_RESET_DEEPSLEEP) ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+int esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    sleepTimer_us = time_in_us;
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    nodeState = NODE_DEEP_SLEEP;
+    waitFor([]() { return false; }, -1);
+}
+
+/* Time of the feeder for the whole process, see the file header */
+extern "C" int gettimeofday(struct timeval *tv, void *tz) noexcept
+{
+    (void)tz;
+    int64_t t_us = nodeClock_us();
+    tv->tv_sec = (time_t)(t_us / 1000000LL);
+    tv->tv_usec = (suseconds_t)(t_us % 1000000LL);
+    return 0;
+}
+
+extern "C" int settimeofday(const struct timeval *tv, const struct timezone *tz) noexcept
+{
+    (void)tz;
+    if (tv != NULL)
+    {
+        clockBase_us = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+        clockAt_us = now_us;
+    }
+    return 0;
+}
+
+extern "C" time_t time(time_t *t) noexcept
+{
+    time_t sec = (time_t)(nodeClock_us() / 1000000LL);
+    if (t != NULL)
+    {
+        *t = sec;
+    }
+    return sec;
+}
+
+/* FreeRTOS */
+BaseType_t xTaskCreateUniversal(TaskFunction_t fn, const char *name, uint32_t stackDepth, void *param, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)stackDepth;
+    (void)priority;
+    (void)core;
+    HostTask *task = new HostTask();
+    task->stack.resize(HOST_STACK_SIZE);
+    task->fn = fn;
+    task->param = param;
+    task->name = name;
+    task->deadline_us = HOST_FOREVER;
+    getcontext(&task->ctx);
+    task->ctx.uc_stack.ss_sp = task->stack.data();
+    task->ctx.uc_stack.ss_size = task->stack.size();
+    task->ctx.uc_link = NULL;
+    makecontext(&task->ctx, taskEntry, 0);
+    tasks.push_back(task);
+    if (handle != NULL)
+    {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if ((task == NULL) || (task == current))
+    {
+        current->deleted = true;
+        swapcontext(&current->ctx, &schedulerCtx);
+        return;
+    }
+    task->deleted = true;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    waitFor([]() { return false; }, ticksToUs(ticks));
+}
+
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)((now_us - bootAt_us) / (portTICK_PERIOD_MS * 1000));
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    switch (action)
+    {
+    case eSetBits:
+        task->notifyValue |= value;
+        break;
+    case eIncrement:
+        task->notifyValue++;
+        break;
+    case eSetValueWithOverwrite:
+        task->notifyValue = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->notifyPending)
+        {
+            return pdFAIL;
+        }
+        task->notifyValue = value;
+        break;
+    case eNoAction:
+    default:
+        break;
+    }
+    task->notifyPending = true;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticks)
+{
+    HostTask *task = current;
+    if (task == NULL)
+    {
+        return pdFALSE;
+    }
+    if (!task->notifyPending)
+    {
+        task->notifyValue &= ~clearOnEntry;
+    }
+    bool notified = waitFor([task]() { return task->notifyPending; }, ticksToUs(ticks));
+    if (value != NULL)
+    {
+        *value = task->notifyValue;
+    }
+    if (!notified)
+    {
+        return pdFALSE;
+    }
+    task->notifyValue &= ~clearOnExit;
+    task->notifyPending = false;
+    return pdTRUE;
+}
+
+BaseType_t xTaskNotifyStateClear(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        task = current;
+    }
+    if (task == NULL)
+    {
+        return pdFALSE;
+    }
+    BaseType_t wasPending = task->notifyPending ? pdTRUE : pdFALSE;
+    task->notifyPending = false;
+    return wasPending;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    HostQueue *queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queues.push_back(queue);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    for (size_t i = 0; i < queues.size(); i++)
+    {
+        if (queues[i] == queue)
+        {
+            queues.erase(queues.begin() + i);
+            delete queue;
+            return;
+        }
+    }
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    if (!waitFor([queue]() { return queue->items.size() < queue->length; }, ticksToUs(ticks)))
+    {
+        return pdFAIL;
+    }
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.push_back(std::vector<uint8_t>(bytes, bytes + queue->itemSize));
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return xQueueSendToBack(queue, item, ticks);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    if (woken != NULL)
+    {
+        *woken = pdFALSE;
+    }
+    return xQueueSendToBack(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    if (!waitFor([queue]() { return !queue->items.empty(); }, ticksToUs(ticks)))
+    {
+        return pdFALSE;
+    }
+    if (queue->itemSize > 0)
+    {
+        memcpy(item, queue->items.front().data(), queue->itemSize);
+    }
+    queue->items.pop_front();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return xQueueSendToBack(sem, NULL, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    return xQueueSendFromISR(sem, NULL, woken);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return xQueueReceive(sem, NULL, ticks);
+}
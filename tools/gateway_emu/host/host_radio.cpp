@@ -0,0 +1,320 @@
+/***********************************************************************
+ * Filename: host_radio.cpp
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     ESP-NOW and Wi-Fi driver of the feeder on the simulated link.
+ *     Frames queue in the driver and go to the air one at a time, the
+ *     send callback reports each with the MAC status in send order.
+ *     The feeder hears a frame only with ESP-NOW up and tuned to the
+ *     channel it was sent on. With the promiscuous mode on, every
+ *     received frame is passed to the promiscuous callback first as
+ *     an 802.11 action frame, so LinkStats gets its RSSI.
+ *
+ ***********************************************************************/
+
+#include <array>
+#include <deque>
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "WiFi.h"
+#include "host.h"
+#include "../sim_link.h"
+
+#define RADIO_DEFAULT_CHANNEL 1
+#define WLAN_HEADER_SIZE 24
+
+typedef struct
+{
+    std::array<uint8_t, 6> dst;
+    std::vector<uint8_t> data;
+} RadioFrame_t;
+
+class NodeRadio : public SimStation
+{
+public:
+    uint8_t mac[6];
+    wifi_mode_t mode;
+    bool nowInit;
+    uint8_t channel;
+    wifi_power_t power;
+    esp_now_recv_cb_t recvCb;
+    esp_now_send_cb_t sendCb;
+    wifi_promiscuous_cb_t promiscuousCb;
+    bool promiscuous;
+    std::vector<std::array<uint8_t, 6>> peers;
+    std::deque<RadioFrame_t> txq;
+    bool txBusy;
+    uint32_t generation; // completions of frames sent before a reset are dropped
+    SimLink *link;
+    int station;
+    int64_t onSince_us;
+    int64_t on_us;
+
+    NodeRadio() : mode(WIFI_OFF), nowInit(false), channel(RADIO_DEFAULT_CHANNEL), power(WIFI_POWER_19_5dBm), recvCb(NULL), sendCb(NULL),
+                  promiscuousCb(NULL), promiscuous(false), txBusy(false), generation(0), link(NULL), station(SIM_FEEDER), onSince_us(0), on_us(0)
+    {
+        static const uint8_t feederMac[6] = {0x34, 0x85, 0x18, 0x00, 0xFE, 0x01};
+        memcpy(mac, feederMac, 6);
+    }
+
+    const uint8_t *Mac(void) const
+    {
+        return mac;
+    }
+
+    bool Listening(uint8_t ch) const
+    {
+        return nowInit && (mode != WIFI_OFF) && (ch == channel);
+    }
+
+    void Deliver(const uint8_t *src, const uint8_t *data, size_t len, int8_t rssi)
+    {
+        if (!nowInit || (mode == WIFI_OFF))
+        {
+            return;
+        }
+        if (promiscuous && (promiscuousCb != NULL))
+        {
+            std::vector<uint8_t> buf(sizeof(wifi_promiscuous_pkt_t) + WLAN_HEADER_SIZE + 4 + len);
+            wifi_promiscuous_pkt_t *pkt = (wifi_promiscuous_pkt_t *)buf.data();
+            pkt->rx_ctrl.rssi = rssi;
+            pkt->rx_ctrl.channel = channel;
+            pkt->rx_ctrl.sig_len = WLAN_HEADER_SIZE + 4 + len;
+            uint8_t *frame = pkt->payload;
+            frame[0] = 0xD0; // action
+            memcpy(&frame[4], mac, 6);
+            memcpy(&frame[10], src, 6);
+            memset(&frame[16], 0xFF, 6);
+            static const uint8_t body[4] = {0x7F, 0x18, 0xFE, 0x34};
+            memcpy(&frame[WLAN_HEADER_SIZE], body, sizeof(body));
+            memcpy(&frame[WLAN_HEADER_SIZE + 4], data, len);
+            promiscuousCb(pkt, WIFI_PKT_MGMT);
+        }
+        if (recvCb != NULL)
+        {
+            recvCb(src, data, (int)len);
+        }
+    }
+
+    bool hasPeer(const uint8_t *addr) const
+    {
+        for (size_t i = 0; i < peers.size(); i++)
+        {
+            if (memcmp(peers[i].data(), addr, 6) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void startTx(void)
+    {
+        if (txBusy || txq.empty() || (link == NULL))
+        {
+            return;
+        }
+        RadioFrame_t frame = txq.front();
+        txq.pop_front();
+        txBusy = true;
+        uint32_t gen = generation;
+        link->Transmit(station, frame.dst.data(), channel, frame.data.data(), frame.data.size(), [this, gen, frame](bool acked) {
+            if (gen != generation)
+            {
+                return;
+            }
+            txBusy = false;
+            if (sendCb != NULL)
+            {
+                sendCb(frame.dst.data(), acked ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+            }
+            startTx();
+        });
+    }
+
+    void setMode(wifi_mode_t newMode)
+    {
+        if ((mode == WIFI_OFF) && (newMode != WIFI_OFF))
+        {
+            onSince_us = HostNow_us();
+        }
+        else if ((mode != WIFI_OFF) && (newMode == WIFI_OFF))
+        {
+            on_us += HostNow_us() - onSince_us;
+        }
+        mode = newMode;
+    }
+
+    void reset(void)
+    {
+        setMode(WIFI_OFF);
+        nowInit = false;
+        channel = RADIO_DEFAULT_CHANNEL;
+        recvCb = NULL;
+        sendCb = NULL;
+        promiscuousCb = NULL;
+        promiscuous = false;
+        peers.clear();
+        txq.clear();
+        txBusy = false;
+        generation++;
+    }
+};
+
+static NodeRadio radio;
+
+WiFiGenericClass WiFi;
+
+void HostRadioAttach(SimLink *link, int station)
+{
+    radio.link = link;
+    radio.station = station;
+    link->Attach(station, &radio);
+}
+
+const uint8_t *HostRadioMac(void)
+{
+    return radio.mac;
+}
+
+int64_t HostRadioOn_us(void)
+{
+    return radio.on_us + ((radio.mode != WIFI_OFF) ? (HostNow_us() - radio.onSince_us) : 0);
+}
+
+void HostRadioReset(void)
+{
+    radio.reset();
+}
+
+bool WiFiGenericClass::mode(wifi_mode_t mode)
+{
+    radio.setMode(mode);
+    if (mode == WIFI_OFF)
+    {
+        radio.nowInit = false;
+        radio.txq.clear();
+    }
+    return true;
+}
+
+bool WiFiGenericClass::setTxPower(wifi_power_t power)
+{
+    radio.power = power;
+    return radio.mode != WIFI_OFF;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+    (void)second;
+    if ((radio.mode == WIFI_OFF) || (primary < 1) || (primary > 14))
+    {
+        return ESP_FAIL;
+    }
+    radio.channel = primary;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    (void)type;
+    return (radio.mode != WIFI_OFF) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_wifi_set_promiscuous_filter(const wifi_promiscuous_filter_t *filter)
+{
+    (void)filter;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb)
+{
+    radio.promiscuousCb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous(bool en)
+{
+    radio.promiscuous = en;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_init(void)
+{
+    if (radio.mode == WIFI_OFF)
+    {
+        return ESP_FAIL;
+    }
+    radio.nowInit = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void)
+{
+    radio.nowInit = false;
+    radio.recvCb = NULL;
+    radio.sendCb = NULL;
+    radio.peers.clear();
+    radio.txq.clear();
+    radio.txBusy = false;
+    radio.generation++;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb)
+{
+    radio.recvCb = cb;
+    return radio.nowInit ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb)
+{
+    radio.sendCb = cb;
+    return radio.nowInit ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+    if (!radio.nowInit || radio.hasPeer(peer->peer_addr))
+    {
+        return ESP_FAIL;
+    }
+    std::array<uint8_t, 6> addr;
+    memcpy(addr.data(), peer->peer_addr, 6);
+    radio.peers.push_back(addr);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t *peer_addr)
+{
+    for (size_t i = 0; i < radio.peers.size(); i++)
+    {
+        if (memcmp(radio.peers[i].data(), peer_addr, 6) == 0)
+        {
+            radio.peers.erase(radio.peers.begin() + i);
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+esp_err_t esp_now_send(const uint8_t *peer_addr, const uint8_t *data, size_t len)
+{
+    if (!radio.nowInit || (len > ESP_NOW_MAX_DATA_LEN) || !radio.hasPeer(peer_addr))
+    {
+        return ESP_FAIL;
+    }
+    RadioFrame_t frame;
+    memcpy(frame.dst.data(), peer_addr, 6);
+    frame.data.assign(data, data + len);
+    radio.txq.push_back(frame);
+    radio.startTx();
+    return ESP_OK;
+}
+
+esp_err_t esp_now_set_wake_window(uint16_t window)
+{
+    (void)window;
+    return ESP_OK;
+}
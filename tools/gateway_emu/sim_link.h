@@ -0,0 +1,168 @@
+/***********************************************************************
+ * Filename: sim_link.h
+ * Author: Pavel Kejik
+ * Date: 2026-10-18
+ * Description:
+ *     Simulated ESP-NOW link between the gateway and the feeder on the
+ *     virtual time of the emulator. Both share one medium, a frame
+ *     waits for the air to be free, DIFS and a random backoff. A frame
+ *     is heard only by a station listening on its channel, it or its
+ *     MAC ack is lost with the configured probability. The sender
+ *     learns the MAC status after the ack time, the receiver gets the
+ *     frame after the receive path latency and jitter, a share of
+ *     frames is held back to reorder them. Airtime follows 802.11b at
+ *     1 Mbps, the default ESP-NOW rate, one MAC attempt per send.
+ *
+ ***********************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <functional>
+#include "esp_now_proto.h"
+#include "host.h"
+
+#define SIM_STATIONS 2
+#define SIM_GATEWAY 0
+#define SIM_FEEDER 1
+
+/* 802.11b long preamble, vendor action frame carrying ESP-NOW, MAC ack */
+#define AIR_PLCP_US 192
+#define AIR_US_PER_BYTE 8
+#define AIR_FRAME_OVERHEAD 43
+#define AIR_ACK_BYTES 14
+#define AIR_SIFS_US 10
+#define AIR_DIFS_US 50
+#define AIR_SLOT_US 20
+#define AIR_CW_MIN 31
+
+typedef struct
+{
+    double loss;       // probability a frame or its ack is lost
+    double latency_ms; // receive path delay of the peer
+    double jitter_ms;
+    double reorder;    // probability a frame is held back
+    double reorder_ms;
+    int8_t rssi;
+    uint32_t seed;
+} LinkConfig_t;
+
+typedef struct
+{
+    uint32_t frames;  // transmissions including retries
+    uint32_t retries;
+    uint32_t lost;    // the frame or its ack
+    uint32_t unheard; // the peer was off or on another channel
+    uint32_t bytes;   // ESP-NOW payload bytes on the air
+    int64_t airtime_us;
+} LinkStats_t;
+
+class SimStation
+{
+public:
+    virtual ~SimStation() {}
+    virtual const uint8_t *Mac(void) const = 0;
+    virtual bool Listening(uint8_t channel) const = 0;
+    virtual void Deliver(const uint8_t *src, const uint8_t *data, size_t len, int8_t rssi) = 0;
+};
+
+typedef std::function<void(bool acked)> SimSendDone;
+
+class SimLink
+{
+private:
+    LinkConfig_t cfg;
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> uni;
+    SimStation *stations[SIM_STATIONS];
+    std::vector<uint8_t> lastFrame[SIM_STATIONS];
+    int64_t airFreeAt_us;
+
+    double chance(void)
+    {
+        return uni(rng);
+    }
+
+public:
+    LinkStats_t stats;
+
+    explicit SimLink(const LinkConfig_t &config) : cfg(config), rng(config.seed), uni(0.0, 1.0), airFreeAt_us(0)
+    {
+        memset(stations, 0, sizeof(stations));
+        ResetStats();
+    }
+
+    void Attach(int station, SimStation *node)
+    {
+        stations[station] = node;
+    }
+
+    void ResetStats(void)
+    {
+        stats = LinkStats_t();
+    }
+
+    static int64_t Airtime_us(size_t len, bool unicast)
+    {
+        int64_t us = AIR_PLCP_US + (AIR_FRAME_OVERHEAD + len) * AIR_US_PER_BYTE;
+        if (unicast)
+        {
+            us += AIR_SIFS_US + AIR_PLCP_US + AIR_ACK_BYTES * AIR_US_PER_BYTE;
+        }
+        return us;
+    }
+
+    /* Puts a frame on the air, done gets the MAC status, a broadcast is always reported sent */
+    void Transmit(int from, const uint8_t *dst, uint8_t channel, const uint8_t *data, size_t len, SimSendDone done)
+    {
+        static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        bool unicast = memcmp(dst, broadcast, 6) != 0;
+        std::vector<uint8_t> frame(data, data + len);
+        const Message *msg = (const Message *)data;
+
+        int64_t start = std::max(HostNow_us(), airFreeAt_us) + AIR_DIFS_US + (int64_t)(chance() * AIR_CW_MIN) * AIR_SLOT_US;
+        int64_t end = start + AIR_PLCP_US + (AIR_FRAME_OVERHEAD + len) * AIR_US_PER_BYTE;
+        int64_t doneAt = start + Airtime_us(len, unicast);
+        airFreeAt_us = doneAt;
+
+        stats.frames++;
+        stats.retries += ((len >= MESSAGE_HEADER_SIZE) && (msg->seq != 0) && (frame == lastFrame[from])) ? 1 : 0;
+        stats.bytes += len;
+        stats.airtime_us += doneAt - start;
+        lastFrame[from] = frame;
+
+        bool lost = chance() < cfg.loss;
+        bool ackLost = unicast && (chance() < cfg.loss);
+        int64_t delay_us = (int64_t)((cfg.latency_ms + cfg.jitter_ms * chance() + ((chance() < cfg.reorder) ? cfg.reorder_ms : 0)) * 1000);
+        int8_t rssi = cfg.rssi + (int8_t)(chance() * 7) - 3;
+        SimStation *sender = stations[from];
+        SimStation *peer = stations[SIM_STATIONS - 1 - from];
+        std::vector<uint8_t> src(sender->Mac(), sender->Mac() + 6);
+        std::vector<uint8_t> to(dst, dst + 6);
+
+        HostAt(end, [this, peer, src, to, frame, channel, unicast, lost, ackLost, delay_us, rssi, end, doneAt, done]() {
+            bool heard = !lost && peer->Listening(channel) && (!unicast || (memcmp(to.data(), peer->Mac(), 6) == 0));
+            if (lost)
+            {
+                stats.lost++;
+            }
+            else if (!heard)
+            {
+                stats.unheard++;
+            }
+            if (heard)
+            {
+                HostAt(end + delay_us, [peer, src, frame, rssi]() { peer->Deliver(src.data(), frame.data(), frame.size(), rssi); });
+            }
+            bool acked = !unicast || (heard && !ackLost);
+            if (unicast && heard && ackLost)
+            {
+                stats.lost++;
+            }
+            HostAt(doneAt, [done, acked]() { done(acked); });
+        });
+    }
+};